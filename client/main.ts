@@ -1,13 +1,16 @@
 import * as THREE from 'three';
 import { Matrix3, Matrix4, Vector3, Quaternion } from 'three';
 import { decodeQoi, decodeQoiHeader } from './qoi';
-import { TaskListenRequest, TaskRequest, TaskResponse, TaskScheduleRequest, TaskServiceClient } from '@gen/proto/task';
-import { SkyboxRequest, SkyboxResponse } from '@gen/proto/skybox';
+import { TaskCancelRequest, TaskListenRequest, TaskRequest, TaskResponse, TaskScheduleRequest, TaskServiceClient } from '@gen/proto/task';
+import { SkyboxDelta, SkyboxRequest, SkyboxResponse } from '@gen/proto/skybox';
 
 const canvasContainerElement = document.getElementById('canvas-container') as HTMLDivElement
 
 const frontendUrl = `http://${window.location.hostname}:6101`;
 const taskService = new TaskServiceClient(frontendUrl, undefined);
+// Identifies this tab to the frontend, which gives it a universe server stream
+// of its own. Not crypto.randomUUID(), which needs a secure context.
+const taskSessionId = Array.from(crypto.getRandomValues(new Uint8Array(16)), (b) => b.toString(16).padStart(2, '0')).join('')
 
 let time = 0
 
@@ -39,48 +42,163 @@ const TEST_CUBE_MAP: THREE.CubeTexture = (() => {
 const env = createEnvMesh()
 
 let skyboxAtlasBuffer: ArrayBuffer = new ArrayBuffer(0)
+let skyboxMipLevels = 0
+
+// Task ID of the most recently scheduled skybox. Responses to older ones are
+// ignored.
+let latestSkyboxTaskId = 0
+// Task ID of the most recent skybox whose final response has arrived.
+let finishedSkyboxTaskId = 0
+// The skybox currently displayed. Progressive responses may finish fetching out
+// of order, so a coarser one must not replace a finer one of the same task.
+let appliedSkybox = { taskId: 0, resolution: 0, mipLevels: 0 }
+
+async function applySkyboxResponse(taskId: number, skybox: SkyboxResponse) {
+	if (taskId < latestSkyboxTaskId) {
+		return
+	}
+	if (skybox.getIsFinal()) {
+		finishedSkyboxTaskId = Math.max(finishedSkyboxTaskId, taskId)
+	}
+	// A delta with no changed tiles has no image at all.
+	let rspData: ArrayBuffer | undefined = undefined
+	if (skybox.getPath()) {
+		const assetUrl = `http://${window.location.hostname}:8000/static/${skybox.getPath()}`;
+		const rsp = await fetch(assetUrl)
+		rspData = await rsp.arrayBuffer()
+	}
+	if (taskId < appliedSkybox.taskId || (taskId === appliedSkybox.taskId && skybox.getResolution() <= appliedSkybox.resolution)) {
+		return
+	}
+
+	const mipLevels = Math.max(1, skybox.getMipLevels())
+	const delta = skybox.getDelta()
+	if (delta) {
+		if (delta.getBaseTaskId() !== appliedSkybox.taskId || skybox.getResolution() !== appliedSkybox.resolution || mipLevels !== appliedSkybox.mipLevels) {
+			// We don't hold the base anymore. The request carries the skybox we do
+			// hold, which the server no longer has, so it answers with a full image.
+			scheduleSkybox()
+			return
+		}
+		if (rspData) {
+			applySkyboxDelta(delta, rspData, skybox.getResolution())
+		}
+	} else {
+		decodeSkyboxAtlas(rspData!, mipLevels)
+	}
+	appliedSkybox = { taskId, resolution: skybox.getResolution(), mipLevels }
 
-async function applySkyboxResponse(skybox: SkyboxResponse) {
-	const assetUrl = `http://${window.location.hostname}:8000/static/${skybox.getPath()}`;
-	const rsp = await fetch(assetUrl)
-	const rspData = await rsp.arrayBuffer()
+	const texture = env.material.uniforms.envMap!.value as THREE.CubeTexture
+	if (mipLevels > 1) {
+		// WebGLTextures takes the mip levels of all the cube faces from the image of
+		// the first face.
+		Object.assign((texture.images[0] as THREE.DataTexture).image, {
+			mipmaps: unpackSkyboxMips(skyboxAtlasBuffer, skybox.getResolution(), mipLevels),
+		})
+	}
+	texture.needsUpdate = true
+	for (const image of texture.images) {
+		image.needsUpdate = true
+	}
+
+	env.material.needsUpdate = true
+}
 
+function decodeSkyboxAtlas(rspData: ArrayBuffer, mipLevels: number) {
 	const { width: atlasWidth, height: atlasHeight } = decodeQoiHeader(rspData)
-	if (atlasHeight != 6 * atlasWidth) {
-		throw new Error(`Invalid skybox atlas dimensions: ${atlasWidth} x ${atlasHeight}. Expected height to be 6 times the width.`)
+	if (atlasHeight != packedSkyboxHeight(atlasWidth, mipLevels)) {
+		throw new Error(`Invalid skybox atlas dimensions: ${atlasWidth} x ${atlasHeight} with ${mipLevels} mip levels.`)
 	}
-	if (skyboxAtlasBuffer.byteLength !== atlasWidth * atlasHeight * 4) {
+	if (skyboxAtlasBuffer.byteLength !== atlasWidth * atlasHeight * 4 || skyboxMipLevels !== mipLevels) {
 		skyboxAtlasBuffer = new ArrayBuffer(atlasWidth * atlasHeight * 4)
+		skyboxMipLevels = mipLevels
 		const images = new Array<THREE.DataTexture>(6)
 		const imageByteSize = atlasWidth * atlasWidth * 4
 		for (const [i, _] of images.entries()) {
+			// Level 0 comes first and spans entire rows, so it can be used in place.
 			const imageData = new Uint8ClampedArray(skyboxAtlasBuffer, i * imageByteSize, imageByteSize)
 			const image = new THREE.DataTexture(imageData, atlasWidth, atlasWidth, THREE.RGBAFormat)
 			image.flipY = false
 			images[i] = image
 		}
 		const texture = new THREE.CubeTexture(images)
-		texture.generateMipmaps = true
+		// Prefiltered levels from the server are uploaded as they are.
+		texture.generateMipmaps = mipLevels === 1
+		texture.minFilter = THREE.LinearMipmapLinearFilter
 		texture.flipY = true
 		env.material.uniforms.envMap!.value = texture
 	}
 
-	decodeQoi(rspData, { outChannels: 4, outBuffer: skyboxAtlasBuffer, flipX: true })
-	const texture = env.material.uniforms.envMap!.value as THREE.CubeTexture
-	texture.needsUpdate = true
-	for (const image of texture.images) {
-		image.needsUpdate = true
+	decodeQoi(rspData, { outChannels: 4, outBuffer: skyboxAtlasBuffer })
+}
+
+// Overwrites the changed tiles of the current atlas with those in rspData.
+function applySkyboxDelta(delta: SkyboxDelta, rspData: ArrayBuffer, atlasWidth: number) {
+	const tiles = decodeQoi(rspData, { outChannels: 4 })
+	const tileSize = delta.getTileSize()
+	const tileMap = delta.getTileMap_asU8()
+	const atlas = new Uint8ClampedArray(skyboxAtlasBuffer)
+	const atlasHeight = atlas.length / (atlasWidth * 4)
+	const tilesX = Math.ceil(atlasWidth / tileSize)
+	const tilesY = Math.ceil(atlasHeight / tileSize)
+	const tilePixels = new Uint8ClampedArray(tiles.data)
+	let tileRow = 0
+	for (let tileIndex = 0; tileIndex < tilesX * tilesY; ++tileIndex) {
+		if (!(tileMap[tileIndex >> 3]! & (1 << (tileIndex & 7)))) {
+			continue
+		}
+		const x0 = (tileIndex % tilesX) * tileSize
+		const y0 = Math.floor(tileIndex / tilesX) * tileSize
+		for (let y = 0; y < tileSize && y0 + y < atlasHeight; ++y) {
+			for (let x = 0; x < tileSize && x0 + x < atlasWidth; ++x) {
+				const src = ((tileRow + y) * tileSize + x) * 4
+				const dst = ((y0 + y) * atlasWidth + x0 + x) * 4
+				atlas.set(tilePixels.subarray(src, src + 4), dst)
+			}
+		}
+		tileRow += tileSize
 	}
+}
 
-	env.material.needsUpdate = true
+// Height of the image holding the packed mip chain of a skybox, as described
+// in SkyboxResponse.
+function packedSkyboxHeight(size: number, mipLevels: number): number {
+	let height = 0
+	for (let level = 0; level < mipLevels; ++level) {
+		height += 6 * Math.max(1, size >> level)
+	}
+	return height
 }
 
-const taskStream = taskService.listen(new TaskListenRequest())
+// Copies the mip levels after level 0 out of the decoded packed image, in the
+// form expected by three.js for cube textures made of DataTextures.
+function unpackSkyboxMips(buffer: ArrayBuffer, size: number, mipLevels: number) {
+	const packed = new Uint8ClampedArray(buffer)
+	const mipmaps = []
+	let levelRow = 6 * size
+	for (let level = 1; level < mipLevels; ++level) {
+		const levelSize = Math.max(1, size >> level)
+		const faces = []
+		for (let face = 0; face < 6; ++face) {
+			const data = new Uint8ClampedArray(levelSize * levelSize * 4)
+			for (let y = 0; y < levelSize; ++y) {
+				const start = (levelRow + face * levelSize + y) * size * 4
+				data.set(packed.subarray(start, start + levelSize * 4), y * levelSize * 4)
+			}
+			faces.push({ image: { data, width: levelSize, height: levelSize } })
+		}
+		mipmaps.push({ image: faces })
+		levelRow += 6 * levelSize
+	}
+	return mipmaps
+}
+
+const taskStream = taskService.listen(new TaskListenRequest().setSessionId(taskSessionId))
 taskStream.on("data", (rsp) => {
 	console.log("Received task response: ", rsp.toObject())
 	switch (rsp.getVariantCase()) {
 		case TaskResponse.VariantCase.SKYBOX:
-			return applySkyboxResponse(rsp.getSkybox()!)
+			return applySkyboxResponse(rsp.getTaskId(), rsp.getSkybox()!)
 		case TaskResponse.VariantCase.VARIANT_NOT_SET:
 			return console.error("Received empty task response")
 	}
@@ -224,10 +342,18 @@ new ResizeObserver(onCanvasContainerResize).observe(canvasContainerElement)
 
 async function scheduleSkybox(): Promise<void> {
 	const { x, y, z } = camera.position
-	const skyboxRequest = new SkyboxRequest().setPositionList([x, y, z])
-	const scheduleRequest = new TaskScheduleRequest().setRequest(new TaskRequest().setSkybox(skyboxRequest))
+	const skyboxRequest = new SkyboxRequest().setPositionList([x, y, z]).setProgressive(true).setMipmaps(true)
+		.setBaseTaskId(appliedSkybox.taskId)
+		.setBaseResolution(appliedSkybox.resolution)
+	const scheduleRequest = new TaskScheduleRequest().setRequest(new TaskRequest().setSkybox(skyboxRequest)).setSessionId(taskSessionId)
 	const scheduleResponse = await taskService.schedule(scheduleRequest)
+	const previousTaskId = latestSkyboxTaskId
+	latestSkyboxTaskId = Math.max(latestSkyboxTaskId, scheduleResponse.getTaskId())
 	console.log(scheduleResponse)
+	if (previousTaskId > finishedSkyboxTaskId && previousTaskId < latestSkyboxTaskId) {
+		// Its responses would be ignored anyway.
+		await taskService.cancel(new TaskCancelRequest().setTaskIdsList([previousTaskId]).setSessionId(taskSessionId))
+	}
 }
 scheduleSkybox()
 
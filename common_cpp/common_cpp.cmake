@@ -0,0 +1,10 @@
+# Tests of the header-only utilities.
+file(GLOB COMMON_CPP_TEST_SRCS "${PKG_SRC_DIR}/test/*.cpp")
+add_executable(common_cpp_test
+  ${COMMON_CPP_TEST_SRCS}
+  "${PKG_SRC_DIR}/test_main.cpp"
+)
+add_test(NAME common_cpp_test COMMAND common_cpp_test)
+
+# Not a test, run by hand to see what the pixel kernels gain on this CPU.
+add_executable(common_cpp_pixels_bench "${PKG_SRC_DIR}/pixels_bench/pixels_bench.cpp")
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Logging that keeps the threads doing the work off the console. LOG() formats
+// the message on the calling thread and hands it to a background thread that
+// writes it to stdout, so that the caller never waits for the console, nor for
+// another thread logging at the same time.
+//
+//   LOG(INFO) << "Uploaded " << count << " objects";
+//
+// The levels are DEBUG, INFO, WARNING and ERROR. The arguments of a message
+// below the level are not evaluated at all, so a disabled LOG() costs a branch.
+// Levels below LOG_MIN_LEVEL are compiled out, and the rest can be raised at
+// runtime with logging::set_min_level().
+//
+// If messages come faster than the console takes them, the ones that don't fit
+// in the buffer are dropped and counted, rather than blocking the caller.
+namespace logging {
+
+// Prefixed, because a bare ERROR clashes with a macro of <windows.h>. LOG()
+// pastes the prefix on, so it takes the bare names.
+enum Level {
+	LEVEL_DEBUG,
+	LEVEL_INFO,
+	LEVEL_WARNING,
+	LEVEL_ERROR,
+};
+
+}  // namespace logging
+
+#ifndef LOG_MIN_LEVEL
+// Least severe level that is compiled in, e.g. logging::LEVEL_INFO to drop the
+// debug messages from a build.
+#define LOG_MIN_LEVEL logging::LEVEL_DEBUG
+#endif
+
+#define LOG(level)                                                                                                  \
+	if (!::logging::is_enabled(::logging::LEVEL_##level)) {                                                           \
+	} else                                                                                                            \
+		::logging::Message(::logging::LEVEL_##level)
+
+namespace logging {
+
+namespace detail {
+
+inline std::atomic<int> min_level = LEVEL_INFO;
+
+// Bounded multi-producer single-consumer ring of messages, after Dmitry
+// Vyukov's queue. Each slot has a sequence number telling the producers and the
+// consumer whose turn it is, so a producer only ever contends with the others
+// over claiming a position, and never waits for the writer.
+class Writer {
+public:
+	static constexpr size_t CAPACITY = 4096;
+
+	// Takes a batch of whole lines. Called on the writer thread only.
+	typedef std::function<void(const std::string &lines)> Output;
+
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		Level level;
+		std::chrono::system_clock::time_point time;
+		std::string text;
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<size_t> enqueue_position = 0;
+	// Only touched by the writer thread.
+	size_t dequeue_position = 0;
+	// Bumped after each message is in place, for the writer thread to wait on.
+	std::atomic<uint32_t> published_count = 0;
+	// Messages written so far, for flush() to wait on.
+	std::atomic<size_t> written_count = 0;
+	std::atomic<size_t> dropped_count = 0;
+	std::atomic<bool> is_stopping = false;
+	const Output output;
+	std::thread thread;
+
+public:
+	explicit Writer(Output output = write_stdout)
+			: slots(new Slot[CAPACITY]), output(std::move(output)) {
+		for (size_t i = 0; i < CAPACITY; ++i) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		thread = std::thread([this] { work(); });
+	}
+
+	Writer(const Writer &) = delete;
+
+	~Writer() {
+		is_stopping.store(true);
+		published_count.fetch_add(1, std::memory_order_release);
+		published_count.notify_one();
+		thread.join();
+	}
+
+	// Never destroyed, because threads still running during static destruction
+	// may log, and a static instance would be gone under them. What is logged
+	// before exit() is written out.
+	static Writer &instance() {
+		static Writer *const writer = [] {
+			std::atexit([] { writer->flush(); });
+			return new Writer();
+		}();
+		return *writer;
+	}
+
+	void push(Level level, std::string &&text) {
+		const auto time = std::chrono::system_clock::now();
+		size_t position = enqueue_position.load(std::memory_order_relaxed);
+		Slot *slot;
+		while (true) {
+			slot = &slots[position % CAPACITY];
+			const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const ptrdiff_t lag = (ptrdiff_t)sequence - (ptrdiff_t)position;
+			if (lag == 0) {
+				if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (lag < 0) {
+				// The writer hasn't taken the message a lap behind yet.
+				dropped_count.fetch_add(1, std::memory_order_relaxed);
+				return;
+			} else {
+				position = enqueue_position.load(std::memory_order_relaxed);
+			}
+		}
+		slot->level = level;
+		slot->time = time;
+		slot->text = std::move(text);
+		slot->sequence.store(position + 1, std::memory_order_release);
+		published_count.fetch_add(1, std::memory_order_release);
+		published_count.notify_one();
+	}
+
+	void flush() {
+		const size_t target = enqueue_position.load();
+		size_t written = written_count.load();
+		while (written < target) {
+			written_count.wait(written);
+			written = written_count.load();
+		}
+	}
+
+private:
+	void work() {
+		std::string lines;
+		while (true) {
+			const uint32_t published = published_count.load(std::memory_order_acquire);
+			lines.clear();
+			while (true) {
+				Slot &slot = slots[dequeue_position % CAPACITY];
+				if (slot.sequence.load(std::memory_order_acquire) != dequeue_position + 1) {
+					break;
+				}
+				format(slot.level, slot.time, slot.text, lines);
+				slot.text.clear();
+				slot.sequence.store(dequeue_position + CAPACITY, std::memory_order_release);
+				++dequeue_position;
+			}
+			if (const size_t dropped = dropped_count.exchange(0, std::memory_order_relaxed)) {
+				format(LEVEL_WARNING, std::chrono::system_clock::now(),
+						"Dropped " + std::to_string(dropped) + " log messages", lines);
+			}
+			if (!lines.empty()) {
+				output(lines);
+				written_count.store(dequeue_position);
+				written_count.notify_all();
+				continue;
+			}
+			if (is_stopping.load()) {
+				return;
+			}
+			published_count.wait(published, std::memory_order_acquire);
+		}
+	}
+
+	static void write_stdout(const std::string &lines) {
+		std::fwrite(lines.data(), 1, lines.size(), stdout);
+		std::fflush(stdout);
+	}
+
+	// Appends the level letter, UTC time of day and text, e.g.
+	// "I 12:34:56.789 Hello".
+	static void format(Level level, std::chrono::system_clock::time_point time, const std::string &text, std::string &lines) {
+		static constexpr char LEVEL_LETTERS[] = "DIWE";
+		const auto since_midnight = time.time_since_epoch() % std::chrono::days(1);
+		const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(since_midnight).count();
+		char prefix[32];
+		const int prefix_length = std::snprintf(
+				prefix, sizeof(prefix), "%c %02lld:%02lld:%02lld.%03lld ",
+				LEVEL_LETTERS[level], ms / 3'600'000, ms / 60'000 % 60, ms / 1000 % 60, ms % 1000);
+		lines.append(prefix, prefix_length);
+		lines += text;
+		lines += '\n';
+	}
+};
+
+}  // namespace detail
+
+inline bool is_enabled(Level level) {
+	return level >= LOG_MIN_LEVEL && level >= detail::min_level.load(std::memory_order_relaxed);
+}
+
+// Messages below the level are skipped from now on. INFO by default.
+inline void set_min_level(Level level) {
+	detail::min_level.store(level, std::memory_order_relaxed);
+}
+
+// Parses "debug", "info", "warning" or "error". Returns false if it is none.
+inline bool parse_level(const std::string &name, Level &level) {
+	static constexpr std::pair<const char *, Level> NAMES[] = {
+		{"debug", LEVEL_DEBUG},
+		{"info", LEVEL_INFO},
+		{"warning", LEVEL_WARNING},
+		{"error", LEVEL_ERROR},
+	};
+	for (const auto &[n, l] : NAMES) {
+		if (name == n) {
+			level = l;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Blocks until the messages logged so far are written, e.g. before exiting
+// abruptly.
+inline void flush() {
+	detail::Writer::instance().flush();
+}
+
+// A message being formatted, handed to the writer once complete. Only meant to
+// be created by LOG().
+class Message {
+	const Level level;
+	std::ostringstream stream;
+
+public:
+	explicit Message(Level level)
+			: level(level) { }
+	Message(const Message &) = delete;
+	~Message() { detail::Writer::instance().push(level, std::move(stream).str()); }
+
+	template <typename T>
+	Message &operator<<(const T &value) {
+		stream << value;
+		return *this;
+	}
+};
+
+}  // namespace logging
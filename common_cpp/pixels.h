@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COMMON_PIXELS_X86 1
+#define COMMON_PIXELS_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+#define COMMON_PIXELS_X86 1
+#define COMMON_PIXELS_MSVC 1
+// MSVC compiles the intrinsics of any instruction set without flags.
+#define COMMON_PIXELS_TARGET(isa)
+#endif
+
+// Kernels for repacking pixels read back from the GPU into what gets encoded.
+// GPUs read back fastest in their native 4-byte formats, while images are
+// encoded as 3-byte RGB.
+//
+// On x86, with GCC, Clang or MSVC, the kernels use AVX2 or SSSE3, whichever
+// the CPU supports, and plain loops otherwise.
+namespace pixels {
+
+namespace detail {
+
+// Converts count 4-byte pixels into RGB. R, G and B are at the given byte
+// offsets within a pixel, and the remaining byte is dropped. If mirrored, the
+// last source pixel becomes the first.
+template <int R, int G, int B>
+void to_rgb_scalar(const uint8_t *src, uint8_t *dst, size_t count, bool is_mirrored) {
+	for (size_t i = 0; i < count; ++i) {
+		const uint8_t *s = src + 4 * (is_mirrored ? count - 1 - i : i);
+		dst[3 * i] = s[R];
+		dst[3 * i + 1] = s[G];
+		dst[3 * i + 2] = s[B];
+	}
+}
+
+#ifdef COMMON_PIXELS_X86
+
+// Shuffle mask packing the RGB of four pixels into the low 12 bytes, in
+// reverse order if mirrored.
+template <int R, int G, int B>
+inline __m128i rgb_mask(bool is_mirrored) {
+	alignas(16) int8_t mask[16];
+	for (int i = 0; i < 4; ++i) {
+		const int p = 4 * (is_mirrored ? 3 - i : i);
+		mask[3 * i] = p + R;
+		mask[3 * i + 1] = p + G;
+		mask[3 * i + 2] = p + B;
+	}
+	for (int i = 12; i < 16; ++i) {
+		mask[i] = -1;
+	}
+	return _mm_load_si128(reinterpret_cast<const __m128i *>(mask));
+}
+
+// Four pixels per step. Each store writes 16 bytes of which 12 are pixels, so
+// the last few pixels are left to the scalar loop to stay within dst.
+template <int R, int G, int B>
+COMMON_PIXELS_TARGET("ssse3") void to_rgb_ssse3(const uint8_t *src, uint8_t *dst, size_t count, bool is_mirrored) {
+	const __m128i mask = rgb_mask<R, G, B>(is_mirrored);
+	size_t i = 0;
+	for (; i + 6 <= count; i += 4) {
+		const size_t s = is_mirrored ? count - 4 - i : i;
+		const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * s));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 3 * i), _mm_shuffle_epi8(in, mask));
+	}
+	if (is_mirrored) {
+		to_rgb_scalar<R, G, B>(src, dst + 3 * i, count - i, true);
+	} else {
+		to_rgb_scalar<R, G, B>(src + 4 * i, dst + 3 * i, count - i, false);
+	}
+}
+
+// Eight pixels per step: the 128-bit lanes are shuffled like in the SSSE3
+// kernel, and then the 12 bytes of the upper lane are moved right after those
+// of the lower one. Mirroring reverses the pixels up front.
+template <int R, int G, int B>
+COMMON_PIXELS_TARGET("avx2") void to_rgb_avx2(const uint8_t *src, uint8_t *dst, size_t count, bool is_mirrored) {
+	const __m128i lane_mask = rgb_mask<R, G, B>(false);
+	const __m256i mask = _mm256_broadcastsi128_si256(lane_mask);
+	const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	size_t i = 0;
+	for (; i + 11 <= count; i += 8) {
+		const size_t s = is_mirrored ? count - 8 - i : i;
+		__m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * s));
+		if (is_mirrored) {
+			in = _mm256_permutevar8x32_epi32(in, reverse);
+		}
+		const __m256i out = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(in, mask), compact);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 3 * i), out);
+	}
+	if (is_mirrored) {
+		to_rgb_ssse3<R, G, B>(src, dst + 3 * i, count - i, true);
+	} else {
+		to_rgb_ssse3<R, G, B>(src + 4 * i, dst + 3 * i, count - i, false);
+	}
+}
+
+#ifdef COMMON_PIXELS_MSVC
+
+inline bool has_avx2() {
+	static const bool has = [] {
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		__cpuid(info, 1);
+		// AVX, and the OS saves the YMM registers.
+		const bool has_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		return has_avx && (info[1] & (1 << 5));
+	}();
+	return has;
+}
+
+inline bool has_ssse3() {
+	static const bool has = [] {
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+	}();
+	return has;
+}
+
+#else
+
+inline bool has_avx2() {
+	static const bool has = __builtin_cpu_supports("avx2");
+	return has;
+}
+
+inline bool has_ssse3() {
+	static const bool has = __builtin_cpu_supports("ssse3");
+	return has;
+}
+
+#endif  // COMMON_PIXELS_MSVC
+
+#endif  // COMMON_PIXELS_X86
+
+template <int R, int G, int B>
+void to_rgb(const uint8_t *src, uint8_t *dst, size_t count, bool is_mirrored) {
+#ifdef COMMON_PIXELS_X86
+	if (has_avx2()) {
+		return to_rgb_avx2<R, G, B>(src, dst, count, is_mirrored);
+	}
+	if (has_ssse3()) {
+		return to_rgb_ssse3<R, G, B>(src, dst, count, is_mirrored);
+	}
+#endif
+	to_rgb_scalar<R, G, B>(src, dst, count, is_mirrored);
+}
+
+}  // namespace detail
+
+// Drops the alpha of count RGBA pixels. If mirrored, the pixels are also
+// reversed, which flips a row horizontally at no extra cost. The source and
+// destination must not overlap.
+inline void rgba_to_rgb(const uint8_t *src, uint8_t *dst, size_t count, bool is_mirrored = false) {
+	detail::to_rgb<0, 1, 2>(src, dst, count, is_mirrored);
+}
+
+// Same as rgba_to_rgb(), for BGRA pixels.
+inline void bgra_to_rgb(const uint8_t *src, uint8_t *dst, size_t count, bool is_mirrored = false) {
+	detail::to_rgb<2, 1, 0>(src, dst, count, is_mirrored);
+}
+
+}  // namespace pixels
+
+#undef COMMON_PIXELS_X86
+#undef COMMON_PIXELS_MSVC
+#undef COMMON_PIXELS_TARGET
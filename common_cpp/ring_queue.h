@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// FIFO queue in a ring buffer that only grows. Once it has grown to the
+// longest the queue gets, pushing and popping never allocate, unlike
+// std::queue over std::deque, which allocates and frees blocks as elements
+// pass through.
+template <typename T>
+class RingQueue {
+	// Size is 0 or a power of two.
+	std::vector<T> slots;
+	size_t head = 0;
+	size_t count = 0;
+
+public:
+	RingQueue() = default;
+
+	explicit RingQueue(size_t capacity) { reserve(capacity); }
+
+	RingQueue(const RingQueue &) = default;
+	RingQueue &operator=(const RingQueue &) = default;
+
+	// Leaves the other queue empty.
+	RingQueue(RingQueue &&other) noexcept
+			: slots(std::move(other.slots))
+			, head(std::exchange(other.head, 0))
+			, count(std::exchange(other.count, 0)) {
+		other.slots.clear();
+	}
+	RingQueue &operator=(RingQueue &&other) noexcept {
+		slots = std::move(other.slots);
+		other.slots.clear();
+		head = std::exchange(other.head, 0);
+		count = std::exchange(other.count, 0);
+		return *this;
+	}
+
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+
+	T &front() { return slots[head]; }
+	const T &front() const { return slots[head]; }
+
+	void push(T &&value) {
+		if (count == slots.size()) {
+			reserve(count + 1);
+		}
+		at(count) = std::move(value);
+		++count;
+	}
+
+	void push(const T &value) { push(T(value)); }
+
+	void pop() {
+		slots[head] = T();
+		head = (head + 1) & (slots.size() - 1);
+		--count;
+	}
+
+	// Removes the elements for which the predicate holds, keeping the order of
+	// the rest. Returns how many were removed.
+	template <typename Predicate>
+	size_t erase_if(Predicate predicate) {
+		size_t kept = 0;
+		for (size_t i = 0; i < count; ++i) {
+			T &value = at(i);
+			if (predicate(std::as_const(value))) {
+				continue;
+			}
+			if (kept != i) {
+				at(kept) = std::move(value);
+			}
+			++kept;
+		}
+		for (size_t i = kept; i < count; ++i) {
+			at(i) = T();
+		}
+		const size_t erased = count - kept;
+		count = kept;
+		return erased;
+	}
+
+	// Makes room for at least capacity elements.
+	void reserve(size_t capacity) {
+		if (capacity <= slots.size()) {
+			return;
+		}
+		std::vector<T> next(std::bit_ceil(std::max<size_t>(capacity, 8)));
+		for (size_t i = 0; i < count; ++i) {
+			next[i] = std::move(at(i));
+		}
+		slots = std::move(next);
+		head = 0;
+	}
+
+private:
+	T &at(size_t i) { return slots[(head + i) & (slots.size() - 1)]; }
+};
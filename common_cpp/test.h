@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdio>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Minimal unit tests, without dependencies. A test is a function declared with
+// TEST(), which checks its expectations with EXPECT() and EXPECT_EQ():
+//
+//   TEST(addition) {
+//     EXPECT_EQ(1 + 1, 2);
+//   }
+//
+// A failed expectation is reported and the test goes on, so that one run shows
+// all the failures. test::run_all() runs every test linked in; test_main.cpp
+// calls it.
+namespace test {
+
+namespace detail {
+
+struct Test {
+	const char *name;
+	void (*function)();
+};
+
+inline std::vector<Test> &registry() {
+	static std::vector<Test> tests;
+	return tests;
+}
+
+inline int &failure_count() {
+	static int count = 0;
+	return count;
+}
+
+inline bool register_test(const char *name, void (*function)()) {
+	registry().push_back({name, function});
+	return true;
+}
+
+inline void fail(const char *file, int line, const std::string &message) {
+	std::fprintf(stderr, "%s:%d: %s\n", file, line, message.c_str());
+	++failure_count();
+}
+
+template <typename T>
+std::string to_string(const T &value) {
+	std::ostringstream out;
+	if constexpr (requires { out << value; }) {
+		out << value;
+	} else {
+		out << "?";
+	}
+	return out.str();
+}
+
+}  // namespace detail
+
+// Runs the tests whose name contains filter, all of them if empty. Returns the
+// exit code: 0 if they all passed.
+inline int run_all(const std::string &filter = "") {
+	int failed_test_count = 0;
+	int run_count = 0;
+	for (const detail::Test &test : detail::registry()) {
+		if (!filter.empty() && std::string(test.name).find(filter) == std::string::npos) {
+			continue;
+		}
+		++run_count;
+		const int failures_before = detail::failure_count();
+		try {
+			test.function();
+		} catch (const std::exception &e) {
+			detail::fail(__FILE__, __LINE__, std::string("Uncaught exception: ") + e.what());
+		}
+		const bool passed = detail::failure_count() == failures_before;
+		std::fprintf(stderr, "%s %s\n", passed ? "PASS" : "FAIL", test.name);
+		failed_test_count += !passed;
+	}
+	std::fprintf(stderr, "%d of %d tests passed\n", run_count - failed_test_count, run_count);
+	return failed_test_count == 0 ? 0 : 1;
+}
+
+}  // namespace test
+
+#define TEST(name)                                                                                                  \
+	static void name##_test();                                                                                        \
+	static const bool name##_is_registered = ::test::detail::register_test(#name, name##_test);                       \
+	static void name##_test()
+
+#define EXPECT(condition)                                                                                           \
+	do {                                                                                                              \
+		if (!(condition)) {                                                                                             \
+			::test::detail::fail(__FILE__, __LINE__, "Expected " #condition);                                             \
+		}                                                                                                               \
+	} while (false)
+
+#define EXPECT_EQ(actual, expected)                                                                                 \
+	do {                                                                                                              \
+		const auto &_actual = (actual);                                                                                 \
+		const auto &_expected = (expected);                                                                             \
+		if (!(_actual == _expected)) {                                                                                  \
+			::test::detail::fail(                                                                                         \
+					__FILE__, __LINE__,                                                                                       \
+					"Expected " #actual " == " #expected ", got " + ::test::detail::to_string(_actual) + " vs "               \
+							+ ::test::detail::to_string(_expected));                                                              \
+		}                                                                                                               \
+	} while (false)
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <common_cpp/log.h>
+#include <common_cpp/test.h>
+
+using logging::detail::Writer;
+
+TEST(log_skips_the_operands_of_disabled_messages) {
+	int evaluation_count = 0;
+	const auto evaluate = [&] { return ++evaluation_count; };
+	logging::set_min_level(logging::LEVEL_ERROR);
+	LOG(DEBUG) << evaluate();
+	LOG(INFO) << evaluate();
+	LOG(WARNING) << evaluate() << evaluate();
+	logging::set_min_level(logging::LEVEL_INFO);
+	EXPECT_EQ(evaluation_count, 0);
+}
+
+TEST(log_flush_waits_for_every_message) {
+	std::mutex mutex;
+	std::string written;
+	Writer writer([&](const std::string &lines) {
+		// Slow, so that the writer is still behind when flush() is called.
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		std::lock_guard lock(mutex);
+		written += lines;
+	});
+	for (int i = 0; i < 100; ++i) {
+		writer.push(logging::LEVEL_INFO, "message " + std::to_string(i));
+	}
+	writer.flush();
+	std::lock_guard lock(mutex);
+	EXPECT_EQ(std::count(written.begin(), written.end(), '\n'), 100);
+	EXPECT(written.find("message 99\n") != std::string::npos);
+}
+
+TEST(log_drops_and_counts_messages_that_dont_fit) {
+	std::atomic<bool> is_writing = false;
+	std::atomic<bool> is_released = false;
+	std::mutex mutex;
+	std::string written;
+	Writer writer([&](const std::string &lines) {
+		is_writing.store(true);
+		is_writing.notify_all();
+		is_released.wait(false);
+		std::lock_guard lock(mutex);
+		written += lines;
+	});
+	// Holds the writer thread in the output, so that nothing is taken off the
+	// buffer while the producers fill it.
+	writer.push(logging::LEVEL_INFO, "first");
+	is_writing.wait(false);
+
+	constexpr int PRODUCER_COUNT = 4;
+	std::vector<std::thread> producers;
+	for (int i = 0; i < PRODUCER_COUNT; ++i) {
+		producers.emplace_back([&] {
+			for (size_t j = 0; j < Writer::CAPACITY; ++j) {
+				writer.push(logging::LEVEL_INFO, "filler");
+			}
+		});
+	}
+	// Returns at all only if the producers don't wait for room.
+	for (std::thread &producer : producers) {
+		producer.join();
+	}
+	is_released.store(true);
+	is_released.notify_all();
+	writer.flush();
+
+	std::lock_guard lock(mutex);
+	const size_t dropped_count = (PRODUCER_COUNT - 1) * Writer::CAPACITY;
+	EXPECT_EQ((size_t)std::count(written.begin(), written.end(), '\n'), 1 + Writer::CAPACITY + 1);
+	EXPECT(written.find("Dropped " + std::to_string(dropped_count) + " log messages\n") != std::string::npos);
+}
@@ -0,0 +1,55 @@
+#include <cstdint>
+#include <vector>
+
+#include <common_cpp/pixels.h>
+#include <common_cpp/test.h>
+
+static std::vector<uint8_t> source(size_t count) {
+	std::vector<uint8_t> pixels(4 * count);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		pixels[i] = (uint8_t)(i * 13 + 5);
+	}
+	return pixels;
+}
+
+// Runs the kernel on count pixels in a buffer with guard bytes past the end,
+// which it must leave alone.
+template <typename Kernel>
+static std::vector<uint8_t> convert(Kernel kernel, const std::vector<uint8_t> &src, bool is_mirrored) {
+	const size_t count = src.size() / 4;
+	std::vector<uint8_t> dst(3 * count + 16, 0xee);
+	kernel(src.data(), dst.data(), count, is_mirrored);
+	for (size_t i = 3 * count; i < dst.size(); ++i) {
+		EXPECT_EQ(dst[i], 0xee);
+	}
+	dst.resize(3 * count);
+	return dst;
+}
+
+TEST(pixels_rgba_to_rgb_drops_alpha) {
+	const std::vector<uint8_t> src = {1, 2, 3, 4, 5, 6, 7, 8};
+	EXPECT(convert(pixels::rgba_to_rgb, src, false) == std::vector<uint8_t>({1, 2, 3, 5, 6, 7}));
+	EXPECT(convert(pixels::rgba_to_rgb, src, true) == std::vector<uint8_t>({5, 6, 7, 1, 2, 3}));
+	EXPECT(convert(pixels::bgra_to_rgb, src, false) == std::vector<uint8_t>({3, 2, 1, 7, 6, 5}));
+}
+
+// Every count up to a few steps of the widest kernel, so that all the ways the
+// vector loops hand over to the narrower ones are covered.
+TEST(pixels_kernels_match_scalar) {
+	for (size_t count = 0; count <= 40; ++count) {
+		const std::vector<uint8_t> src = source(count);
+		for (bool is_mirrored : {false, true}) {
+			EXPECT(convert(pixels::rgba_to_rgb, src, is_mirrored)
+					== convert(pixels::detail::to_rgb_scalar<0, 1, 2>, src, is_mirrored));
+			EXPECT(convert(pixels::bgra_to_rgb, src, is_mirrored)
+					== convert(pixels::detail::to_rgb_scalar<2, 1, 0>, src, is_mirrored));
+#if defined(__x86_64__) || defined(__i386__) || (defined(_MSC_VER) && defined(_M_X64))
+			// The dispatch above picks the widest, so the narrower one on its own.
+			if (pixels::detail::has_ssse3()) {
+				EXPECT(convert(pixels::detail::to_rgb_ssse3<0, 1, 2>, src, is_mirrored)
+						== convert(pixels::detail::to_rgb_scalar<0, 1, 2>, src, is_mirrored));
+			}
+#endif
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#include <deque>
+#include <memory>
+#include <random>
+
+#include <common_cpp/ring_queue.h>
+#include <common_cpp/test.h>
+
+TEST(ring_queue_is_fifo_across_growth) {
+	RingQueue<std::unique_ptr<int>> queue;
+	std::deque<int> expected;
+	std::mt19937 random(1);
+	int next = 0;
+	for (int i = 0; i < 10'000; ++i) {
+		// Pushes slightly more often, so that it keeps wrapping and growing.
+		if (random() % 5 < 3 || queue.empty()) {
+			queue.push(std::make_unique<int>(next));
+			expected.push_back(next);
+			++next;
+		} else {
+			EXPECT_EQ(*queue.front(), expected.front());
+			queue.pop();
+			expected.pop_front();
+		}
+		EXPECT_EQ(queue.size(), expected.size());
+	}
+	while (!queue.empty()) {
+		EXPECT_EQ(*queue.front(), expected.front());
+		queue.pop();
+		expected.pop_front();
+	}
+}
+
+TEST(ring_queue_erases_in_order) {
+	RingQueue<int> queue(8);
+	// Wrapped around the end of the buffer.
+	for (int i = 0; i < 6; ++i) {
+		queue.push(-1);
+	}
+	for (int i = 0; i < 6; ++i) {
+		queue.pop();
+	}
+	for (int i = 0; i < 8; ++i) {
+		queue.push(i);
+	}
+	EXPECT_EQ(queue.erase_if([](int value) { return value % 3 == 0; }), size_t(3));
+	for (int value : {1, 2, 4, 5, 7}) {
+		EXPECT_EQ(queue.front(), value);
+		queue.pop();
+	}
+	EXPECT(queue.empty());
+}
+
+TEST(ring_queue_move_leaves_source_empty) {
+	RingQueue<int> a;
+	a.push(1);
+	a.push(2);
+	RingQueue<int> b = std::move(a);
+	EXPECT(a.empty());
+	EXPECT_EQ(b.size(), size_t(2));
+	a.push(3);
+	EXPECT_EQ(a.front(), 3);
+	a = std::move(b);
+	EXPECT(b.empty());
+	EXPECT_EQ(a.front(), 1);
+}
@@ -0,0 +1,37 @@
+#include <string>
+#include <vector>
+
+#include <common_cpp/sha256.h>
+#include <common_cpp/test.h>
+
+static std::string sha256_hex(std::string_view bytes) {
+	Sha256 sha;
+	sha.update(bytes);
+	return Sha256::to_hex(sha.digest());
+}
+
+// Test vectors of FIPS 180-4.
+TEST(sha256_matches_test_vectors) {
+	EXPECT_EQ(sha256_hex(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	EXPECT_EQ(sha256_hex("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	EXPECT_EQ(
+			sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+			"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+	EXPECT_EQ(
+			sha256_hex(std::string(1'000'000, 'a')),
+			"cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST(sha256_is_independent_of_split) {
+	std::string bytes(300, ' ');
+	for (size_t i = 0; i < bytes.size(); ++i) {
+		bytes[i] = (char)(i * 31);
+	}
+	const std::string expected = sha256_hex(bytes);
+	for (size_t split : {0, 1, 55, 63, 64, 65, 128, 299}) {
+		Sha256 sha;
+		sha.update(std::string_view(bytes).substr(0, split));
+		sha.update(std::string_view(bytes).substr(split));
+		EXPECT_EQ(Sha256::to_hex(sha.digest()), expected);
+	}
+}
@@ -0,0 +1,7 @@
+#include "test.h"
+
+// Runs all the tests linked in, or only those whose name contains the first
+// argument.
+int main(int argc, char **argv) {
+	return test::run_all(argc > 1 ? argv[1] : "");
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running submitted jobs in submission order.
+//
+// The destructor waits for the jobs that are running, but discards those that
+// haven't started yet.
+class ThreadPool {
+	std::mutex mut;
+	std::condition_variable job_available;
+	std::deque<std::function<void()>> jobs;
+	std::vector<std::thread> threads;
+	bool is_stopping = false;
+
+public:
+	// With thread_count 0, uses as many threads as there are hardware threads.
+	explicit ThreadPool(int thread_count = 0) {
+		if (thread_count <= 0) {
+			thread_count = std::max(1u, std::thread::hardware_concurrency());
+		}
+		for (int i = 0; i < thread_count; ++i) {
+			threads.emplace_back([this] { work(); });
+		}
+	}
+
+	ThreadPool(const ThreadPool &) = delete;
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			is_stopping = true;
+			jobs.clear();
+		}
+		job_available.notify_all();
+		for (std::thread &thread : threads) {
+			thread.join();
+		}
+	}
+
+	int thread_count() const { return threads.size(); }
+
+	void submit(std::function<void()> &&job) {
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			jobs.push_back(std::move(job));
+		}
+		job_available.notify_one();
+	}
+
+private:
+	void work() {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mut);
+				job_available.wait(lock, [this] { return is_stopping || !jobs.empty(); });
+				if (is_stopping) {
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
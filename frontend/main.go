@@ -30,6 +30,7 @@ var (
 	grpcPort          = flag.Int("grpc-port", 6100, "The port to serve gRPC requests")
 	grpcwebPort       = flag.Int("grpcweb-port", 6101, "The port to serve gRPC-Web requests")
 	universeAddr      = flag.String("universe-addr", "", "The address of the universe server")
+	taskWeight        = flag.Int("task-weight", 1, "Share of the universe server's processing time of each viewer, relative to the viewers of other frontends")
 )
 
 func main() {
@@ -123,7 +124,7 @@ func mainWithError() error {
 	}()
 
 	log.Println("Starting task streaming...")
-	taskServiceServer.StartStreaming(universeTaskServiceClient)
+	taskServiceServer.StartStreaming(universeTaskServiceClient, *taskWeight)
 
 	grpcwebServer := &http.Server{Handler: grpcweb.WrapServer(
 		grpcServer,
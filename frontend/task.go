@@ -2,87 +2,204 @@ package main
 
 import (
 	"context"
+	"errors"
 	"fmt"
 	"log"
+	"slices"
+	"strconv"
 	"sync"
 	"sync/atomic"
 
 	"github.com/mkatch/spejs/pb"
 	"github.com/mkatch/spejs/universepb"
+	"google.golang.org/grpc/codes"
+	"google.golang.org/grpc/metadata"
+	"google.golang.org/grpc/status"
 )
 
+// The tasks of one viewer, e.g. a browser tab, on a universe server stream of
+// their own. The server keeps the state of a viewer per stream: which task
+// supersedes which, the skyboxes that deltas are taken against, and
+// prefetching.
+type taskSession struct {
+	id        string
+	stream    universepb.TaskService_StreamClient
+	cancel    context.CancelFunc
+	sendMut   sync.Mutex                    // Serializes sends, which gRPC streams don't allow concurrently.
+	listeners []pb.TaskService_ListenServer // Guarded by TaskServiceServer.mut.
+	ended     chan struct{}                 // Closed once the stream has ended, with err set.
+	err       error
+}
+
 type TaskServiceServer struct {
 	pb.UnimplementedTaskServiceServer
-	mut          sync.Mutex
-	backend      universepb.TaskServiceClient
-	stream       universepb.TaskService_StreamClient
-	cancelStream context.CancelFunc
-	listeners    []pb.TaskService_ListenServer
-	streamChan   chan error
-	nextTaskId   atomic.Uint64 // TODO: Not enought for multiple frontends and restarting.
+	mut        sync.Mutex
+	backend    universepb.TaskServiceClient
+	weight     int
+	sessions   map[string]*taskSession
+	nextTaskId atomic.Uint64 // TODO: Not enought for multiple frontends and restarting.
 }
 
-func (s *TaskServiceServer) StartStreaming(backend universepb.TaskServiceClient) (err error) {
+// The weight determines the share of the universe server's processing time the
+// stream of each session gets relative to other streams, from this frontend or
+// others.
+func (s *TaskServiceServer) StartStreaming(backend universepb.TaskServiceClient, weight int) error {
+	s.mut.Lock()
+	defer s.mut.Unlock()
 	if s.backend != nil {
 		return fmt.Errorf("already streaming")
 	}
-
-	ctx, cancelStream := context.WithCancel(context.Background())
 	s.backend = backend
-	s.stream, err = backend.Stream(ctx)
-	if err != nil {
-		s.stream = nil
-		cancelStream()
-		return err
-	}
-	s.cancelStream = cancelStream
+	s.weight = weight
+	s.sessions = make(map[string]*taskSession)
+	return nil
+}
 
-	s.streamChan = make(chan error)
-	go func() {
-		defer close(s.streamChan)
-		for {
-			rsp, err := s.stream.Recv()
-			log.Println("Received", rsp, err)
-			if err != nil {
-				s.streamChan <- err
-				break
-			}
-			func() {
-				s.mut.Lock()
-				defer s.mut.Unlock()
-				for _, l := range s.listeners {
-					log.Println("Sending", rsp, "to", l)
-					l.Send(rsp)
-				}
-			}()
+// Ends the streams of all sessions, and returns the errors of those that ended
+// for another reason.
+func (s *TaskServiceServer) StopStreaming() error {
+	s.mut.Lock()
+	sessions := s.sessions
+	s.sessions = make(map[string]*taskSession)
+	s.backend = nil
+	s.mut.Unlock()
+
+	var errs []error
+	for _, session := range sessions {
+		session.cancel()
+		<-session.ended
+		if status.Code(session.err) != codes.Canceled {
+			errs = append(errs, fmt.Errorf("session %s: %w", session.id, session.err))
 		}
-	}()
+	}
+	return errors.Join(errs...)
+}
 
-	return nil
+// Returns the session with the ID, opening a stream for it if it is new.
+func (s *TaskServiceServer) openSession(id string) (*taskSession, error) {
+	if id == "" {
+		return nil, status.Error(codes.InvalidArgument, "missing session ID")
+	}
+	s.mut.Lock()
+	defer s.mut.Unlock()
+	if session, ok := s.sessions[id]; ok {
+		return session, nil
+	}
+	if s.backend == nil {
+		return nil, status.Error(codes.Unavailable, "not streaming")
+	}
+
+	ctx, cancel := context.WithCancel(context.Background())
+	ctx = metadata.AppendToOutgoingContext(ctx, "task-weight", strconv.Itoa(s.weight))
+	stream, err := s.backend.Stream(ctx)
+	if err != nil {
+		cancel()
+		return nil, err
+	}
+	session := &taskSession{
+		id:     id,
+		stream: stream,
+		cancel: cancel,
+		ended:  make(chan struct{}),
+	}
+	s.sessions[id] = session
+	log.Println("New task session", id)
+	go s.receive(session)
+	return session, nil
 }
 
-func (s *TaskServiceServer) StopStreaming() error {
-	s.cancelStream()
-	return <-s.streamChan
+// Forwards the responses on the stream of the session to its listeners, until
+// the stream ends.
+func (s *TaskServiceServer) receive(session *taskSession) {
+	for {
+		rsp, err := session.stream.Recv()
+		log.Println("Received", rsp, err)
+		if err != nil {
+			s.mut.Lock()
+			if s.sessions[session.id] == session {
+				delete(s.sessions, session.id)
+			}
+			s.mut.Unlock()
+			session.err = err
+			close(session.ended)
+			return
+		}
+		func() {
+			s.mut.Lock()
+			defer s.mut.Unlock()
+			for _, l := range session.listeners {
+				log.Println("Sending", rsp, "to", l)
+				l.Send(rsp)
+			}
+		}()
+	}
 }
 
 func (s *TaskServiceServer) Schedule(ctx context.Context, req *pb.TaskScheduleRequest) (*pb.TaskScheduleResponse, error) {
+	session, err := s.openSession(req.SessionId)
+	if err != nil {
+		return nil, err
+	}
+	session.sendMut.Lock()
+	// Assigned under the lock, so that IDs reach the backend in increasing order,
+	// which it relies on to tell the latest task.
 	taskId := s.nextTaskId.Add(1)
-	err := s.stream.Send(&universepb.TaskRequest{
+	err = session.stream.Send(&universepb.TaskRequest{
 		TaskId: taskId,
 		Task:   req.Request,
 	})
+	session.sendMut.Unlock()
 	if err != nil {
 		return nil, err
 	}
 	return &pb.TaskScheduleResponse{TaskId: taskId}, nil
 }
 
+func (s *TaskServiceServer) Cancel(ctx context.Context, req *pb.TaskCancelRequest) (*pb.TaskCancelResponse, error) {
+	s.mut.Lock()
+	session := s.sessions[req.SessionId]
+	s.mut.Unlock()
+	if session == nil {
+		// Its tasks went with its stream.
+		return &pb.TaskCancelResponse{}, nil
+	}
+	session.sendMut.Lock()
+	err := session.stream.Send(&universepb.TaskRequest{
+		CancelTaskIds: req.TaskIds,
+	})
+	session.sendMut.Unlock()
+	if err != nil {
+		return nil, err
+	}
+	return &pb.TaskCancelResponse{}, nil
+}
+
+// Once the last listener of a session leaves, its stream is closed, which
+// cancels its tasks.
 func (s *TaskServiceServer) Listen(req *pb.TaskListenRequest, rsp pb.TaskService_ListenServer) error {
 	log.Println("Listen", req)
+	session, err := s.openSession(req.SessionId)
+	if err != nil {
+		return err
+	}
 	s.mut.Lock()
-	s.listeners = append(s.listeners, rsp)
+	session.listeners = append(session.listeners, rsp)
 	s.mut.Unlock()
-	<-rsp.Context().Done()
+
+	select {
+	case <-rsp.Context().Done():
+	case <-session.ended:
+	}
+
+	s.mut.Lock()
+	defer s.mut.Unlock()
+	session.listeners = slices.DeleteFunc(session.listeners, func(l pb.TaskService_ListenServer) bool {
+		return l == rsp
+	})
+	if len(session.listeners) == 0 && s.sessions[session.id] == session {
+		delete(s.sessions, session.id)
+		session.cancel()
+		log.Println("Ended task session", session.id)
+	}
 	return nil
 }
@@ -30,6 +30,29 @@ inline size_t size_of(GLenum type) {
 	}
 }
 
+// Number of components of a pixel of the given format, as passed to e.g.
+// glTextureSubImage3D.
+inline size_t component_count(GLenum format) {
+	switch (format) {
+		case GL_RED:
+		case GL_RED_INTEGER:
+		case GL_DEPTH_COMPONENT:
+			return 1;
+		case GL_RG:
+		case GL_RG_INTEGER:
+			return 2;
+		case GL_RGB:
+		case GL_RGB_INTEGER:
+			return 3;
+		case GL_RGBA:
+		case GL_RGBA_INTEGER:
+			return 4;
+		default:
+			assert(false);
+			return 0;
+	}
+}
+
 // An exception that is thrown when an error related to the usage of OpenGL
 // occurs.
 class exception : public std::runtime_error {
@@ -2,5 +2,6 @@
 
 #include "guard.h"
 #include "shaders.h"
+#include "streaming_buffer.h"
 #include "texture.h"
 #include "vertex_buffer.h"
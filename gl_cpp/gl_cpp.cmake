@@ -10,7 +10,7 @@ add_custom_command(
   OUTPUT ${GLAD_GEN_FILES}
   COMMAND ${GLAD}
     --api gl:core=4.6
-    --extensions " "
+    --extensions "GL_ARB_parallel_shader_compile,GL_KHR_parallel_shader_compile"
     --out-path "${GLAD_OUT_DIR}"
     c
 )
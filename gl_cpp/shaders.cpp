@@ -1,6 +1,10 @@
 #include "shaders.h"
 
-#include <iostream>
+#include <chrono>
+#include <format>
+#include <thread>
+
+#include <common_cpp/log.h>
 
 namespace gl {
 
@@ -13,8 +17,9 @@ struct ShadersBuilder {
 		shaders->programs.push_back(program);
 	}
 
-	static Program *current_program() {
-		return const_cast<Program *>(shaders->programs.back());
+	static void push_program(Program *program, ComputeShaderSource const *compute_shader_source) {
+		program->compute_shader = get_shader(shaders->compute_shaders, compute_shader_source);
+		shaders->programs.push_back(program);
 	}
 
 	template <typename Shader, typename Source>
@@ -36,22 +41,20 @@ Shaders::Shaders() {
 	ShadersBuilder::shaders = this;
 }
 
-Uniform::Uniform(const char *name, const GLenum type)
-		: name(name), type(type) {
-	ShadersBuilder::current_program()->uniforms.push_back(this);
-}
-
-Attribute::Attribute(const char *name, const GLenum type)
-		: name(name), type(type) {
-	ShadersBuilder::current_program()->attributes.push_back(this);
-}
-
 Program::Program(const char *name, VertexShaderSource const &vertex_shader_source, FragmentShaderSource const &fragment_shader_source)
 		: name(name) {
 	ShadersBuilder::push_program(this, &vertex_shader_source, &fragment_shader_source);
 }
 
-GLuint compile_shader(const ShaderSource *source) {
+Program::Program(const char *name, ComputeShaderSource const &compute_shader_source)
+		: name(name) {
+	ShadersBuilder::push_program(this, &compute_shader_source);
+}
+
+// Creates the shader object and kicks off its compilation without waiting for
+// the result. With parallel compilation, the driver is free to compile it in
+// the background.
+GLuint submit_shader(const ShaderSource *source) {
 	GLuint shader_id = glCreateShader(source->shader_type);
 	if (shader_id == 0)
 		throw gl::exception("Unable to create new shader", glGetError());
@@ -59,7 +62,11 @@ GLuint compile_shader(const ShaderSource *source) {
 	const GLint source_size = strlen(source->source);
 	glShaderSource(shader_id, 1, &source->source, &source_size);
 	glCompileShader(shader_id);
+	return shader_id;
+}
 
+// Blocks until the shader is compiled and throws if it failed.
+void check_shader(GLuint shader_id, const ShaderSource *source) {
 	int compile_status;
 	glGetShaderiv(shader_id, GL_COMPILE_STATUS, &compile_status);
 	if (compile_status != GL_TRUE) {
@@ -69,23 +76,40 @@ GLuint compile_shader(const ShaderSource *source) {
 		glDeleteShader(shader_id);
 		throw gl::exception("Shader " + squote(source->name) + ", compilation error: " + log);
 	}
+}
 
-	return shader_id;
+// Names of the shaders of the program, for error messages.
+string shader_names(const Program *program) {
+	if (program->compute_shader) {
+		return squote(program->compute_shader->source->name);
+	}
+	return squote(program->vertex_shader->source->name) + ", " + squote(program->fragment_shader->source->name);
 }
 
-GLuint link_program(const VertexShader *vertex_shader, const FragmentShader *fragment_shader) {
+// Creates the program object and kicks off linking without waiting for the
+// result. The shaders need not be compiled yet.
+GLuint submit_program(const Program *program) {
 	GLuint program_id = glCreateProgram();
 	if (program_id == 0)
 		throw gl::exception("Unable to create new program");
 
 	gl_if_error(
-			glAttachShader(program_id, vertex_shader->shader_id);
-			glAttachShader(program_id, fragment_shader->shader_id);) {
+			if (program->compute_shader) {
+				glAttachShader(program_id, program->compute_shader->shader_id);
+			} else {
+				glAttachShader(program_id, program->vertex_shader->shader_id);
+				glAttachShader(program_id, program->fragment_shader->shader_id);
+			}) {
 		glDeleteProgram(program_id);
-		throw gl::exception("Unable to attach shaders " + squote(vertex_shader->source->name) + ", " + squote(fragment_shader->source->name) + ".", error);
+		throw gl::exception("Unable to attach shaders " + shader_names(program) + ".", error);
 	}
 
 	glLinkProgram(program_id);
+	return program_id;
+}
+
+// Blocks until the program is linked and throws if it failed.
+void check_program(GLuint program_id, const Program *program) {
 	GLint link_status;
 	glGetProgramiv(program_id, GL_LINK_STATUS, &link_status);
 	if (link_status != GL_TRUE) {
@@ -93,99 +117,123 @@ GLuint link_program(const VertexShader *vertex_shader, const FragmentShader *fra
 		char log[max_log_length + 1];
 		glGetProgramInfoLog(program_id, max_log_length, nullptr, log);
 		glDeleteProgram(program_id);
-		throw gl::exception("Unable to link shaders " + squote(vertex_shader->source->name) + ", " + squote(fragment_shader->source->name) + ": " + log);
+		throw gl::exception("Unable to link shaders " + shader_names(program) + ": " + log);
 	}
+}
 
+GLuint compile_shader(const ShaderSource *source) {
+	GLuint shader_id = submit_shader(source);
+	check_shader(shader_id, source);
+	return shader_id;
+}
+
+GLuint link_program(const Program *program) {
+	GLuint program_id = submit_program(program);
+	check_program(program_id, program);
 	return program_id;
 }
 
-void validate_uniforms(GLuint program_id, const char *program_name, const std::vector<const Uniform *> &uniforms) {
-	GLint max_name_length = 0;
-	glGetProgramiv(program_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length);
-	string name_storage((char)0, max_name_length + 1);
-	char *name = name_storage.data();
-
-	GLint active_uniform_count = 0;
-	glGetProgramiv(program_id, GL_ACTIVE_UNIFORMS, &active_uniform_count);
-
-	for (int i = 0; i < active_uniform_count; ++i) {
-		GLint size;
-		GLenum type;
-		glGetActiveUniform(program_id, i, name_storage.capacity(), nullptr, &size, &type, name);
-		for (auto &uniform : uniforms) {
-			if (strcmp(uniform->name, name) == 0) {
-				if (uniform->type != type) {
-					throw gl::exception("Uniform " + string(program_name) + "." + uniform->name + " has wrong data type; expected " + enum_string(type) + ", got " + enum_string(uniform->type) + ".");
-				}
-				break;
-			}
-		}
+// Whether the driver can compile and link on background threads.
+bool has_parallel_shader_compile() {
+	return GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+}
+
+// Lets the driver pick the number of compiler threads. The KHR and ARB
+// extensions share the enums, but each loads only its own entry point.
+void set_max_shader_compiler_threads() {
+	constexpr GLuint DRIVER_DEFAULT = 0xFFFFFFFF;
+	if (GLAD_GL_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(DRIVER_DEFAULT);
+	} else {
+		glMaxShaderCompilerThreadsARB(DRIVER_DEFAULT);
 	}
+}
 
-	for (auto &uniform : uniforms) {
-		if (uniform->location == -1) {
-			if (uniform->name[0] == '_') {
-				std::cout << "WARNING: Uniform " << squote(uniform->name) << " is not used in program " << program_name << std::endl;
-				continue;
-			}
-			throw gl::exception("Uniform " + squote(uniform->name) + " not found in program " + string(program_name) + ".");
+// Polls GL_COMPLETION_STATUS_KHR until all the given objects are done. Unlike
+// querying GL_COMPILE_STATUS or GL_LINK_STATUS, this does not stall, so the
+// remaining jobs keep running in the background meanwhile.
+void wait_for_completion(std::vector<GLuint> shader_ids, std::vector<GLuint> program_ids) {
+	auto is_complete = [](auto get_param, GLuint id) {
+		GLint status = GL_FALSE;
+		get_param(id, GL_COMPLETION_STATUS_KHR, &status);
+		return status == GL_TRUE;
+	};
+	while (true) {
+		std::erase_if(shader_ids, [&](GLuint id) { return is_complete(glGetShaderiv, id); });
+		std::erase_if(program_ids, [&](GLuint id) { return is_complete(glGetProgramiv, id); });
+		if (shader_ids.empty() && program_ids.empty()) {
+			return;
 		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
 }
 
-void validate_attributes(GLuint program_id, const char *program_name, const std::vector<const Attribute *> &attributes) {
-	GLint max_name_length = 0;
-	glGetProgramiv(program_id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_name_length);
-	string name_storage((char)0, max_name_length + 1);
-	char *name = name_storage.data();
+void Shaders::compile_all() {
+	const auto start_time = std::chrono::steady_clock::now();
+	const bool parallel = has_parallel_shader_compile();
+	if (parallel) {
+		set_max_shader_compiler_threads();
+		submit_all();
+	} else {
+		compile_all_sync();
+	}
 
-	GLint active_attribute_count = 0;
-	glGetProgramiv(program_id, GL_ACTIVE_ATTRIBUTES, &active_attribute_count);
+	const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time);
+	LOG(INFO)
+			<< "Compiled " << vertex_shaders.size() + fragment_shaders.size() + compute_shaders.size() << " shaders and linked "
+			<< programs.size() << " programs in " << std::format("{:.1f}", elapsed.count()) << " ms "
+			<< paren(parallel ? "parallel" : "synchronous");
+}
 
-	for (int i = 0; i < active_attribute_count; ++i) {
-		GLint size;
-		GLenum type;
-		glGetActiveAttrib(program_id, i, name_storage.capacity(), nullptr, &size, &type, name);
-		for (auto &attribute : attributes) {
-			if (strcmp(attribute->name, name) == 0) {
-				if (attribute->type != type) {
-					throw gl::exception("Attribute " + string(program_name) + "." + attribute->name + " has wrong data type; expected " + enum_string(type) + ", got " + enum_string(attribute->type) + ".");
-				}
-				break;
-			}
-		}
+void Shaders::submit_all() {
+	// Submit phase. Nothing here waits for the driver, linking included, since
+	// the link job is queued behind the compile jobs of its shaders.
+	std::vector<GLuint> shader_ids;
+	for (auto vertex_shader : vertex_shaders) {
+		shader_ids.push_back(vertex_shader->shader_id = submit_shader(vertex_shader->source));
+	}
+	for (auto fragment_shader : fragment_shaders) {
+		shader_ids.push_back(fragment_shader->shader_id = submit_shader(fragment_shader->source));
+	}
+	for (auto compute_shader : compute_shaders) {
+		shader_ids.push_back(compute_shader->shader_id = submit_shader(compute_shader->source));
+	}
+	std::vector<GLuint> program_ids;
+	for (auto program : programs) {
+		program_ids.push_back(program->program_id = submit_program(program));
 	}
 
-	for (auto &attribute : attributes) {
-		if (attribute->location == -1) {
-			if (attribute->name[0] == '_') {
-				std::cout << "WARNING: Attribute " << squote(attribute->name) << " is not used in program " << program_name << std::endl;
-				continue;
-			}
-			throw gl::exception("Attribute " + squote(attribute->name) + " not found in program " + string(program_name) + ".");
-		}
+	// Poll phase.
+	wait_for_completion(shader_ids, program_ids);
+
+	// Shaders are checked first, because their logs are more useful than the
+	// link error that a failed compilation implies.
+	for (auto vertex_shader : vertex_shaders) {
+		check_shader(vertex_shader->shader_id, vertex_shader->source);
+	}
+	for (auto fragment_shader : fragment_shaders) {
+		check_shader(fragment_shader->shader_id, fragment_shader->source);
+	}
+	for (auto compute_shader : compute_shaders) {
+		check_shader(compute_shader->shader_id, compute_shader->source);
+	}
+	for (auto program : programs) {
+		check_program(program->program_id, program);
 	}
 }
 
-void Shaders::compile_all() {
+void Shaders::compile_all_sync() {
 	for (auto vertex_shader : vertex_shaders) {
 		vertex_shader->shader_id = compile_shader(vertex_shader->source);
 	}
 	for (auto fragment_shader : fragment_shaders) {
 		fragment_shader->shader_id = compile_shader(fragment_shader->source);
 	}
+	for (auto compute_shader : compute_shaders) {
+		compute_shader->shader_id = compile_shader(compute_shader->source);
+	}
 	for (auto program : programs) {
-		program->program_id = link_program(program->vertex_shader, program->fragment_shader);
-		for (auto &uniform : program->uniforms) {
-			// const_cast is ok, because program owns the uniforms.
-			const_cast<Uniform *>(uniform)->location = glGetUniformLocation(program->program_id, uniform->name);
-		}
-		validate_uniforms(program->program_id, program->name, program->uniforms);
-		for (auto &attribute : program->attributes) {
-			// const_cast is ok, because program owns the attributes.
-			const_cast<Attribute *>(attribute)->location = glGetAttribLocation(program->program_id, attribute->name);
-		}
-		validate_attributes(program->program_id, program->name, program->attributes);
+		program->program_id = link_program(program);
 	}
 }
 
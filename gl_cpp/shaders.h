@@ -5,6 +5,7 @@
 #include "common.h"
 #include "math.h"
 #include "texture.h"
+#include "vertex_format.h"
 
 namespace gl {
 
@@ -21,6 +22,7 @@ struct ShaderSource {
 
 struct VertexShaderSource : public ShaderSource { };
 struct FragmentShaderSource : public ShaderSource { };
+struct ComputeShaderSource : public ShaderSource { };
 
 // Wraps an OpenGL shader object of type GL_VERTEX_SHADER.
 struct VertexShader {
@@ -34,64 +36,104 @@ struct FragmentShader {
 	GLuint shader_id;
 };
 
+// Wraps an OpenGL shader object of type GL_COMPUTE_SHADER.
+struct ComputeShader {
+	const ComputeShaderSource *source;
+	GLuint shader_id;
+};
+
 // Describes a uniform of a shader program.
+//
+// The location is fixed at build time with layout(location = N) in GLSL, so
+// instances are constexpr handles. Don't instantiate by hand; shader_bundler
+// generates one for each uniform in the <shader>_interface structs.
 struct Uniform {
-	GLuint location;
+	GLint location;
 	const char *name;
 	GLenum type;
 
 protected:
-	Uniform(const char *name, GLenum type);
+	constexpr Uniform(GLint location, const char *name, GLenum type)
+			: location(location), name(name), type(type) { }
 };
 
 // Describes an attribute of a shader program.
+//
+// Like Uniform, generated by shader_bundler with the explicit location.
 struct Attribute {
-	GLuint location;
+	GLint location;
 	const char *name;
 	GLenum type;
 
 protected:
-	Attribute(const char *name, GLenum type);
+	constexpr Attribute(GLint location, const char *name, GLenum type)
+			: location(location), name(name), type(type) { }
 };
 
-#define _Attribute(glsl_type, gl_type)                                     \
-	Attribute_##glsl_type : public Attribute {                               \
-		Attribute_##glsl_type(char const *name) : Attribute(name, gl_type) { } \
+// Describes a shader storage block of a shader program.
+//
+// Like Uniform, generated by shader_bundler, with the binding point given by
+// layout(binding = N) in GLSL.
+struct StorageBlock {
+	GLuint binding;
+	const char *name;
+
+	// Binds the whole buffer to the binding point of the block.
+	void bind(GLuint buffer_id) const {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer_id);
+	}
+
+	// Binds a range of the buffer. The offset must be a multiple of
+	// GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT.
+	void bind(GLuint buffer_id, GLintptr offset, GLsizeiptr size) const {
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer_id, offset, size);
+	}
+};
+
+#define _Attribute(glsl_type, gl_type, component_count_, attribute_kind) \
+	Attribute_##glsl_type : public Attribute {                             \
+		static constexpr GLint component_count = component_count_;           \
+		static constexpr AttributeKind kind = AttributeKind::attribute_kind; \
+		constexpr Attribute_##glsl_type(GLint location, char const *name)    \
+				: Attribute(location, name, gl_type) { }                         \
 	}
 #define _scalar_Uniform(glsl_type, gl_type, gl_setter_infix, cpp_component_type) \
 	Uniform_##glsl_type : public Uniform {                                         \
-		Uniform_##glsl_type(char const *name) : Uniform(name, gl_type) { }           \
+		constexpr Uniform_##glsl_type(GLint location, char const *name)              \
+				: Uniform(location, name, gl_type) { }                                   \
 		void operator=(cpp_component_type value) const {                             \
 			glUniform1##gl_setter_infix(location, value);                              \
 		}                                                                            \
 	}
 #define _vector_Uniform(component_count, glsl_type, gl_type, gl_setter_infix, cpp_component_type)  \
 	Uniform_##glsl_type : public Uniform {                                                           \
-		Uniform_##glsl_type(char const *name) : Uniform(name, gl_type) { }                             \
-		void operator=(const glm::vec##component_count &u) const {                                     \
+		constexpr Uniform_##glsl_type(GLint location, char const *name)                                \
+				: Uniform(location, name, gl_type) { }                                                     \
+		void operator=(const glm::vec<component_count, cpp_component_type> &u) const {                 \
 			glUniform##component_count##gl_setter_infix##v(location, 1, (const cpp_component_type *)&u); \
 		}                                                                                              \
 	}
-#define _matrix_Uniform(csize, rsize)                                             \
-	Uniform_mat##csize : public Uniform {                                           \
-		Uniform_mat##csize(char const *name) : Uniform(name, GL_FLOAT_MAT##csize) { } \
-		void operator=(const glm::mat##csize &M) const {                              \
-			glUniformMatrix##csize##fv(location, 1, GL_FALSE, (const GLfloat *)&M);     \
-		}                                                                             \
+#define _matrix_Uniform(csize, rsize)                                          \
+	Uniform_mat##csize : public Uniform {                                        \
+		constexpr Uniform_mat##csize(GLint location, char const *name)             \
+				: Uniform(location, name, GL_FLOAT_MAT##csize) { }                     \
+		void operator=(const glm::mat##csize &M) const {                           \
+			glUniformMatrix##csize##fv(location, 1, GL_FALSE, (const GLfloat *)&M);  \
+		}                                                                          \
 	}
-#define _vector_Attributes_Uniforms(glsl_component_type, glsl_vec_prefix, gl_component_type, gl_setter_infix, cpp_component_type) \
-	struct _Attribute(glsl_component_type, gl_component_type);                                                                      \
-	struct _Attribute(glsl_vec_prefix##vec2, gl_component_type##_VEC2);                                                             \
-	struct _Attribute(glsl_vec_prefix##vec3, gl_component_type##_VEC3);                                                             \
-	struct _Attribute(glsl_vec_prefix##vec4, gl_component_type##_VEC4);                                                             \
-	struct _scalar_Uniform(glsl_component_type, gl_component_type, gl_setter_infix, cpp_component_type);                            \
-	struct _vector_Uniform(2, glsl_vec_prefix##vec2, gl_component_type##_VEC2, gl_setter_infix, cpp_component_type);                \
-	struct _vector_Uniform(3, glsl_vec_prefix##vec3, gl_component_type##_VEC3, gl_setter_infix, cpp_component_type);                \
+#define _vector_Attributes_Uniforms(glsl_component_type, glsl_vec_prefix, gl_component_type, gl_setter_infix, cpp_component_type, attribute_kind) \
+	struct _Attribute(glsl_component_type, gl_component_type, 1, attribute_kind);                                                                   \
+	struct _Attribute(glsl_vec_prefix##vec2, gl_component_type##_VEC2, 2, attribute_kind);                                                          \
+	struct _Attribute(glsl_vec_prefix##vec3, gl_component_type##_VEC3, 3, attribute_kind);                                                          \
+	struct _Attribute(glsl_vec_prefix##vec4, gl_component_type##_VEC4, 4, attribute_kind);                                                          \
+	struct _scalar_Uniform(glsl_component_type, gl_component_type, gl_setter_infix, cpp_component_type);                                            \
+	struct _vector_Uniform(2, glsl_vec_prefix##vec2, gl_component_type##_VEC2, gl_setter_infix, cpp_component_type);                                \
+	struct _vector_Uniform(3, glsl_vec_prefix##vec3, gl_component_type##_VEC3, gl_setter_infix, cpp_component_type);                                \
 	struct _vector_Uniform(4, glsl_vec_prefix##vec4, gl_component_type##_VEC4, gl_setter_infix, cpp_component_type)
 
-_vector_Attributes_Uniforms(float, , GL_FLOAT, f, GLfloat);
-_vector_Attributes_Uniforms(int, i, GL_INT, i, GLint);
-_vector_Attributes_Uniforms(uint, u, GL_UNSIGNED_INT, ui, GLuint);
+_vector_Attributes_Uniforms(float, , GL_FLOAT, f, GLfloat, FLOAT);
+_vector_Attributes_Uniforms(int, i, GL_INT, i, GLint, INT);
+_vector_Attributes_Uniforms(uint, u, GL_UNSIGNED_INT, ui, GLuint, UINT);
 
 struct _matrix_Uniform(2, 2);
 struct _matrix_Uniform(2x3, 3x2);
@@ -109,23 +151,60 @@ struct _matrix_Uniform(4x3, 3x4);
 #undef _scalar_Uniform
 #undef _Attribute
 
+struct Uniform_sampler2D : public Uniform {
+	constexpr Uniform_sampler2D(GLint location, char const *name)
+			: Uniform(location, name, GL_SAMPLER_2D) { }
+	TextureUnit operator=(TextureUnit unit) const {
+		glUniform1i(location, unit);
+		return unit;
+	}
+};
+
 struct Uniform_sampler3D : public Uniform {
-	Uniform_sampler3D(char const *name)
-			: Uniform(name, GL_SAMPLER_3D) { }
+	constexpr Uniform_sampler3D(GLint location, char const *name)
+			: Uniform(location, name, GL_SAMPLER_3D) { }
 	TextureUnit operator=(TextureUnit unit) const {
-		glUniform1ui(location, unit);
+		glUniform1i(location, unit);
 		return unit;
 	}
 };
 
-// Wraps an OpenGL shader program object.
+struct Uniform_usampler3D : public Uniform {
+	constexpr Uniform_usampler3D(GLint location, char const *name)
+			: Uniform(location, name, GL_UNSIGNED_INT_SAMPLER_3D) { }
+	TextureUnit operator=(TextureUnit unit) const {
+		glUniform1i(location, unit);
+		return unit;
+	}
+};
+
+struct Uniform_samplerCube : public Uniform {
+	constexpr Uniform_samplerCube(GLint location, char const *name)
+			: Uniform(location, name, GL_SAMPLER_CUBE) { }
+	TextureUnit operator=(TextureUnit unit) const {
+		glUniform1i(location, unit);
+		return unit;
+	}
+};
+
+// Set to the image unit the image is bound to with glBindImageTexture.
+struct Uniform_image2D : public Uniform {
+	constexpr Uniform_image2D(GLint location, char const *name)
+			: Uniform(location, name, GL_IMAGE_2D) { }
+	GLuint operator=(GLuint unit) const {
+		glUniform1i(location, unit);
+		return unit;
+	}
+};
+
+// Wraps an OpenGL shader program object. Either a vertex and a fragment
+// shader, or a single compute shader.
 struct Program {
 	GLuint program_id;
 	const char *name;
-	const VertexShader *vertex_shader;
-	const FragmentShader *fragment_shader;
-	std::vector<const Uniform *> uniforms;
-	std::vector<const Attribute *> attributes;
+	const VertexShader *vertex_shader = nullptr;
+	const FragmentShader *fragment_shader = nullptr;
+	const ComputeShader *compute_shader = nullptr;
 
 protected:
 // Convenience aliases, so that the declarations resemble GLSL code.
@@ -164,9 +243,14 @@ protected:
 #undef _Uniform_typedef
 #undef _Attribute_typedef
 
+	typedef Uniform_sampler2D uniform_sampler2D;
 	typedef Uniform_sampler3D uniform_sampler3D;
+	typedef Uniform_usampler3D uniform_usampler3D;
+	typedef Uniform_samplerCube uniform_samplerCube;
+	typedef Uniform_image2D uniform_image2D;
 
 	Program(const char *name, VertexShaderSource const &vertex_shader_source, FragmentShaderSource const &fragment_shader_source);
+	Program(const char *name, ComputeShaderSource const &compute_shader_source);
 };
 
 // Base class for declaring shader interfaces.
@@ -177,9 +261,10 @@ protected:
 //
 // class MyShaders : public gl::Shaders {
 //   struct MyProgram : gl::Program {
-//     gl::Attribute position = {"position"};
-//     gl::Attribute position = {"color"};
-//     MyProgram() : Program(my_vert, my_frag) {}
+//     typedef Src::my_vert_interface V;
+//     static constexpr in_vec3 position = V::position;
+//     static constexpr in_vec4 color = V::color;
+//     MyProgram() : Program("MyProgram", Src::my_vert, Src::my_frag) {}
 //   };
 //   const MyProgram my_program;
 //
@@ -192,16 +277,20 @@ protected:
 // Upon instantiation, the Shaders base class registers a static global metadata
 // builder that gathers structure information as it is being initialized. The
 // fields are then initialized in a DFS-order, registering themselves into that
-// builder. The gl::Program adds itself to the list of programs, each
-// gl::Attribute adds itself to the list of attributes of the current program,
-// and so on.
+// builder. Each gl::Program adds itself to the list of programs.
+//
+// Uniforms and attributes don't take part in that. The shader_bundler reflects
+// them from the .glsl files, which must give each one an explicit
+// layout(location = N), and emits a constexpr handle for each. Declaring one
+// with a type that doesn't match the GLSL, or one that doesn't exist, is a
+// compile error, and there are no location lookups at runtime.
 //
 // If done correctly, you can do this:
 //
 //   MyShaders shaders;
 //   shaders.compile_all();
 //   shaders.my_program.program_id; // <- will be filled
-//   shaders.my_program.position.location; // <- will be filled
+//   shaders.my_program.position.location; // <- known at compile time
 //   // etc.
 //
 // As for the shader sources, use the shader_bundler to generate those from
@@ -210,9 +299,15 @@ class Shaders {
 	std::vector<Program *> programs;
 	std::vector<VertexShader *> vertex_shaders;
 	std::vector<FragmentShader *> fragment_shaders;
+	std::vector<ComputeShader *> compute_shaders;
 
 public:
 	// Compile all declared programs.
+	//
+	// When the driver supports GL_KHR_parallel_shader_compile, all the shaders
+	// and programs are submitted first and only then polled for completion, so
+	// that the driver can work on them in parallel. Otherwise each one is
+	// compiled synchronously.
 	void compile_all();
 
 	friend class ShadersBuilder;
@@ -221,6 +316,10 @@ public:
 
 protected:
 	Shaders();
+
+private:
+	void submit_all();
+	void compile_all_sync();
 };
 
 }  // namespace gl
\ No newline at end of file
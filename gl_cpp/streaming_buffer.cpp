@@ -0,0 +1,93 @@
+#include "streaming_buffer.h"
+
+#include <format>
+
+namespace gl {
+
+StreamingBuffer::~StreamingBuffer() {
+	for (GLsync fence : fences) {
+		glDeleteSync(fence);
+	}
+	if (_buffer_id != 0) {
+		glUnmapNamedBuffer(_buffer_id);
+		glDeleteBuffers(1, &_buffer_id);
+	}
+}
+
+void StreamingBuffer::create(GLsizeiptr region_size, int region_count, bool is_coherent) {
+	assert(_buffer_id == 0);
+	assert(region_size > 0 && region_count > 0);
+	_region_size = region_size;
+	_is_coherent = is_coherent;
+	fences.assign(region_count, nullptr);
+
+	const GLbitfield coherent_bit = is_coherent ? GL_MAP_COHERENT_BIT : 0;
+	gl_error_guard(glCreateBuffers(1, &_buffer_id));
+	gl_error_guard(glNamedBufferStorage(
+			_buffer_id, region_size * region_count, nullptr,
+			GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | coherent_bit));
+	const GLbitfield flush_bit = is_coherent ? 0 : GL_MAP_FLUSH_EXPLICIT_BIT;
+	mapped = static_cast<std::byte *>(glMapNamedBufferRange(
+			_buffer_id, 0, region_size * region_count,
+			GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | coherent_bit | flush_bit));
+	if (mapped == nullptr) {
+		throw gl::exception("Unable to map streaming buffer", glGetError());
+	}
+}
+
+void StreamingBuffer::next_frame() {
+	assert(_buffer_id != 0);
+	if (region >= 0) {
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	region = (region + 1) % region_count();
+	region_used = 0;
+	if (fences[region] != nullptr) {
+		wait(fences[region]);
+		glDeleteSync(fences[region]);
+		fences[region] = nullptr;
+	}
+}
+
+void StreamingBuffer::flush(GLintptr offset, GLsizeiptr size_bytes) {
+	if (!_is_coherent && size_bytes > 0) {
+		glFlushMappedNamedBufferRange(_buffer_id, offset, size_bytes);
+	}
+}
+
+void StreamingBuffer::flush_region() {
+	flush(region * _region_size, region_used);
+}
+
+GLintptr StreamingBuffer::allocate_bytes(GLsizeiptr size_bytes, GLsizeiptr alignment) {
+	assert(region >= 0);
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+	const GLintptr region_offset = region * _region_size;
+	// Aligned relative to the start of the buffer, which is what binding
+	// alignments are about.
+	const GLintptr offset = (region_offset + region_used + alignment - 1) & ~(alignment - 1);
+	if (offset + size_bytes > region_offset + _region_size) {
+		throw gl::exception(std::format(
+				"Streaming buffer region of {} bytes can't fit {} more bytes", _region_size, size_bytes));
+	}
+	region_used = offset + size_bytes - region_offset;
+	return offset;
+}
+
+// Waits for the GPU to pass the fence. The first wait flushes the commands, so
+// that the fence is sure to be signalled eventually.
+void StreamingBuffer::wait(GLsync fence) {
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while (true) {
+		const GLenum result = glClientWaitSync(fence, flags, 1'000'000'000);
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+			return;
+		}
+		if (result == GL_WAIT_FAILED) {
+			throw gl::exception("Waiting for streaming buffer region failed", glGetError());
+		}
+		flags = 0;
+	}
+}
+
+}  // namespace gl
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "common.h"
+
+namespace gl {
+
+// Range of a StreamingBuffer handed out by StreamingBuffer::allocate(). Write
+// the data through the pointer, flush it and then point the GPU at offset
+// within the buffer.
+template <typename T>
+struct StreamingAllocation {
+	T *data;
+	GLsizei count;
+	GLuint buffer_id;
+	GLintptr offset;
+
+	GLsizeiptr size_bytes() const { return count * sizeof(T); }
+};
+
+// Ring of region_count equal regions in one buffer that stays mapped for its
+// whole lifetime, for data the CPU writes anew every frame: per-frame instances,
+// uniform blocks, dynamic geometry, or staging for copies into other buffers.
+//
+// Each frame allocates from the next region. A fence at the end of the frame
+// guards the region, and the region is only reused once the GPU has passed it,
+// so writes never race the draws still reading the previous contents and the
+// driver never has to copy or synchronize behind the scenes.
+//
+// Unless the buffer is coherent, written ranges must be made visible with
+// flush() before the commands that read them are issued.
+class StreamingBuffer {
+	GLuint _buffer_id = 0;
+	std::byte *mapped = nullptr;
+	GLsizeiptr _region_size = 0;
+	bool _is_coherent = false;
+	std::vector<GLsync> fences;
+	int region = -1;
+	GLsizeiptr region_used = 0;
+
+public:
+	StreamingBuffer() = default;
+	StreamingBuffer(const StreamingBuffer &) = delete;
+	~StreamingBuffer();
+
+	GLuint buffer_id() const { return _buffer_id; }
+
+	GLsizeiptr region_size() const { return _region_size; }
+
+	int region_count() const { return fences.size(); }
+
+	bool is_coherent() const { return _is_coherent; }
+
+	// Allocates immutable storage for region_count regions of region_size bytes
+	// and maps it persistently. Three regions let the CPU run up to two frames
+	// ahead of the GPU.
+	void create(GLsizeiptr region_size, int region_count = 3, bool is_coherent = false);
+
+	// Fences the current region and moves on to the next one, waiting for the
+	// GPU to be done with it if needed. Call once per frame, before any
+	// allocate().
+	void next_frame();
+
+	// Allocates count objects of type T from the current region. The offset is a
+	// multiple of the alignment, which has to be a power of two; for binding
+	// ranges as uniform or storage blocks, pass the corresponding
+	// GL_*_OFFSET_ALIGNMENT. Throws gl::exception if the region is full.
+	template <typename T>
+	StreamingAllocation<T> allocate(GLsizei count, GLsizeiptr alignment = alignof(T)) {
+		const GLintptr offset = allocate_bytes(count * sizeof(T), alignment);
+		return {reinterpret_cast<T *>(mapped + offset), count, _buffer_id, offset};
+	}
+
+	// Allocates and fills in one go.
+	template <typename T>
+	StreamingAllocation<T> push(const T *data, GLsizei count, GLsizeiptr alignment = alignof(T)) {
+		StreamingAllocation<T> allocation = allocate<T>(count, alignment);
+		std::copy(data, data + count, allocation.data);
+		flush(allocation);
+		return allocation;
+	}
+
+	template <typename T, size_t N>
+	StreamingAllocation<T> push(const T (&data)[N], GLsizeiptr alignment = alignof(T)) {
+		return push(data, N, alignment);
+	}
+
+	// Makes the CPU writes to the range visible to the GPU. Wraps
+	// glFlushMappedNamedBufferRange, and does nothing for coherent buffers.
+	void flush(GLintptr offset, GLsizeiptr size_bytes);
+
+	template <typename T>
+	void flush(const StreamingAllocation<T> &allocation) {
+		flush(allocation.offset, allocation.size_bytes());
+	}
+
+	// Makes all the writes to the current region so far visible to the GPU.
+	void flush_region();
+
+private:
+	GLintptr allocate_bytes(GLsizeiptr size_bytes, GLsizeiptr alignment);
+	void wait(GLsync fence);
+};
+
+}  // namespace gl
@@ -20,9 +20,13 @@ struct TextureImageFormat {
 
 	constexpr TextureImageFormat(GLenum format, GLenum type)
 			: format(format), type(type) { }
+
+	size_t pixel_size() const { return component_count(format) * size_of(type); }
 };
 
 constexpr TextureImageFormat RED8 = {GL_RED, GL_UNSIGNED_BYTE};
+constexpr TextureImageFormat RGBA8 = {GL_RGBA, GL_UNSIGNED_BYTE};
+constexpr TextureImageFormat RGBA8UI = {GL_RGBA_INTEGER, GL_UNSIGNED_BYTE};
 
 class Texture {
 	GLuint _texture_id = 0;
@@ -77,6 +81,9 @@ struct BufferView {
 	template <typename T>
 	BufferView(const std::vector<T> &data)
 			: data(data.data()), size_bytes(data.size() * sizeof(T)) { }
+	template <typename T>
+	BufferView(const T *data, size_t count)
+			: data(data), size_bytes(count * sizeof(T)) { }
 };
 
 class Texture3D : public Texture {
@@ -106,10 +113,24 @@ public:
 	void sub_image(int level, int x, int y, int z, int sizex, int sizey, int sizez, TextureImageFormat format, BufferView data) {
 		assert_created();
 		assert(0 <= level && level < _levels);
-		assert(data.size_bytes == sizex * sizey * sizez * gl::size_of(data.type));
+		assert(data.size_bytes == sizex * sizey * sizez * format.pixel_size());
 		gl_error_guard(glTextureSubImage3D(texture_id(), level, x, y, z, sizex, sizey, sizez, format.format, format.type, data.data));
 	}
 
+	// Like sub_image(), but sources the pixels from offset within a buffer,
+	// through GL_PIXEL_UNPACK_BUFFER. The copy happens in order with the other
+	// commands, without the CPU waiting for it.
+	void sub_image(int level, int x, int y, int z, int sizex, int sizey, int sizez, TextureImageFormat format, GLuint unpack_buffer_id, GLintptr offset) {
+		assert_created();
+		assert(0 <= level && level < _levels);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack_buffer_id);
+		gl_if_error(glTextureSubImage3D(texture_id(), level, x, y, z, sizex, sizey, sizez, format.format, format.type, reinterpret_cast<const void *>(offset))) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			throw ::gl::exception("Error during glTextureSubImage3D from buffer", error);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
 	void image(int level, TextureImageFormat format, BufferView data) {
 		glm::uvec3 s = size(level);
 		sub_image(level, 0, 0, 0, s.x, s.y, s.z, format, std::move(data));
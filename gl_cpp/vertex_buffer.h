@@ -5,6 +5,7 @@
 
 #include "common.h"
 #include "shaders.h"
+#include "vertex_format.h"
 
 namespace gl {
 
@@ -39,17 +40,31 @@ public:
 		glNamedBufferData(_buffer_id, vertex_count * sizeof(T), data, usage);
 	}
 
+	// Allocates uninitialized storage for the given number of vertices, to be
+	// filled with buffer_sub_data().
+	void allocate(GLsizei vertex_count, GLenum usage = GL_DYNAMIC_DRAW) {
+		buffer_data(nullptr, vertex_count, usage);
+	}
+
+	// Overwrites vertex_count vertices starting at first.
+	void buffer_sub_data(GLsizei first, const T *data, GLsizei vertex_count) {
+		assert_created();
+		assert(first + vertex_count <= _vertex_count);
+		glNamedBufferSubData(_buffer_id, first * sizeof(T), vertex_count * sizeof(T), data);
+	}
+
 	// Uploads fixed-size array data to the buffer.
 	template <size_t N>
 	void buffer_data(const T (&data)[N], GLenum usage = GL_STATIC_DRAW) {
 		buffer_data(data, sizeof(data) / sizeof(T), usage);
 	}
 
-	// Binds the buffer for building a vertex array.
-	void bind(std::function<void(VertexArrayBuilder, const T *)> build) const {
+	// Binds the buffer for building a vertex array. With a non-zero divisor, the
+	// attributes advance per that many instances instead of per vertex.
+	void bind(std::function<void(VertexArrayBuilder, const T *)> build, GLuint divisor = 0) const {
 		assert_created();
 		glBindBuffer(GL_ARRAY_BUFFER, _buffer_id);
-		build(VertexArrayBuilder(sizeof(T)), nullptr);
+		build(VertexArrayBuilder(sizeof(T), divisor), nullptr);
 	}
 
 	void assert_created() const {
@@ -68,44 +83,34 @@ public:
 // Use VertexBuffer::bind to get an instance of this class.
 class VertexArrayBuilder {
 	GLsizei stride;
+	GLuint divisor;
 
 public:
-#define _enable_attribute_scalar(glsl_type, gl_component_type, cpp_component_type)                 \
-	void enable_attribute(const Attribute_##glsl_type &attribute, const cpp_component_type &value) { \
-		enable_attribute(attribute.location, 1, gl_component_type, &value);                            \
-	}
-#define _enable_attribute_vector(value_size, attribute_size, glsl_vec_prefix, gl_component_type)                                                 \
-	void enable_attribute(const Attribute_##glsl_vec_prefix##vec##attribute_size &attribute, const glm::glsl_vec_prefix##vec##value_size &value) { \
-		enable_attribute(attribute.location, value_size, gl_component_type, &value);                                                                 \
+	// Points the attribute at the field of the vertex type, given as a member of
+	// the base pointer passed to the bind() callback.
+	//
+	// The field type must have a VertexFormat of the same kind as the attribute,
+	// with at most as many components. A field of four components can feed a
+	// three component attribute too, so that packed and padded formats fit.
+	template <typename A, typename T>
+	void enable_attribute(const A &attribute, const T &value) {
+		typedef VertexFormat<T> F;
+		static_assert(F::kind == A::kind, "Attribute and vertex field are of different kinds: float, int or uint");
+		static_assert(
+				F::size <= A::component_count || (F::size == 4 && A::component_count == 3),
+				"Vertex field has more components than the attribute");
+		if constexpr (F::kind == AttributeKind::FLOAT) {
+			glVertexAttribPointer(attribute.location, F::size, F::type, F::normalized, stride, &value);
+		} else {
+			glVertexAttribIPointer(attribute.location, F::size, F::type, stride, &value);
+		}
+		glVertexAttribDivisor(attribute.location, divisor);
+		glEnableVertexAttribArray(attribute.location);
 	}
-#define _enable_attribute_overloads(glsl_component_type, glsl_vec_prefix, gl_component_type, cpp_component_type) \
-	_enable_attribute_scalar(glsl_component_type, gl_component_type, cpp_component_type);                          \
-	_enable_attribute_scalar(glsl_vec_prefix##vec2, gl_component_type, cpp_component_type);                        \
-	_enable_attribute_scalar(glsl_vec_prefix##vec3, gl_component_type, cpp_component_type);                        \
-	_enable_attribute_scalar(glsl_vec_prefix##vec4, gl_component_type, cpp_component_type);                        \
-	_enable_attribute_vector(2, 2, glsl_vec_prefix, gl_component_type);                                            \
-	_enable_attribute_vector(2, 3, glsl_vec_prefix, gl_component_type);                                            \
-	_enable_attribute_vector(2, 4, glsl_vec_prefix, gl_component_type);                                            \
-	_enable_attribute_vector(3, 3, glsl_vec_prefix, gl_component_type);                                            \
-	_enable_attribute_vector(3, 4, glsl_vec_prefix, gl_component_type);                                            \
-	_enable_attribute_vector(4, 4, glsl_vec_prefix, gl_component_type)
-
-	_enable_attribute_overloads(float, , GL_FLOAT, GLfloat);
-	_enable_attribute_overloads(int, i, GL_INT, GLint);
-	_enable_attribute_overloads(uint, u, GL_UNSIGNED_INT, GLuint);
-
-#undef _enable_attribute_overloads
-#undef _enable_attribute_vector
-#undef _enable_attribute_scalar
 
 private:
-	VertexArrayBuilder(GLsizei stride)
-			: stride(stride) { }
-
-	void enable_attribute(GLuint location, GLint component_count, GLenum component_type, const void *offset) {
-		glVertexAttribPointer(location, component_count, component_type, /* normalized */ GL_FALSE, stride, offset);
-		glEnableVertexAttribArray(location);
-	}
+	VertexArrayBuilder(GLsizei stride, GLuint divisor)
+			: stride(stride), divisor(divisor) { }
 
 	template <typename T>
 	friend struct VertexBuffer;
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <type_traits>
+
+#include "common.h"
+
+namespace gl {
+
+// How a shader reads an attribute: as floats, or as signed or unsigned
+// integers. Integer attributes take their values as they are, so they can only
+// be fed integers of the same signedness. Float attributes take floats, half
+// floats, or integers normalized to [0, 1] or [-1, 1].
+enum class AttributeKind {
+	FLOAT,
+	INT,
+	UINT,
+};
+
+// Rounds to the nearest half-precision float, ties to even.
+inline uint16_t float_to_half(float value) {
+	const uint32_t f = std::bit_cast<uint32_t>(value);
+	const uint32_t sign = (f >> 16) & 0x8000;
+	const uint32_t float_exponent = (f >> 23) & 0xff;
+	uint32_t mantissa = f & 0x7fffff;
+	if (float_exponent == 0xff) {
+		// Infinity stays infinity, NaN stays NaN.
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	}
+	const int exponent = (int)float_exponent - 127 + 15;
+	if (exponent >= 31) {
+		return sign | 0x7c00;
+	}
+	int shift = 13;
+	uint32_t half = sign | (uint32_t)exponent << 10;
+	if (exponent <= 0) {
+		// Subnormal, with the implicit leading bit made explicit.
+		if (exponent < -10) {
+			return sign;
+		}
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+		half = sign;
+	}
+	half |= mantissa >> shift;
+	// A carry out of the mantissa correctly bumps the exponent.
+	const uint32_t rest = mantissa & ((1u << shift) - 1);
+	const uint32_t halfway = 1u << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1))) {
+		++half;
+	}
+	return half;
+}
+
+// N half-precision floats, read by the shader as floats. Half the size of
+// floats, with about three significant decimal digits.
+template <int N>
+struct HalfVec {
+	uint16_t components[N];
+
+	HalfVec() = default;
+	explicit HalfVec(const glm::vec<N, float> &v) {
+		for (int i = 0; i < N; ++i) {
+			components[i] = float_to_half(v[i]);
+		}
+	}
+};
+
+// N integer components, read by the shader as floats: unsigned ones mapped to
+// [0, 1], and signed ones to [-1, 1].
+template <int N, typename T>
+struct NormalizedVec {
+	static_assert(std::is_integral_v<T> && sizeof(T) <= 2, "Only 8 and 16 bit components can be normalized");
+
+	T components[N];
+
+	NormalizedVec() = default;
+	explicit NormalizedVec(const glm::vec<N, float> &v) {
+		constexpr float min = std::is_signed_v<T> ? -1.0f : 0.0f;
+		for (int i = 0; i < N; ++i) {
+			components[i] = (T)std::round(std::clamp(v[i], min, 1.0f) * std::numeric_limits<T>::max());
+		}
+	}
+};
+
+// Signed x, y and z of 10 bits and w of 2 bits, packed from the lowest bits up
+// into 32 bits, and read by the shader as floats normalized to [-1, 1]. Holds a
+// normal in a third of the space of floats.
+struct Int2_10_10_10Rev {
+	uint32_t bits;
+
+	Int2_10_10_10Rev() = default;
+	explicit Int2_10_10_10Rev(const glm::vec4 &v) {
+		auto pack = [](float c, int bit_count) {
+			const int max = (1 << (bit_count - 1)) - 1;
+			const int i = (int)std::round(std::clamp(c, -1.0f, 1.0f) * max);
+			return (uint32_t)i & ((1u << bit_count) - 1);
+		};
+		bits = pack(v.x, 10) | pack(v.y, 10) << 10 | pack(v.z, 10) << 20 | pack(v.w, 2) << 30;
+	}
+	explicit Int2_10_10_10Rev(const glm::vec3 &v)
+			: Int2_10_10_10Rev(glm::vec4(v, 0.0f)) { }
+};
+
+template <GLint size_, GLenum type_, bool normalized_, AttributeKind kind_>
+struct VertexFormatTraits {
+	// Number of components.
+	static constexpr GLint size = size_;
+	static constexpr GLenum type = type_;
+	static constexpr bool normalized = normalized_;
+	static constexpr AttributeKind kind = kind_;
+};
+
+// Describes how a C++ type is laid out as a vertex attribute, for
+// VertexArrayBuilder. Only the types below have one, so that an attribute
+// can't be fed a type it doesn't support.
+template <typename T>
+struct VertexFormat;
+
+#define _component_VertexFormat(cpp_type, gl_type, attribute_kind)                                                        \
+	template <>                                                                                                             \
+	struct VertexFormat<cpp_type> : VertexFormatTraits<1, gl_type, false, AttributeKind::attribute_kind> { };               \
+	template <int N>                                                                                                        \
+	struct VertexFormat<glm::vec<N, cpp_type>> : VertexFormatTraits<N, gl_type, false, AttributeKind::attribute_kind> { }
+
+_component_VertexFormat(GLfloat, GL_FLOAT, FLOAT);
+_component_VertexFormat(GLint, GL_INT, INT);
+_component_VertexFormat(GLuint, GL_UNSIGNED_INT, UINT);
+_component_VertexFormat(GLshort, GL_SHORT, INT);
+_component_VertexFormat(GLushort, GL_UNSIGNED_SHORT, UINT);
+_component_VertexFormat(GLbyte, GL_BYTE, INT);
+_component_VertexFormat(GLubyte, GL_UNSIGNED_BYTE, UINT);
+
+#undef _component_VertexFormat
+
+template <int N>
+struct VertexFormat<HalfVec<N>> : VertexFormatTraits<N, GL_HALF_FLOAT, false, AttributeKind::FLOAT> { };
+
+template <int N>
+struct VertexFormat<NormalizedVec<N, GLbyte>> : VertexFormatTraits<N, GL_BYTE, true, AttributeKind::FLOAT> { };
+
+template <int N>
+struct VertexFormat<NormalizedVec<N, GLubyte>> : VertexFormatTraits<N, GL_UNSIGNED_BYTE, true, AttributeKind::FLOAT> { };
+
+template <int N>
+struct VertexFormat<NormalizedVec<N, GLshort>> : VertexFormatTraits<N, GL_SHORT, true, AttributeKind::FLOAT> { };
+
+template <int N>
+struct VertexFormat<NormalizedVec<N, GLushort>> : VertexFormatTraits<N, GL_UNSIGNED_SHORT, true, AttributeKind::FLOAT> { };
+
+template <>
+struct VertexFormat<Int2_10_10_10Rev> : VertexFormatTraits<4, GL_INT_2_10_10_10_REV, true, AttributeKind::FLOAT> { };
+
+}  // namespace gl
@@ -6,6 +6,8 @@ import (
 	"io"
 	"os"
 	"path"
+	"regexp"
+	"strconv"
 	"strings"
 	"time"
 )
@@ -31,8 +33,64 @@ type ShaderSourceInfo struct {
 	file        string
 	cppStruct   string
 	cppTypeEnum string
+	isVertex    bool
 }
 
+// A uniform or vertex attribute declared in a shader, with the location it was
+// explicitly assigned via layout(location = N).
+type ShaderVariable struct {
+	name     string
+	glslType string
+	location int
+}
+
+// A shader storage block, with the binding point it was explicitly assigned
+// via layout(binding = N).
+type StorageBlock struct {
+	name    string
+	binding int
+}
+
+// The reflected interface of a single shader.
+type ShaderInterface struct {
+	uniforms      []ShaderVariable
+	attributes    []ShaderVariable
+	storageBlocks []StorageBlock
+}
+
+// GLSL types that have a corresponding ::gl::Uniform_* struct.
+var uniformTypes = map[string]bool{
+	"float": true, "vec2": true, "vec3": true, "vec4": true,
+	"int": true, "ivec2": true, "ivec3": true, "ivec4": true,
+	"uint": true, "uvec2": true, "uvec3": true, "uvec4": true,
+	"mat2": true, "mat3": true, "mat4": true,
+	"mat2x3": true, "mat2x4": true, "mat3x2": true,
+	"mat3x4": true, "mat4x2": true, "mat4x3": true,
+	"sampler2D": true, "sampler3D": true, "usampler3D": true, "samplerCube": true,
+	"image2D": true,
+}
+
+// GLSL types that have a corresponding ::gl::Attribute_* struct.
+var attributeTypes = map[string]bool{
+	"float": true, "vec2": true, "vec3": true, "vec4": true,
+	"int": true, "ivec2": true, "ivec3": true, "ivec4": true,
+	"uint": true, "uvec2": true, "uvec3": true, "uvec4": true,
+}
+
+// Matches global uniform and input declarations, optionally preceded by a
+// layout qualifier and followed by precision and interpolation qualifiers. Does
+// not attempt to handle the full GLSL grammar; declarations inside blocks or
+// split across lines are not supported.
+var declarationRegexp = regexp.MustCompile(
+	`^\s*(?:layout\s*\(([^)]*)\)\s*)?(uniform|in)\s+(?:(?:lowp|mediump|highp|flat|smooth|noperspective|readonly|writeonly|coherent|volatile|restrict)\s+)*(\w+)\s+(\w+)\s*;`)
+var locationRegexp = regexp.MustCompile(`\blocation\s*=\s*(\d+)`)
+
+// Matches the first line of a shader storage block declaration. Only the name
+// of the block is reflected, not its members.
+var storageBlockRegexp = regexp.MustCompile(
+	`^\s*layout\s*\(([^)]*)\)\s*(?:(?:readonly|writeonly|coherent|volatile|restrict)\s+)*buffer\s+(\w+)`)
+var bindingRegexp = regexp.MustCompile(`\bbinding\s*=\s*(\d+)`)
+
 func inferShaderSourceInfo(filePath string) ShaderSourceInfo {
 	info := ShaderSourceInfo{
 		name: fileStem(filePath),
@@ -41,15 +99,84 @@ func inferShaderSourceInfo(filePath string) ShaderSourceInfo {
 	if strings.HasSuffix(info.name, "_v") {
 		info.cppStruct = "::gl::VertexShaderSource"
 		info.cppTypeEnum = "GL_VERTEX_SHADER"
+		info.isVertex = true
 	} else if strings.HasSuffix(info.name, "_f") {
 		info.cppStruct = "::gl::FragmentShaderSource"
 		info.cppTypeEnum = "GL_FRAGMENT_SHADER"
+	} else if strings.HasSuffix(info.name, "_c") {
+		info.cppStruct = "::gl::ComputeShaderSource"
+		info.cppTypeEnum = "GL_COMPUTE_SHADER"
 	} else {
-		panic("Shader file name must end with _v or _f to indicate shader type. Was " + info.name + ".")
+		panic("Shader file name must end with _v, _f or _c to indicate shader type. Was " + info.name + ".")
 	}
 	return info
 }
 
+// Extracts the uniforms, the storage blocks and, for vertex shaders, the
+// attributes from GLSL source. Every one of them must have an explicit location
+// or binding, because that is what makes the runtime lookups unnecessary.
+func reflectShaderInterface(info *ShaderSourceInfo) ShaderInterface {
+	input, err := os.Open(info.file)
+	if err != nil {
+		panic(err)
+	}
+	defer input.Close()
+
+	var iface ShaderInterface
+	lines := bufio.NewScanner(input)
+	for lineNumber := 1; lines.Scan(); lineNumber++ {
+		line, _, _ := strings.Cut(lines.Text(), "//")
+		if match := storageBlockRegexp.FindStringSubmatch(line); match != nil {
+			bindingMatch := bindingRegexp.FindStringSubmatch(match[1])
+			if bindingMatch == nil {
+				panic(fmt.Sprintf("%s:%d: buffer %s must have an explicit layout(binding = N).", info.file, lineNumber, match[2]))
+			}
+			binding, err := strconv.Atoi(bindingMatch[1])
+			if err != nil {
+				panic(err)
+			}
+			iface.storageBlocks = append(iface.storageBlocks, StorageBlock{name: match[2], binding: binding})
+			continue
+		}
+		match := declarationRegexp.FindStringSubmatch(line)
+		if match == nil {
+			continue
+		}
+		layout, storage, glslType, name := match[1], match[2], match[3], match[4]
+		if storage == "in" && !info.isVertex {
+			// Inputs of other stages are varyings, not attributes.
+			continue
+		}
+		where := fmt.Sprintf("%s:%d: %s %s", info.file, lineNumber, storage, name)
+
+		locationMatch := locationRegexp.FindStringSubmatch(layout)
+		if locationMatch == nil {
+			panic(where + " must have an explicit layout(location = N).")
+		}
+		location, err := strconv.Atoi(locationMatch[1])
+		if err != nil {
+			panic(err)
+		}
+
+		variable := ShaderVariable{name: name, glslType: glslType, location: location}
+		if storage == "uniform" {
+			if !uniformTypes[glslType] {
+				panic(where + " has unsupported uniform type " + glslType + ".")
+			}
+			iface.uniforms = append(iface.uniforms, variable)
+		} else {
+			if !attributeTypes[glslType] {
+				panic(where + " has unsupported attribute type " + glslType + ".")
+			}
+			iface.attributes = append(iface.attributes, variable)
+		}
+	}
+	if err := lines.Err(); err != nil {
+		panic(err)
+	}
+	return iface
+}
+
 // The cppheader subcommand. Outputs the .h file declaring all the constants for
 // individual shaders.
 func subCmdCppHeader(header string, inputs []string) {
@@ -71,10 +198,27 @@ func subCmdCppHeader(header string, inputs []string) {
 		info := inferShaderSourceInfo(input)
 		fmt.Fprintf(out, "\t// %s\n", info.file)
 		fmt.Fprintf(out, "\tstatic const %s %s;\n", info.cppStruct, info.name)
+		outputCppInterface(&info, reflectShaderInterface(&info), out)
 	}
 	fmt.Fprintf(out, "};\n")
 }
 
+// Outputs the struct with constexpr handles of all the uniforms, attributes and
+// storage blocks of a shader, e.g. ShaderSources::solid_v_interface::Projection.
+func outputCppInterface(info *ShaderSourceInfo, iface ShaderInterface, out io.Writer) {
+	fmt.Fprintf(out, "\tstruct %s_interface {\n", info.name)
+	for _, u := range iface.uniforms {
+		fmt.Fprintf(out, "\t\tstatic constexpr ::gl::Uniform_%s %s = {%d, \"%s\"};\n", u.glslType, u.name, u.location, u.name)
+	}
+	for _, a := range iface.attributes {
+		fmt.Fprintf(out, "\t\tstatic constexpr ::gl::Attribute_%s %s = {%d, \"%s\"};\n", a.glslType, a.name, a.location, a.name)
+	}
+	for _, b := range iface.storageBlocks {
+		fmt.Fprintf(out, "\t\tstatic constexpr ::gl::StorageBlock %s = {%d, \"%s\"};\n", b.name, b.binding, b.name)
+	}
+	fmt.Fprintf(out, "\t};\n")
+}
+
 // The cppsrc subcommand. Outputs multiple .cpp files, one for each .glsl.
 func subCmdCppSrc(header string, inputs []string) {
 	outDir := path.Dir(header)
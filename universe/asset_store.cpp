@@ -0,0 +1,185 @@
+#include "asset_store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+
+#include <common_cpp/log.h>
+#include <common_cpp/sha256.h>
+#include <qoi.h>
+
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+static constexpr std::string_view TEMP_EXTENSION = ".tmp";
+static constexpr std::string_view QOI_EXTENSION = ".qoi";
+
+// Whether the file name is what qoi_name() gives. Others are from an earlier
+// naming scheme, and would never be reused.
+static bool is_asset_name(const string &name) {
+	const size_t hash_size = 2 * std::tuple_size_v<Sha256::Digest>;
+	if (!name.ends_with(QOI_EXTENSION) || name.size() < QOI_EXTENSION.size() + hash_size + 2) {
+		return false;
+	}
+	const size_t hash_begin = name.size() - QOI_EXTENSION.size() - hash_size;
+	if (name[hash_begin - 1] != '_') {
+		return false;
+	}
+	return std::all_of(name.begin() + hash_begin, name.end() - QOI_EXTENSION.size(), [](char c) {
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+	});
+}
+
+AssetStore::AssetStore(const AssetStoreOptions &options)
+		: options(options), writer(1) {
+	writer.submit([] { trace::set_thread_name("asset_writer"); });
+	fs::create_directories(options.dir);
+
+	// Left behind files are indexed oldest first, so they are the first to go.
+	std::vector<std::pair<fs::file_time_type, fs::path>> files;
+	for (const fs::directory_entry &file : fs::directory_iterator(options.dir)) {
+		if (!file.is_regular_file()) {
+			continue;
+		}
+		if (file.path().extension() == TEMP_EXTENSION || !is_asset_name(file.path().filename().string())) {
+			// From a write that never finished, or named the old way.
+			fs::remove(file.path());
+			continue;
+		}
+		files.emplace_back(file.last_write_time(), file.path());
+	}
+	std::sort(files.begin(), files.end());
+	std::lock_guard<std::mutex> lock(mut);
+	for (const auto &[time, path] : files) {
+		const string name = path.filename().string();
+		Entry &entry = entries[name];
+		entry.lru_position = lru_names.insert(lru_names.end(), name);
+		entry.size = fs::file_size(path);
+		entry.is_written = true;
+		total_size += entry.size;
+	}
+	evict_locked("");
+	LOG(INFO) << "Asset store " << squote(options.dir) << " with " << entries.size() << " files, "
+						<< (total_size >> 20) << " MB";
+}
+
+void AssetStore::put_qoi(const string &prefix, std::vector<uint8_t> &&pixels, int width, int height, string *path) {
+	writer.submit([this, prefix, pixels = std::move(pixels), width, height, path, task_id = trace::current_task_id()] {
+		trace::TaskScope task_scope(task_id);
+		string name;
+		{
+			trace::Span hash_span("hash");
+			name = qoi_name(prefix, pixels, width, height);
+		}
+		*path = options.dir + "/" + name;
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			if (auto it = entries.find(name); it != entries.end()) {
+				touch_locked(it->second);
+				return;
+			}
+			Entry &entry = entries[name];
+			entry.lru_position = lru_names.insert(lru_names.end(), name);
+		}
+
+		qoi_desc desc = {(unsigned int)width, (unsigned int)height, 3, QOI_LINEAR};
+		int size = 0;
+		void *encoded;
+		{
+			trace::Span encode_span("encode");
+			encoded = qoi_encode(pixels.data(), &desc, &size);
+		}
+		if (!encoded) {
+			LOG(ERROR) << "Failed to encode asset " << squote(name);
+			forget(name);
+			return;
+		}
+		const uint8_t *encoded_bytes = static_cast<const uint8_t *>(encoded);
+		write(name, std::vector<uint8_t>(encoded_bytes, encoded_bytes + size));
+		std::free(encoded);
+	});
+}
+
+string AssetStore::qoi_name(const string &prefix, const std::vector<uint8_t> &pixels, int width, int height) {
+	Sha256 sha;
+	sha.update_u32(width);
+	sha.update_u32(height);
+	sha.update(pixels.data(), pixels.size());
+	return prefix + "_" + Sha256::to_hex(sha.digest()) + string(QOI_EXTENSION);
+}
+
+void AssetStore::then(std::function<void()> &&function) {
+	writer.submit(std::move(function));
+}
+
+// Writes the file through a temporary one, so that it appears all at once.
+void AssetStore::write(const string &name, const std::vector<uint8_t> &bytes) {
+	trace::Span store_span("store");
+	const fs::path path = fs::path(options.dir) / name;
+	fs::path temp_path = path;
+	temp_path += TEMP_EXTENSION;
+	std::error_code error;
+	{
+		std::ofstream out(temp_path, std::ios::binary);
+		out.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+		if (!out.flush()) {
+			LOG(ERROR) << "Failed to write asset " << squote(temp_path.string());
+			fs::remove(temp_path, error);
+			forget(name);
+			return;
+		}
+	}
+	fs::rename(temp_path, path, error);
+	if (error) {
+		LOG(ERROR) << "Failed to rename asset " << squote(temp_path.string()) << ": " << error.message();
+		forget(name);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mut);
+	auto it = entries.find(name);
+	if (it == entries.end()) {
+		return;
+	}
+	it->second.size = bytes.size();
+	it->second.is_written = true;
+	total_size += bytes.size();
+	evict_locked(name);
+}
+
+// Deletes the least recently stored files, but the one to keep, until the rest
+// fit in the budget. Files still being written are skipped.
+void AssetStore::evict_locked(const string &keep) {
+	const uint64_t budget = (uint64_t)options.budget_mb << 20;
+	for (auto it = lru_names.begin(); it != lru_names.end() && total_size > budget;) {
+		const string &name = *it;
+		Entry &entry = entries.at(name);
+		if (!entry.is_written || name == keep) {
+			++it;
+			continue;
+		}
+		std::error_code error;
+		fs::remove(fs::path(options.dir) / name, error);
+		total_size -= entry.size;
+		entries.erase(name);
+		it = lru_names.erase(it);
+	}
+}
+
+void AssetStore::touch_locked(Entry &entry) {
+	lru_names.splice(lru_names.end(), lru_names, entry.lru_position);
+}
+
+// Drops the entry of a file that failed to be written, so that the next put()
+// of the same image tries again.
+void AssetStore::forget(const string &name) {
+	std::lock_guard<std::mutex> lock(mut);
+	if (auto it = entries.find(name); it != entries.end()) {
+		lru_names.erase(it->second.lru_position);
+		entries.erase(it);
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <common_cpp/thread_pool.h>
+
+#include "common.h"
+
+struct AssetStoreOptions {
+	// Directory the assets are written to, relative to the working directory,
+	// which the frontend serves under /static. Created if missing. The directory
+	// belongs to the store, which may delete anything in it.
+	string dir = "assets";
+	// Once the assets take more than this, in megabytes, the least recently
+	// stored ones are deleted.
+	int budget_mb = 1024;
+};
+
+// Images sent to clients by path, like skyboxes, stored in files named after
+// the SHA-256 of their size and pixels. A file never changes once it is in
+// place, so responses can't overwrite each other, and it is written to a
+// temporary file first and renamed, so a client can't fetch it half-written.
+// Storing the same image again reuses the file.
+//
+// Images are hashed, encoded and written on a single writer thread, in the
+// order they are put. Files already in the directory on startup are reused
+// too, and count towards the budget, unless they aren't named like assets.
+//
+// Only put() and then() from the render thread.
+class AssetStore {
+public:
+	const AssetStoreOptions options;
+
+	AssetStore(const AssetStoreOptions &options);
+	AssetStore(const AssetStore &) = delete;
+
+	// Stores the RGB image as QOI. Its path relative to the working directory is
+	// assigned to *path on the writer thread, so *path must be left alone until
+	// a function given to then() after this runs. The file is written by then
+	// too.
+	void put_qoi(const string &prefix, std::vector<uint8_t> &&pixels, int width, int height, string *path);
+
+	// Name of the file of the image: the prefix, then the hex SHA-256 of the
+	// width and height, as 4 bytes little endian each, followed by the pixels.
+	static string qoi_name(const string &prefix, const std::vector<uint8_t> &pixels, int width, int height);
+
+	// Calls the function on the writer thread once all the images put so far
+	// are in place, e.g. to send the responses that refer to them.
+	void then(std::function<void()> &&function);
+
+private:
+	struct Entry {
+		// Position in lru_names.
+		std::list<string>::iterator lru_position;
+		uint64_t size = 0;
+		bool is_written = false;
+	};
+
+	std::mutex mut;
+	std::unordered_map<string, Entry> entries;
+	// Names of the entries, least recently stored first.
+	std::list<string> lru_names;
+	uint64_t total_size = 0;
+
+	// Last, so that it is destroyed first and its jobs can't touch anything
+	// destroyed already.
+	ThreadPool writer;
+
+	void write(const string &name, const std::vector<uint8_t> &bytes);
+	void forget(const string &name);
+	void evict_locked(const string &keep);
+	void touch_locked(Entry &entry);
+};
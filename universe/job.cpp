@@ -1,7 +1,8 @@
 #include "job.h"
 
 #include <process.h>
-#include <iostream>
+
+#include <common_cpp/log.h>
 
 JobServiceServer::JobServiceServer(int argc, char **argv)
 		: command(assemble_command(argc, argv)), pid(_getpid()) { }
@@ -14,8 +15,18 @@ void JobServiceServer::set_on_quit(const std::function<void()> &callback) {
 	}
 }
 
+void JobServiceServer::set_metrics_source(const std::function<void(google::protobuf::Map<string, int64_t> &)> &callback) {
+	const std::lock_guard lock(mut);
+	metrics_source = callback;
+}
+
+void JobServiceServer::set_trace_source(const std::function<void(const pb::JobTraceRequest &, pb::JobTraceResponse &)> &callback) {
+	const std::lock_guard lock(mut);
+	trace_source = callback;
+}
+
 grpc::Status JobServiceServer::Attach(grpc::ServerContext *ctx, const google::protobuf::Empty *req, pb::JobAttachResponse *rsp) {
-	std::cout << "JobServiceServer::Attach" << std::endl;
+	LOG(INFO) << "JobServiceServer::Attach";
 	rsp->set_command(command);
 	rsp->set_pid(pid);
 	return grpc::Status::OK;
@@ -23,6 +34,10 @@ grpc::Status JobServiceServer::Attach(grpc::ServerContext *ctx, const google::pr
 
 grpc::Status JobServiceServer::Status(grpc::ServerContext *ctx, const google::protobuf::Empty *req, pb::JobStatusResponse *rsp) {
 	rsp->set_is_ready(true);
+	const std::lock_guard lock(mut);
+	if (metrics_source) {
+		metrics_source(*rsp->mutable_metrics());
+	}
 	return grpc::Status::OK;
 }
 
@@ -37,6 +52,15 @@ grpc::Status JobServiceServer::Quit(grpc::ServerContext *ctx, const google::prot
 	return grpc::Status::OK;
 }
 
+grpc::Status JobServiceServer::Trace(grpc::ServerContext *ctx, const pb::JobTraceRequest *req, pb::JobTraceResponse *rsp) {
+	const std::lock_guard lock(mut);
+	if (!trace_source) {
+		return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "The job doesn't record traces.");
+	}
+	trace_source(*req, *rsp);
+	return grpc::Status::OK;
+}
+
 string JobServiceServer::assemble_command(int argc, char **argv) {
 	string command;
 	for (int i = 0; i < argc; i++) {
@@ -14,15 +14,24 @@ class JobServiceServer final : public pb::JobService::Service {
 	std::mutex mut;
 	bool quit_requested = false;
 	std::function<void()> on_quit;
+	std::function<void(google::protobuf::Map<string, int64_t> &)> metrics_source;
+	std::function<void(const pb::JobTraceRequest &, pb::JobTraceResponse &)> trace_source;
 
 public:
 	JobServiceServer(int argc, char **argv);
 
 	void set_on_quit(const std::function<void()> &callback);
 
+	// The callback fills in the metrics reported by Status.
+	void set_metrics_source(const std::function<void(google::protobuf::Map<string, int64_t> &)> &callback);
+
+	// The callback answers Trace.
+	void set_trace_source(const std::function<void(const pb::JobTraceRequest &, pb::JobTraceResponse &)> &callback);
+
 	grpc::Status Attach(grpc::ServerContext *ctx, const google::protobuf::Empty *req, pb::JobAttachResponse *rsp) override;
 	grpc::Status Status(grpc::ServerContext *ctx, const google::protobuf::Empty *req, pb::JobStatusResponse *rsp) override;
 	grpc::Status Quit(grpc::ServerContext *ctx, const google::protobuf::Empty *req, google::protobuf::Empty *rsp) override;
+	grpc::Status Trace(grpc::ServerContext *ctx, const pb::JobTraceRequest *req, pb::JobTraceResponse *rsp) override;
 
 private:
 	static string assemble_command(int argc, char **argv);
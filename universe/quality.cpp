@@ -0,0 +1,68 @@
+#include "quality.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The tier only goes down while the latency is under this fraction of the
+// target, so that it doesn't flap around the target.
+static constexpr float STEP_DOWN_FRACTION = 0.5f;
+// Weight of the latest response in the average service time.
+static constexpr float SERVICE_SMOOTHING = 0.2f;
+
+int QualityController::pick(int queue_length) {
+	if (!is_enabled()) {
+		return 0;
+	}
+	std::lock_guard<std::mutex> lock(mut);
+	const float target = options.latency_target_ms;
+	// Every task ahead in the queue takes about the service time.
+	const float predicted_ms = (queue_length + 1) * average_service_ms;
+	const bool has_settled = (int)latencies.size() >= std::max(1, options.window / 4);
+	const float p95 = has_settled ? percentile_95_locked() : 0.0f;
+	// Both only from responses at this tier, which cost differently than those
+	// at the last one, so that a single slow task can't go through all the tiers.
+	const bool is_predicted_late = average_service_ms > 0.0f && predicted_ms > target;
+	const bool is_late = has_settled && p95 > target;
+	int next_tier = tier;
+	if (tier < TIER_COUNT - 1 && (is_predicted_late || is_late)) {
+		++next_tier;
+	} else if (tier > 0 && has_settled && p95 < STEP_DOWN_FRACTION * target
+			// A better tier costs about twice as much.
+			&& 2 * predicted_ms < STEP_DOWN_FRACTION * target) {
+		--next_tier;
+	}
+	if (next_tier != tier) {
+		tier = next_tier;
+		latencies.clear();
+		average_service_ms = 0.0f;
+	}
+	return tier;
+}
+
+int QualityController::current_tier() {
+	std::lock_guard<std::mutex> lock(mut);
+	return tier;
+}
+
+void QualityController::record(int tier, float wait_ms, float service_ms) {
+	std::lock_guard<std::mutex> lock(mut);
+	if (tier != this->tier) {
+		// Rendered before the last change.
+		return;
+	}
+	latencies.push_back(wait_ms + service_ms);
+	while ((int)latencies.size() > options.window) {
+		latencies.pop_front();
+	}
+	average_service_ms = average_service_ms == 0.0f
+			? service_ms
+			: average_service_ms + SERVICE_SMOOTHING * (service_ms - average_service_ms);
+}
+
+float QualityController::percentile_95_locked() const {
+	std::vector<float> sorted(latencies.begin(), latencies.end());
+	const size_t k = (size_t)std::ceil(0.95 * sorted.size()) - 1;
+	std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+	return sorted[k];
+}
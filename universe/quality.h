@@ -0,0 +1,77 @@
+#pragma once
+
+#include <deque>
+#include <iterator>
+#include <mutex>
+
+#include "common.h"
+
+struct QualityOptions {
+	// Target for the 95th percentile of the time from queueing a skybox task to
+	// sending its response, in milliseconds. Quality is never lowered if 0.
+	float latency_target_ms = 0.0f;
+	// Number of the latest responses the percentile is taken over.
+	int window = 64;
+};
+
+// What a skybox is rendered at under a quality tier.
+struct QualityTier {
+	// The face size is the requested one divided by 2 to this power.
+	int resolution_shift;
+	// Multiplies the pixels per unit the level of detail is selected for, so
+	// less than 1 draws more objects as points and merges more of them.
+	float lod_scale;
+};
+
+// Picks the quality tier of skybox tasks to keep the latency under the target
+// when the server is loaded, at the cost of resolution and level of detail.
+//
+// The tier goes up, i.e. the quality down, when the 95th percentile of the
+// recent responses is over the target, or when the tasks waiting in the queue
+// are predicted to miss it. It goes back down once the latency stays well under
+// the target. After a change, only the responses at the new tier count: the
+// prediction waits for one of them, and the percentile, either way, for a
+// quarter of the window.
+//
+// pick() is called from the render thread and record() from any thread.
+class QualityController {
+public:
+	// Best first. The first steps only coarsen the level of detail, which is
+	// cheap to render at and hardly visible.
+	static constexpr QualityTier TIERS[] = {
+		{.resolution_shift = 0, .lod_scale = 1.0f},
+		{.resolution_shift = 0, .lod_scale = 0.5f},
+		{.resolution_shift = 1, .lod_scale = 0.5f},
+		{.resolution_shift = 2, .lod_scale = 0.5f},
+	};
+	static constexpr int TIER_COUNT = std::size(TIERS);
+
+	const QualityOptions options;
+
+	QualityController(const QualityOptions &options)
+			: options(options) { }
+
+	bool is_enabled() const { return options.latency_target_ms > 0; }
+
+	// Tier for the next task, with queue_length tasks waiting behind it.
+	int pick(int queue_length);
+
+	// Tier picked last, without picking again.
+	int current_tier();
+
+	// Records the response of a task rendered at the tier, that waited wait_ms
+	// in the queue and took service_ms more until its response was sent.
+	// Ignored unless the tier is still the current one.
+	void record(int tier, float wait_ms, float service_ms);
+
+private:
+	std::mutex mut;
+	int tier = 0;
+	// End to end latencies of the latest responses, since the tier last changed.
+	std::deque<float> latencies;
+	// Moving average of the service time since the tier last changed, 0 until
+	// the first response.
+	float average_service_ms = 0.0f;
+
+	float percentile_95_locked() const;
+};
@@ -4,6 +4,7 @@
 #include <iostream>
 
 #include "task.h"
+#include "trace.h"
 
 RpcServer::RpcServer(int argc, char **argv, TaskQueue &tasks)
 		: job_service(argc, argv)
@@ -21,6 +22,30 @@ void RpcServer::start(const string &addr) {
 	}
 
 	job_service.set_on_quit(std::bind(&RpcServer::ensure_quit, this));
+	job_service.set_metrics_source([this](google::protobuf::Map<string, int64_t> &metrics) {
+		metrics["tasks_cancelled_pending"] = tasks.stats.cancelled_pending;
+		metrics["tasks_cancelled_before_render"] = tasks.stats.cancelled_before_render;
+		metrics["tasks_cancelled_before_encode"] = tasks.stats.cancelled_before_encode;
+		metrics["skybox_prefetch_hits"] = tasks.stats.prefetch_hits;
+		metrics["skybox_prefetch_misses"] = tasks.stats.prefetch_misses;
+		metrics["skybox_prefetch_renders"] = tasks.stats.prefetch_renders;
+		metrics["skybox_prefetch_wasted"] = tasks.stats.prefetch_wasted;
+		metrics["occlusion_passes"] = tasks.stats.occlusion_passes;
+		metrics["occlusion_drawn_early"] = tasks.stats.occlusion_drawn_early;
+		metrics["occlusion_drawn_late"] = tasks.stats.occlusion_drawn_late;
+		metrics["occlusion_frustum_culled"] = tasks.stats.occlusion_frustum_culled;
+		metrics["occlusion_culled"] = tasks.stats.occlusion_culled;
+		metrics["skybox_renders"] = tasks.stats.skybox_renders;
+		metrics["skybox_render_gpu_us"] = tasks.stats.skybox_render_gpu_us;
+		metrics["quality_tier"] = tasks.stats.quality_tier;
+		metrics["degraded_skyboxes"] = tasks.stats.degraded_skyboxes;
+	});
+	job_service.set_trace_source([](const pb::JobTraceRequest &req, pb::JobTraceResponse &rsp) {
+		rsp.set_trace_json(trace::dump_json(req.clear()));
+		if (req.has_enabled()) {
+			trace::set_enabled(req.enabled());
+		}
+	});
 
 	waiting_thread = std::thread([=] { server->Wait(); });
 }
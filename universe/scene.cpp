@@ -0,0 +1,294 @@
+#include "scene.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+void SceneBuffer::push(const glm::vec3 &position, float scale, const glm::vec3 &color, float phase) {
+	positions.push_back(position);
+	scales.push_back(scale);
+	colors.push_back(color);
+	phases.push_back(phase);
+}
+
+void SceneBuffer::push_light(const glm::vec3 &position, float radius, const glm::vec3 &color) {
+	lights.push_back({.position = position, .radius = radius, .color = color, ._padding = 0.0f});
+}
+
+SceneColumns SceneBuffer::columns() const {
+	return {
+		.count = positions.size(),
+		.positions = positions.data(),
+		.scales = scales.data(),
+		.colors = colors.data(),
+		.phases = phases.data(),
+		.light_count = lights.size(),
+		.lights = lights.data(),
+	};
+}
+
+SceneClusters SceneClusters::build(const SceneColumns &scene, float cell_size) {
+	SceneClusters result;
+	if (scene.count == 0) {
+		return result;
+	}
+	if (cell_size <= 0) {
+		glm::vec3 min = scene.positions[0];
+		glm::vec3 max = scene.positions[0];
+		for (size_t i = 1; i < scene.count; ++i) {
+			min = glm::min(min, scene.positions[i]);
+			max = glm::max(max, scene.positions[i]);
+		}
+		const glm::vec3 extent = glm::max(max - min, glm::vec3(1.0f));
+		cell_size = std::cbrt(extent.x * extent.y * extent.z * TARGET_CLUSTER_SIZE / scene.count);
+	}
+
+	// First pass assigns the cells to clusters and counts their objects.
+	auto cell_key = [cell_size](const glm::vec3 &position) {
+		const glm::i64vec3 cell = glm::i64vec3(glm::floor(position / cell_size));
+		constexpr uint64_t MASK = (1 << 21) - 1;
+		return ((uint64_t)cell.x & MASK) << 42 | ((uint64_t)cell.y & MASK) << 21 | ((uint64_t)cell.z & MASK);
+	};
+	std::unordered_map<uint64_t, uint32_t> cluster_indices;
+	std::vector<uint32_t> object_clusters(scene.count);
+	for (size_t i = 0; i < scene.count; ++i) {
+		auto [it, is_new] = cluster_indices.try_emplace(cell_key(scene.positions[i]), result.clusters.size());
+		if (is_new) {
+			result.clusters.push_back({.center = glm::vec3(0.0f), .radius = 0.0f, .color = glm::vec3(0.0f)});
+		}
+		object_clusters[i] = it->second;
+		SceneCluster &cluster = result.clusters[it->second];
+		const float coverage = scene.scales[i] * scene.scales[i];
+		cluster.center += scene.positions[i];
+		cluster.color += coverage * scene.colors[i];
+		cluster.coverage += coverage;
+		++cluster.count;
+	}
+
+	uint32_t first = 0;
+	for (SceneCluster &cluster : result.clusters) {
+		cluster.center /= (float)cluster.count;
+		if (cluster.coverage > 0) {
+			cluster.color /= cluster.coverage;
+		}
+		cluster.first = first;
+		first += cluster.count;
+		cluster.count = 0;
+	}
+
+	// Second pass fills in the order and the bounding spheres. The cube mesh
+	// spans [-1, 1], so an object of scale s fits in a sphere of radius
+	// sqrt(3) * s.
+	result.order.resize(scene.count);
+	for (size_t i = 0; i < scene.count; ++i) {
+		SceneCluster &cluster = result.clusters[object_clusters[i]];
+		result.order[cluster.first + cluster.count++] = i;
+		const float extent = glm::distance(cluster.center, scene.positions[i]) + std::sqrt(3.0f) * scene.scales[i];
+		cluster.radius = std::max(cluster.radius, extent);
+	}
+	return result;
+}
+
+static float randf(float min, float max) {
+	float t = (float)std::rand() / RAND_MAX;
+	return (1 - t) * min + t * max;
+}
+
+static float randf() {
+	return randf(0, 1);
+}
+
+SceneBuffer default_scene() {
+	SceneBuffer scene;
+	const glm::vec3 axes[] = {
+		{1.0f, 0.0f, 0.0f},
+		{-1.0f, 0.0f, 0.0f},
+		{0.0f, 1.0f, 0.0f},
+		{0.0f, -1.0f, 0.0f},
+		{0.0f, 0.0f, 1.0f},
+		{0.0f, 0.0f, -1.0f},
+	};
+	const glm::vec3 axis_colors[] = {
+		{1.0f, 0.0f, 0.0f},
+		{0.5f, 0.5f, 0.0f},
+		{0.0f, 1.0f, 0.0f},
+		{0.0f, 0.5f, 0.5f},
+		{0.0f, 0.0f, 1.0f},
+		{0.5f, 0.0f, 0.5f},
+	};
+
+	for (int i = 0; i < 6; ++i) {
+		scene.push(10.0f * axes[i], 1.0f, axis_colors[i], 0.0f);
+	}
+	for (int i = 0; i < 6; ++i) {
+		for (int j = 0; j < 6; ++j) {
+			scene.push(10.0f * (axes[i] + 0.15f * axes[j]), 0.2f, 0.9f * axis_colors[j], 1.0f);
+		}
+	}
+
+	for (int i = 0; i < 200; ++i) {
+		glm::vec3 p = {randf(-10, 10), randf(-10, 10), randf(-10, 10)};
+		glm::normalize(p);
+		p *= randf(3, 10);
+		const glm::vec3 color = {randf(), randf(), randf()};
+		const float phase = randf(-10, 10);
+		scene.push(p, randf(1.0, 4.0), color, phase);
+	}
+
+	return scene;
+}
+
+static size_t align_up(size_t offset) {
+	return (offset + SceneFile::ALIGNMENT - 1) / SceneFile::ALIGNMENT * SceneFile::ALIGNMENT;
+}
+
+SceneFile::SceneFile(const string &path) {
+#ifdef _WIN32
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		file_handle = nullptr;
+		throw std::runtime_error("Failed to open scene file " + squote(path));
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size)) {
+		unmap();
+		throw std::runtime_error("Failed to get the size of scene file " + squote(path));
+	}
+	size = file_size.QuadPart;
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	data = mapping_handle ? MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!data) {
+		unmap();
+		throw std::runtime_error("Failed to map scene file " + squote(path));
+	}
+#else
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open scene file " + squote(path));
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to get the size of scene file " + squote(path));
+	}
+	size = st.st_size;
+	data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		data = nullptr;
+		throw std::runtime_error("Failed to map scene file " + squote(path));
+	}
+#endif
+
+	auto fail = [&](const string &reason) {
+		unmap();
+		throw std::runtime_error("Invalid scene file " + squote(path) + ": " + reason);
+	};
+	const size_t v1_header_size = offsetof(SceneFileHeader, light_count);
+	if (size < v1_header_size) {
+		fail("too short");
+	}
+	const SceneFileHeader &h = header();
+	if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0) {
+		fail("bad magic");
+	}
+	if (h.version < 1 || h.version > VERSION) {
+		fail("unsupported version " + to_string(h.version));
+	}
+	// The columns are found by their offsets, so a longer header from a writer
+	// that added fields is fine, but a shorter one would overlap them.
+	const size_t version_header_size = h.version >= 2 ? sizeof(SceneFileHeader) : v1_header_size;
+	if (h.header_size < version_header_size || h.header_size > size) {
+		fail("header size " + to_string(h.header_size) + " doesn't fit version " + to_string(h.version));
+	}
+	auto column = [&](uint64_t offset, size_t element_size, uint64_t count) -> const void * {
+		if (offset % ALIGNMENT != 0 || offset > size || (size - offset) / element_size < count) {
+			fail("column at " + to_string(offset) + " out of bounds");
+		}
+		return static_cast<const char *>(data) + offset;
+	};
+	_columns = {
+		.count = h.object_count,
+		.positions = static_cast<const glm::vec3 *>(column(h.positions_offset, sizeof(glm::vec3), h.object_count)),
+		.scales = static_cast<const float *>(column(h.scales_offset, sizeof(float), h.object_count)),
+		.colors = static_cast<const glm::vec3 *>(column(h.colors_offset, sizeof(glm::vec3), h.object_count)),
+		.phases = static_cast<const float *>(column(h.phases_offset, sizeof(float), h.object_count)),
+	};
+	if (h.version >= 2) {
+		_columns.light_count = h.light_count;
+		_columns.lights = static_cast<const SceneLight *>(column(h.lights_offset, sizeof(SceneLight), h.light_count));
+	}
+}
+
+SceneFile::~SceneFile() {
+	unmap();
+}
+
+void SceneFile::unmap() {
+#ifdef _WIN32
+	if (data) {
+		UnmapViewOfFile(data);
+	}
+	if (mapping_handle) {
+		CloseHandle(mapping_handle);
+	}
+	if (file_handle) {
+		CloseHandle(file_handle);
+	}
+	mapping_handle = file_handle = nullptr;
+#else
+	if (data) {
+		munmap(data, size);
+	}
+#endif
+	data = nullptr;
+}
+
+void SceneFile::write(const string &path, const SceneColumns &columns, uint64_t seed) {
+	SceneFileHeader header = {};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.header_size = sizeof(SceneFileHeader);
+	header.object_count = columns.count;
+	header.seed = seed;
+	header.positions_offset = align_up(sizeof(SceneFileHeader));
+	header.scales_offset = align_up(header.positions_offset + columns.count * sizeof(glm::vec3));
+	header.colors_offset = align_up(header.scales_offset + columns.count * sizeof(float));
+	header.phases_offset = align_up(header.colors_offset + columns.count * sizeof(glm::vec3));
+	header.light_count = columns.light_count;
+	header.lights_offset = align_up(header.phases_offset + columns.count * sizeof(float));
+
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		throw std::runtime_error("Failed to open " + squote(path) + " for writing");
+	}
+	size_t offset = 0;
+	auto write_at = [&](uint64_t column_offset, const void *bytes, size_t byte_count) {
+		static const char padding[ALIGNMENT] = {};
+		out.write(padding, column_offset - offset);
+		out.write(static_cast<const char *>(bytes), byte_count);
+		offset = column_offset + byte_count;
+	};
+	write_at(0, &header, sizeof(header));
+	write_at(header.positions_offset, columns.positions, columns.count * sizeof(glm::vec3));
+	write_at(header.scales_offset, columns.scales, columns.count * sizeof(float));
+	write_at(header.colors_offset, columns.colors, columns.count * sizeof(glm::vec3));
+	write_at(header.phases_offset, columns.phases, columns.count * sizeof(float));
+	write_at(header.lights_offset, columns.lights, columns.light_count * sizeof(SceneLight));
+	if (!out.flush()) {
+		throw std::runtime_error("Failed to write " + squote(path));
+	}
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "common.h"
+#include "math.h"
+
+// Positions and colors are stored as glm::vec3, both in memory and in files.
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float));
+
+// Point light, e.g. a star. Its intensity falls off with the square of the
+// distance and fades out to nothing at the radius, so that it only needs to be
+// considered within it.
+struct SceneLight {
+	glm::vec3 position;
+	float radius;
+	glm::vec3 color;
+	float _padding;
+};
+// Uploaded as is to a std430 storage buffer, and stored as is in files.
+static_assert(sizeof(SceneLight) == 32);
+
+// Read-only view of the objects of a scene, one column per property, so that
+// each can be uploaded to a GPU buffer as it is. The lights are separate from
+// the objects.
+struct SceneColumns {
+	size_t count = 0;
+	const glm::vec3 *positions = nullptr;
+	const float *scales = nullptr;
+	const glm::vec3 *colors = nullptr;
+	const float *phases = nullptr;
+	size_t light_count = 0;
+	const SceneLight *lights = nullptr;
+};
+
+// Scene objects held in memory.
+struct SceneBuffer {
+	std::vector<glm::vec3> positions;
+	std::vector<float> scales;
+	std::vector<glm::vec3> colors;
+	std::vector<float> phases;
+	std::vector<SceneLight> lights;
+
+	void push(const glm::vec3 &position, float scale, const glm::vec3 &color, float phase);
+	void push_light(const glm::vec3 &position, float radius, const glm::vec3 &color);
+
+	SceneColumns columns() const;
+};
+
+// Objects of a scene grouped by the cells of a uniform grid, for level of
+// detail. A cluster far enough away is drawn as a single point standing for all
+// its objects.
+struct SceneCluster {
+	// Bounding sphere of the objects, including their extent.
+	glm::vec3 center;
+	float radius;
+	// Mean color of the objects weighted by their coverage.
+	glm::vec3 color;
+	// Sum of the squared object scales, proportional to the area the objects
+	// cover on screen.
+	float coverage;
+	// Range of the objects of the cluster in SceneClusters::order.
+	uint32_t first;
+	uint32_t count;
+	uint32_t _padding[2];
+};
+// Uploaded as is to a std430 storage buffer.
+static_assert(sizeof(SceneCluster) == 48);
+
+struct SceneClusters {
+	// Indices of the objects of the scene, grouped by cluster.
+	std::vector<uint32_t> order;
+	std::vector<SceneCluster> clusters;
+
+	// Objects of each cluster lie in a cube of cell_size. With cell_size 0, it
+	// is picked so that there are about TARGET_CLUSTER_SIZE objects per cell on
+	// average.
+	static SceneClusters build(const SceneColumns &scene, float cell_size = 0);
+
+	static constexpr int TARGET_CLUSTER_SIZE = 64;
+};
+
+// Random numbers for generating scenes. The standard distributions are not
+// portable, so this keeps generated scenes the same across standard libraries.
+class SceneRandom {
+	std::mt19937_64 rng;
+
+public:
+	explicit SceneRandom(uint64_t seed)
+			: rng(seed) { }
+
+	// Uniform in [min, max).
+	float uniform(float min, float max) {
+		const float t = (float)(rng() >> 40) * 0x1.0p-24f;
+		return min + t * (max - min);
+	}
+};
+
+// The scene used when no scene file is given: the coordinate axes marked with
+// cubes, plus random ones around.
+SceneBuffer default_scene();
+
+// Header at the start of a scene file. All integers are little endian. The
+// columns follow as tightly packed arrays of floats, each starting at an offset
+// that is a multiple of SceneFile::ALIGNMENT.
+struct SceneFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t object_count;
+	// Seed of the generator that wrote the file, for reference.
+	uint64_t seed;
+	// Offsets of the columns from the start of the file, in bytes.
+	uint64_t positions_offset;
+	uint64_t scales_offset;
+	uint64_t colors_offset;
+	uint64_t phases_offset;
+	// Since version 2. Version 1 headers end before these, and have no lights.
+	uint64_t light_count;
+	uint64_t lights_offset;
+};
+
+// Scene file mapped into memory. The columns point straight into the mapping,
+// so they are only valid while the file is.
+class SceneFile {
+	void *data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+#endif
+	SceneColumns _columns;
+
+public:
+	static constexpr char MAGIC[8] = {'S', 'P', 'J', 'S', 'C', 'E', 'N', 'E'};
+	static constexpr uint32_t VERSION = 2;
+	static constexpr size_t ALIGNMENT = 64;
+
+	// Maps the file and validates the header. Throws std::runtime_error if it is
+	// not a valid scene file of a supported version. Reads all versions up to
+	// VERSION.
+	SceneFile(const string &path);
+	SceneFile(const SceneFile &) = delete;
+	~SceneFile();
+
+	const SceneFileHeader &header() const { return *static_cast<const SceneFileHeader *>(data); }
+
+	const SceneColumns &columns() const { return _columns; }
+
+	static void write(const string &path, const SceneColumns &columns, uint64_t seed);
+
+private:
+	void unmap();
+};
@@ -0,0 +1,160 @@
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+#include <absl/flags/usage.h>
+#include <chrono>
+#include <iostream>
+
+#include <universe/scene.h>
+#include <universe/volume.h>
+
+using std::cout, std::endl;
+
+ABSL_FLAG(string, out, "scene.bin", "Path of the scene file to write");
+ABSL_FLAG(uint64_t, count, 1'000'000, "Number of objects");
+ABSL_FLAG(uint64_t, seed, 1, "Seed of the random generator. The same seed and flags always give the same file.");
+ABSL_FLAG(float, radius, 1000.0f, "Radius of the ball the objects are scattered in");
+ABSL_FLAG(float, min_scale, 0.2f, "Minimum object scale");
+ABSL_FLAG(float, max_scale, 4.0f, "Maximum object scale");
+ABSL_FLAG(uint64_t, lights, 0, "Number of point lights, scattered like the objects. Scenes with increasing counts benchmark the lighting.");
+ABSL_FLAG(float, light_radius, 50.0f, "Distance at which the lights fade out");
+ABSL_FLAG(string, volume_out, "", "Path of a volume file of nebulae to write too, spanning the ball of the objects. None if empty.");
+ABSL_FLAG(int, volume_bricks, 8, "Size of the volume in bricks along each axis");
+ABSL_FLAG(int, volume_brick_size, 16, "Edge length of the volume bricks in voxels");
+
+static uint64_t splitmix64(uint64_t x) {
+	x += 0x9E3779B97F4A7C15;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+	return x ^ (x >> 31);
+}
+
+// Value noise: random values in [0, 1) at the integer lattice points, smoothly
+// interpolated in between.
+static float value_noise(uint64_t seed, const glm::vec3 &p) {
+	const glm::vec3 cell = glm::floor(p);
+	const glm::vec3 f = p - cell;
+	const glm::vec3 t = f * f * (glm::vec3(3.0f) - 2.0f * f);
+	auto lattice = [&](int dx, int dy, int dz) {
+		const uint64_t x = (int64_t)cell.x + dx, y = (int64_t)cell.y + dy, z = (int64_t)cell.z + dz;
+		return (float)(splitmix64(seed ^ splitmix64(x ^ splitmix64(y ^ splitmix64(z)))) >> 40) * 0x1.0p-24f;
+	};
+	auto lerp = [](float a, float b, float t) { return a + t * (b - a); };
+	return lerp(
+			lerp(lerp(lattice(0, 0, 0), lattice(1, 0, 0), t.x), lerp(lattice(0, 1, 0), lattice(1, 1, 0), t.x), t.y),
+			lerp(lerp(lattice(0, 0, 1), lattice(1, 0, 1), t.x), lerp(lattice(0, 1, 1), lattice(1, 1, 1), t.x), t.y),
+			t.z);
+}
+
+// Fractal noise in [0, 1), octaves of value noise of doubling frequency and
+// halving amplitude.
+static float fractal_noise(uint64_t seed, glm::vec3 p) {
+	float sum = 0, amplitude = 0.5f;
+	for (int octave = 0; octave < 4; ++octave) {
+		sum += amplitude * value_noise(seed + octave, p);
+		p *= 2.0f;
+		amplitude *= 0.5f;
+	}
+	return sum / (1 - amplitude * 2);
+}
+
+// Writes a volume of wispy clouds of gas filling the ball of the given radius,
+// reddish in places and bluish in others.
+static void write_nebulae(const string &path, uint64_t seed, float radius, int bricks, int brick_size) {
+	VolumeFileHeader header = {};
+	header.grid_size = glm::ivec3(bricks);
+	header.brick_size = brick_size;
+	header.origin = glm::vec3(-radius);
+	header.voxel_size = 2 * radius / (bricks * brick_size);
+	const float feature_size = radius / 4;
+	const glm::vec3 colors[2] = {{1.0f, 0.35f, 0.4f}, {0.3f, 0.55f, 1.0f}};
+	VolumeFile::write(path, header, [&](const glm::ivec3 &coords, std::byte *voxels) {
+		bool is_empty = true;
+		const int size = brick_size + 2;
+		for (int z = 0; z < size; ++z) {
+			for (int y = 0; y < size; ++y) {
+				for (int x = 0; x < size; ++x) {
+					// The apron overlaps the neighbors by a voxel.
+					const glm::vec3 voxel = glm::vec3(coords * brick_size + glm::ivec3(x, y, z) - 1) + 0.5f;
+					const glm::vec3 p = header.origin + voxel * header.voxel_size;
+					const float falloff = std::max(0.0f, 1 - glm::length(p) / radius);
+					const float density = std::clamp((fractal_noise(seed, p / feature_size) - 0.55f) * 4, 0.0f, 1.0f) * falloff;
+					std::byte *v = voxels + 4 * ((z * size + y) * size + x);
+					const uint8_t alpha = (uint8_t)std::round(255 * density);
+					if (alpha == 0) {
+						v[0] = v[1] = v[2] = v[3] = std::byte(0);
+						continue;
+					}
+					is_empty = false;
+					const float t = fractal_noise(seed + 100, p / feature_size);
+					const glm::vec3 color = glm::mix(colors[0], colors[1], std::clamp((t - 0.3f) * 2.5f, 0.0f, 1.0f));
+					v[0] = std::byte(std::round(255 * color.x));
+					v[1] = std::byte(std::round(255 * color.y));
+					v[2] = std::byte(std::round(255 * color.z));
+					v[3] = std::byte(alpha);
+				}
+			}
+		}
+		return !is_empty;
+	});
+}
+
+int main(int argc, char **argv) {
+	try {
+		absl::SetProgramUsageMessage("Generates a random scene file for universe_server");
+		absl::ParseCommandLine(argc, argv);
+		const uint64_t count = absl::GetFlag(FLAGS_count);
+		const uint64_t seed = absl::GetFlag(FLAGS_seed);
+		const float radius = absl::GetFlag(FLAGS_radius);
+		const float min_scale = absl::GetFlag(FLAGS_min_scale);
+		const float max_scale = absl::GetFlag(FLAGS_max_scale);
+		const uint64_t light_count = absl::GetFlag(FLAGS_lights);
+		const float light_radius = absl::GetFlag(FLAGS_light_radius);
+
+		const auto start_time = std::chrono::steady_clock::now();
+		SceneRandom rng(seed);
+		SceneBuffer scene;
+		scene.positions.reserve(count);
+		scene.scales.reserve(count);
+		scene.colors.reserve(count);
+		scene.phases.reserve(count);
+		// Rejection sampling keeps the density uniform within the ball.
+		auto point_in_ball = [&rng] {
+			glm::vec3 p;
+			do {
+				p = {rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1)};
+			} while (glm::dot(p, p) > 1);
+			return p;
+		};
+		for (uint64_t i = 0; i < count; ++i) {
+			const glm::vec3 p = point_in_ball();
+			const float scale = rng.uniform(min_scale, max_scale);
+			const float r = rng.uniform(0, 1);
+			const float g = rng.uniform(0, 1);
+			const float b = rng.uniform(0, 1);
+			const float phase = rng.uniform(-10, 10);
+			scene.push(radius * p, scale, {r, g, b}, phase);
+		}
+		for (uint64_t i = 0; i < light_count; ++i) {
+			const glm::vec3 p = point_in_ball();
+			const glm::vec3 color = {rng.uniform(0.2f, 1), rng.uniform(0.2f, 1), rng.uniform(0.2f, 1)};
+			scene.push_light(radius * p, light_radius, color);
+		}
+
+		const string out = absl::GetFlag(FLAGS_out);
+		SceneFile::write(out, scene.columns(), seed);
+		const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+		cout << "Wrote " << count << " objects and " << light_count << " lights to " << out << " in " << elapsed.count() << " ms" << endl;
+
+		if (const string volume_out = absl::GetFlag(FLAGS_volume_out); !volume_out.empty()) {
+			const auto volume_start_time = std::chrono::steady_clock::now();
+			write_nebulae(volume_out, seed, radius, absl::GetFlag(FLAGS_volume_bricks), absl::GetFlag(FLAGS_volume_brick_size));
+			const auto volume_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - volume_start_time);
+			cout << "Wrote volume to " << volume_out << " in " << volume_elapsed.count() << " ms" << endl;
+		}
+	} catch (std::exception &e) {
+		cout << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -7,8 +7,10 @@ struct Shaders : public gl::Shaders {
 	typedef ShaderSources Src;
 
 	struct BasicProgram : gl::Program {
-		in_vec4 position = {"position"};
-		in_vec4 color = {"color"};
+		typedef Src::basic_v_interface V;
+
+		static constexpr in_vec4 position = V::position;
+		static constexpr in_vec4 color = V::color;
 
 		BasicProgram()
 				: Program("BasicProgram", Src::basic_v, Src::basic_f) { }
@@ -16,22 +18,182 @@ struct Shaders : public gl::Shaders {
 	const BasicProgram basic_program;
 
 	struct SolidProgram : gl::Program {
-		uniform_mat4 Projection = {"Projection"};
-		uniform_mat4 Model = {"Model"};
-		uniform_mat3 Normal_model = {"_Normal_model"};
-		uniform_vec4 color = {"color"};
+		typedef Src::solid_v_interface V;
+		typedef Src::solid_f_interface F;
+
+		static constexpr uniform_mat4 Projection = V::Projection;
+
+		static constexpr uniform_vec3 ambient_color = F::ambient_color;
+		static constexpr uniform_vec2 viewport_size = F::viewport_size;
+		static constexpr uniform_float near = F::near;
+		static constexpr uniform_float far = F::far;
 
-		uniform_vec3 ambient_color = {"ambient_color"};
-		uniform_vec3 light0_position = {"light0_position"};
-		uniform_vec3 light0_color = {"light0_color"};
-		uniform_vec3 light1_position = {"light1_position"};
-		uniform_vec3 light1_color = {"light1_color"};
+		static constexpr gl::StorageBlock Lights = F::Lights;
+		static constexpr gl::StorageBlock ClusterLightCounts = F::ClusterLightCounts;
+		static constexpr gl::StorageBlock ClusterLights = F::ClusterLights;
 
-		in_vec3 position = {"position"};
-		in_vec3 normal = {"normal"};
+		static constexpr in_vec3 position = V::position;
+		static constexpr in_vec3 normal = V::normal;
+		static constexpr in_vec3 instance_position = V::instance_position;
+		static constexpr in_float instance_scale = V::instance_scale;
+		static constexpr in_vec3 instance_color = V::instance_color;
+		static constexpr in_float instance_phase = V::instance_phase;
 
 		SolidProgram()
 				: Program("SolidProgram", Src::solid_v, Src::solid_f) { }
 	};
 	const SolidProgram solid_program;
+
+	struct PointProgram : gl::Program {
+		typedef Src::point_v_interface V;
+
+		static constexpr uniform_mat4 Projection = V::Projection;
+		static constexpr uniform_vec3 eye = V::eye;
+		static constexpr uniform_float pixels_per_unit = V::pixels_per_unit;
+
+		static constexpr uniform_vec3 ambient_color = V::ambient_color;
+		static constexpr uniform_vec2 viewport_size = V::viewport_size;
+		static constexpr uniform_float near = V::near;
+		static constexpr uniform_float far = V::far;
+
+		static constexpr gl::StorageBlock Lights = V::Lights;
+		static constexpr gl::StorageBlock ClusterLightCounts = V::ClusterLightCounts;
+		static constexpr gl::StorageBlock ClusterLights = V::ClusterLights;
+
+		static constexpr in_vec3 position = V::position;
+		static constexpr in_float radius = V::radius;
+		static constexpr in_vec3 color = V::color;
+
+		PointProgram()
+				: Program("PointProgram", Src::point_v, Src::point_f) { }
+	};
+	const PointProgram point_program;
+
+	struct LodProgram : gl::Program {
+		typedef Src::lod_c_interface C;
+
+		// Must match local_size_x.
+		static constexpr GLuint WORKGROUP_SIZE = 64;
+
+		static constexpr uniform_vec3 eye = C::eye;
+		static constexpr uniform_float pixels_per_unit = C::pixels_per_unit;
+		static constexpr uniform_float mesh_min_pixels = C::mesh_min_pixels;
+		static constexpr uniform_float point_min_pixels = C::point_min_pixels;
+		static constexpr uniform_uint cluster_count = C::cluster_count;
+
+		static constexpr gl::StorageBlock Clusters = C::Clusters;
+		static constexpr gl::StorageBlock Order = C::Order;
+		static constexpr gl::StorageBlock Positions = C::Positions;
+		static constexpr gl::StorageBlock Scales = C::Scales;
+		static constexpr gl::StorageBlock Colors = C::Colors;
+		static constexpr gl::StorageBlock Phases = C::Phases;
+		static constexpr gl::StorageBlock Commands = C::Commands;
+		static constexpr gl::StorageBlock Meshes = C::Meshes;
+		static constexpr gl::StorageBlock Points = C::Points;
+		static constexpr gl::StorageBlock MeshObjects = C::MeshObjects;
+
+		LodProgram()
+				: Program("LodProgram", Src::lod_c) { }
+	};
+	const LodProgram lod_program;
+
+	struct HizProgram : gl::Program {
+		typedef Src::hiz_c_interface C;
+
+		// Must match local_size_x and local_size_y.
+		static constexpr GLuint WORKGROUP_SIZE = 8;
+
+		static constexpr uniform_sampler2D src = C::src;
+		static constexpr uniform_int src_level = C::src_level;
+		static constexpr uniform_image2D dst = C::dst;
+
+		HizProgram()
+				: Program("HizProgram", Src::hiz_c) { }
+	};
+	const HizProgram hiz_program;
+
+	struct ProjectProgram : gl::Program {
+		typedef Src::project_c_interface C;
+
+		// Must match local_size_x and local_size_y.
+		static constexpr GLuint WORKGROUP_SIZE = 8;
+
+		static constexpr uniform_samplerCube skybox = C::skybox;
+		static constexpr uniform_int projection = C::projection;
+		static constexpr uniform_float lod = C::lod;
+		static constexpr uniform_image2D dst = C::dst;
+
+		ProjectProgram()
+				: Program("ProjectProgram", Src::project_c) { }
+	};
+	const ProjectProgram project_program;
+
+	struct VolumeProgram : gl::Program {
+		typedef Src::volume_f_interface F;
+
+		static constexpr uniform_mat4 InverseViewProjection = F::InverseViewProjection;
+		static constexpr uniform_vec3 eye = F::eye;
+		static constexpr uniform_vec3 origin = F::origin;
+		static constexpr uniform_float voxel_size = F::voxel_size;
+		static constexpr uniform_ivec3 grid_size = F::grid_size;
+		static constexpr uniform_int brick_size = F::brick_size;
+		static constexpr uniform_vec3 atlas_size = F::atlas_size;
+		static constexpr uniform_float density_scale = F::density_scale;
+		static constexpr uniform_int max_steps = F::max_steps;
+		static constexpr uniform_sampler3D atlas = F::atlas;
+		static constexpr uniform_usampler3D indirection = F::indirection;
+		static constexpr uniform_sampler2D depth = F::depth;
+
+		VolumeProgram()
+				: Program("VolumeProgram", Src::volume_v, Src::volume_f) { }
+	};
+	const VolumeProgram volume_program;
+
+	struct CullProgram : gl::Program {
+		typedef Src::cull_c_interface C;
+
+		// Must match local_size_x.
+		static constexpr GLuint WORKGROUP_SIZE = 64;
+
+		static constexpr uniform_mat4 ViewProjection = C::ViewProjection;
+		static constexpr uniform_uint face = C::face;
+		static constexpr uniform_uint phase = C::phase;
+		static constexpr uniform_sampler2D hiz = C::hiz;
+		static constexpr uniform_int hiz_levels = C::hiz_levels;
+		static constexpr uniform_vec2 hiz_size = C::hiz_size;
+
+		static constexpr gl::StorageBlock LodCommand = C::LodCommand;
+		static constexpr gl::StorageBlock Meshes = C::Meshes;
+		static constexpr gl::StorageBlock MeshObjects = C::MeshObjects;
+		static constexpr gl::StorageBlock Visibility = C::Visibility;
+		static constexpr gl::StorageBlock Commands = C::Commands;
+		static constexpr gl::StorageBlock CulledMeshes = C::CulledMeshes;
+
+		CullProgram()
+				: Program("CullProgram", Src::cull_c) { }
+	};
+	const CullProgram cull_program;
+
+	struct LightsProgram : gl::Program {
+		typedef Src::lights_c_interface C;
+
+		// Must match local_size_x, CLUSTER_GRID and MAX_CLUSTER_LIGHTS.
+		static constexpr GLuint WORKGROUP_SIZE = 64;
+		static constexpr GLuint CLUSTER_COUNT = 16 * 16 * 24;
+		static constexpr GLuint MAX_CLUSTER_LIGHTS = 128;
+
+		static constexpr uniform_mat4 View = C::View;
+		static constexpr uniform_vec2 tan_half_fov = C::tan_half_fov;
+		static constexpr uniform_float near = C::near;
+		static constexpr uniform_float far = C::far;
+		static constexpr uniform_uint light_count = C::light_count;
+
+		static constexpr gl::StorageBlock Lights = C::Lights;
+		static constexpr gl::StorageBlock ClusterLightCounts = C::ClusterLightCounts;
+		static constexpr gl::StorageBlock ClusterLights = C::ClusterLights;
+
+		LightsProgram()
+				: Program("LightsProgram", Src::lights_c) { }
+	};
+	const LightsProgram lights_program;
 };
\ No newline at end of file
@@ -1,7 +1,7 @@
 #version 460
 
-in vec4 position;
-in vec4 color;
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec4 color;
 out vec4 frag_color;
 
 void main()
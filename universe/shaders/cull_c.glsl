@@ -0,0 +1,142 @@
+#version 460
+
+// Two-phase occlusion culling of the meshes selected by the level of detail
+// pass, for one face of a skybox.
+//
+// The early phase picks the meshes that were visible in the last pass of the
+// same face, which are drawn first. The late phase tests every mesh in the
+// frustum against the hierarchical depth buffer of what the early phase drew,
+// picks the newly visible ones and updates the visibility for the next pass.
+
+layout(local_size_x = 64) in;
+
+layout(location = 0) uniform mat4 ViewProjection;
+layout(location = 1) uniform uint face;
+// 0 for the early phase, 1 for the late one.
+layout(location = 2) uniform uint phase;
+layout(location = 3) uniform sampler2D hiz;
+layout(location = 4) uniform int hiz_levels;
+// Size of level 0 of the hierarchical depth buffer.
+layout(location = 5) uniform vec2 hiz_size;
+
+// The draw command of the level of detail pass, whose instance count is the
+// number of meshes.
+layout(std430, binding = 0) readonly buffer LodCommand { uint lod_command[4]; };
+// Mesh instances as written by lod_c.glsl, copied as they are.
+const uint MESH_SIZE = 6;
+layout(std430, binding = 1) readonly buffer Meshes { uint meshes[]; };
+layout(std430, binding = 2) readonly buffer MeshObjects { uint mesh_objects[]; };
+// Bit per face of every object of the scene, set if it was visible in the last
+// pass of that face.
+layout(std430, binding = 3) buffer Visibility { uint visibility[]; };
+// DrawArraysIndirectCommand of each phase, and counters of the meshes culled by
+// the late phase.
+layout(std430, binding = 4) buffer Commands {
+  uint early_command[4];
+  uint late_command[4];
+  uint frustum_culled;
+  uint occlusion_culled;
+};
+// The meshes to draw. The late phase appends after the early one, and draws
+// from there through the base instance of its command.
+layout(std430, binding = 5) writeonly buffer CulledMeshes { uint culled_meshes[]; };
+
+const float SQRT_3 = 1.7320508;
+
+bool is_in_frustum(vec3 center, float radius) {
+  mat4 rows = transpose(ViewProjection);
+  vec4 planes[6] = vec4[6](
+    rows[3] + rows[0], rows[3] - rows[0],
+    rows[3] + rows[1], rows[3] - rows[1],
+    rows[3] + rows[2], rows[3] - rows[2]
+  );
+  for (int i = 0; i < 6; ++i) {
+    if (dot(planes[i].xyz, center) + planes[i].w < -radius * length(planes[i].xyz)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether the bounding box of the sphere is behind the farthest depth drawn in
+// the screen rectangle it covers.
+bool is_occluded(vec3 center, float radius) {
+  vec2 lo = vec2(1.0);
+  vec2 hi = vec2(0.0);
+  float nearest = 1.0;
+  for (int k = 0; k < 8; ++k) {
+    vec3 corner = center + radius * vec3(
+      (k & 1) != 0 ? 1.0 : -1.0,
+      (k & 2) != 0 ? 1.0 : -1.0,
+      (k & 4) != 0 ? 1.0 : -1.0
+    );
+    vec4 clip = ViewProjection * vec4(corner, 1.0);
+    if (clip.w <= 0.0) {
+      // Reaches behind the eye.
+      return false;
+    }
+    vec3 window = 0.5 * clip.xyz / clip.w + 0.5;
+    lo = min(lo, window.xy);
+    hi = max(hi, window.xy);
+    nearest = min(nearest, window.z);
+  }
+  lo = clamp(lo, 0.0, 1.0);
+  hi = clamp(hi, 0.0, 1.0);
+  // The level where the rectangle is at most a texel across, so that it is
+  // covered by the texels at its corners.
+  vec2 extent = (hi - lo) * hiz_size;
+  float level = clamp(ceil(log2(max(max(extent.x, extent.y), 1.0))), 0.0, float(hiz_levels - 1));
+  float farthest = max(
+    max(textureLod(hiz, lo, level).r, textureLod(hiz, vec2(hi.x, lo.y), level).r),
+    max(textureLod(hiz, vec2(lo.x, hi.y), level).r, textureLod(hiz, hi, level).r)
+  );
+  return nearest > farthest;
+}
+
+void append(uint m, bool is_late) {
+  uint i = is_late
+    ? early_command[1] + atomicAdd(late_command[1], 1u)
+    : atomicAdd(early_command[1], 1u);
+  for (uint k = 0; k < MESH_SIZE; ++k) {
+    culled_meshes[MESH_SIZE * i + k] = meshes[MESH_SIZE * m + k];
+  }
+}
+
+void main() {
+  uint m = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+  if (phase == 1 && m == 0) {
+    late_command[3] = early_command[1];
+  }
+  if (m >= lod_command[1]) {
+    return;
+  }
+  uint object = mesh_objects[m];
+  uint j = MESH_SIZE * m;
+  vec3 center = uintBitsToFloat(uvec3(meshes[j], meshes[j + 1], meshes[j + 2]));
+  float radius = SQRT_3 * uintBitsToFloat(meshes[j + 3]);
+  uint bit = 1u << face;
+  bool was_visible = (visibility[object] & bit) != 0;
+
+  if (phase == 0) {
+    if (was_visible && is_in_frustum(center, radius)) {
+      append(m, false);
+    }
+    return;
+  }
+
+  if (!is_in_frustum(center, radius)) {
+    visibility[object] &= ~bit;
+    atomicAdd(frustum_culled, 1u);
+  } else if (!is_occluded(center, radius)) {
+    visibility[object] |= bit;
+    if (!was_visible) {
+      append(m, true);
+    }
+  } else {
+    // Drawn anyway if the early phase already did.
+    visibility[object] &= ~bit;
+    if (!was_visible) {
+      atomicAdd(occlusion_culled, 1u);
+    }
+  }
+}
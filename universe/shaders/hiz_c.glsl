@@ -0,0 +1,31 @@
+#version 460
+
+// Builds one level of the hierarchical depth buffer from the level below, or
+// from the depth buffer itself. Every texel is the farthest depth of the
+// source texels it covers.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(location = 0) uniform sampler2D src;
+layout(location = 1) uniform int src_level;
+layout(r32f, location = 2) uniform writeonly image2D dst;
+
+void main() {
+  ivec2 dst_size = imageSize(dst);
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(p, dst_size))) {
+    return;
+  }
+  // When a source size is odd, a texel covers parts of three source texels
+  // along that axis.
+  ivec2 src_size = textureSize(src, src_level);
+  ivec2 lo = p * src_size / dst_size;
+  ivec2 hi = min(((p + 1) * src_size + dst_size - 1) / dst_size, src_size);
+  float farthest = 0.0;
+  for (int y = lo.y; y < hi.y; ++y) {
+    for (int x = lo.x; x < hi.x; ++x) {
+      farthest = max(farthest, texelFetch(src, ivec2(x, y), src_level).r);
+    }
+  }
+  imageStore(dst, p, vec4(farthest));
+}
@@ -0,0 +1,74 @@
+#version 460
+
+// Assigns the lights to the clusters of the view frustum of one pass. The
+// clusters are CLUSTER_GRID.x by CLUSTER_GRID.y screen tiles, each split into
+// CLUSTER_GRID.z slices, spaced exponentially in depth between the near and far
+// planes. One invocation per cluster, with the workgroup staging the lights
+// through shared memory.
+
+layout(local_size_x = 64) in;
+
+const uvec3 CLUSTER_GRID = uvec3(16, 16, 24);
+// Any further lights of a cluster are ignored.
+const uint MAX_CLUSTER_LIGHTS = 128;
+
+layout(location = 0) uniform mat4 View;
+// Tangent of half the field of view, horizontally and vertically.
+layout(location = 1) uniform vec2 tan_half_fov;
+layout(location = 2) uniform float near;
+layout(location = 3) uniform float far;
+layout(location = 4) uniform uint light_count;
+
+struct Light {
+  vec3 position;
+  float radius;
+  vec3 color;
+  float _padding;
+};
+
+layout(std430, binding = 0) readonly buffer Lights { Light lights[]; };
+layout(std430, binding = 1) writeonly buffer ClusterLightCounts { uint cluster_light_counts[]; };
+// MAX_CLUSTER_LIGHTS light indices per cluster.
+layout(std430, binding = 2) writeonly buffer ClusterLights { uint cluster_lights[]; };
+
+// View space position and radius.
+shared vec4 staged_lights[gl_WorkGroupSize.x];
+
+void main() {
+  uint c = gl_GlobalInvocationID.x;
+  uvec3 g = uvec3(
+    c % CLUSTER_GRID.x,
+    c / CLUSTER_GRID.x % CLUSTER_GRID.y,
+    c / (CLUSTER_GRID.x * CLUSTER_GRID.y)
+  );
+
+  // Bounding box of the cluster in view space, which looks down -z. At depth
+  // z, the tile spans its normalized device coordinates times
+  // z * tan_half_fov.
+  float z0 = near * pow(far / near, float(g.z) / float(CLUSTER_GRID.z));
+  float z1 = near * pow(far / near, float(g.z + 1) / float(CLUSTER_GRID.z));
+  vec2 a0 = (vec2(g.xy) / vec2(CLUSTER_GRID.xy) * 2.0 - 1.0) * tan_half_fov;
+  vec2 a1 = (vec2(g.xy + 1u) / vec2(CLUSTER_GRID.xy) * 2.0 - 1.0) * tan_half_fov;
+  vec3 lo = vec3(min(a0 * z0, a0 * z1), -z1);
+  vec3 hi = vec3(max(a1 * z0, a1 * z1), -z0);
+
+  uint count = 0;
+  for (uint base = 0; base < light_count; base += gl_WorkGroupSize.x) {
+    uint i = base + gl_LocalInvocationIndex;
+    if (i < light_count) {
+      staged_lights[gl_LocalInvocationIndex] = vec4((View * vec4(lights[i].position, 1.0)).xyz, lights[i].radius);
+    }
+    barrier();
+    uint n = min(gl_WorkGroupSize.x, light_count - base);
+    for (uint k = 0; k < n && count < MAX_CLUSTER_LIGHTS; ++k) {
+      vec4 light = staged_lights[k];
+      vec3 d = light.xyz - clamp(light.xyz, lo, hi);
+      if (dot(d, d) <= light.w * light.w) {
+        cluster_lights[c * MAX_CLUSTER_LIGHTS + count] = base + k;
+        ++count;
+      }
+    }
+    barrier();
+  }
+  cluster_light_counts[c] = count;
+}
@@ -0,0 +1,149 @@
+#version 460
+
+// Selects the level of detail of every object of the scene for one viewpoint,
+// one workgroup per cluster. Near objects are appended to the mesh instances,
+// far ones to the points. Objects smaller than a pixel are not drawn on their
+// own, but merged into a single point per cluster, as is the whole cluster
+// when it is smaller than a pixel.
+
+layout(local_size_x = 64) in;
+
+layout(location = 0) uniform vec3 eye;
+// On-screen size in pixels of a unit length at unit distance.
+layout(location = 1) uniform float pixels_per_unit;
+// Objects are drawn as points below this on-screen diameter in pixels.
+layout(location = 2) uniform float mesh_min_pixels;
+// And merged into the point of their cluster below this one.
+layout(location = 3) uniform float point_min_pixels;
+layout(location = 4) uniform uint cluster_count;
+
+struct Cluster {
+  vec3 center;
+  float radius;
+  vec3 color;
+  float coverage;
+  uint first;
+  uint count;
+};
+
+layout(std430, binding = 0) readonly buffer Clusters { Cluster clusters[]; };
+layout(std430, binding = 1) readonly buffer Order { uint order[]; };
+// The scene columns. The vec3 ones are tightly packed, which std430 arrays of
+// vec3 are not.
+layout(std430, binding = 2) readonly buffer Positions { float positions[]; };
+layout(std430, binding = 3) readonly buffer Scales { float scales[]; };
+layout(std430, binding = 4) readonly buffer Colors { float colors[]; };
+layout(std430, binding = 5) readonly buffer Phases { float phases[]; };
+// DrawArraysIndirectCommand for the meshes, where the instance count is the
+// number of appended meshes, and for the points, where the vertex count is the
+// number of appended points.
+layout(std430, binding = 6) buffer Commands {
+  uint mesh_command[4];
+  uint point_command[4];
+};
+// Position, scale, color and phase of each mesh instance, and position, radius
+// and color of each point, as LodMeshInstance and LodPoint. The color is packed
+// into 8-bit normalized components, the rest are float bits.
+const uint MESH_SIZE = 6;
+const uint POINT_SIZE = 5;
+layout(std430, binding = 7) writeonly buffer Meshes { uint meshes[]; };
+layout(std430, binding = 8) writeonly buffer Points { uint points[]; };
+// Index of the object of each mesh instance in the scene.
+layout(std430, binding = 9) writeonly buffer MeshObjects { uint mesh_objects[]; };
+
+const float SQRT_3 = 1.7320508;
+
+shared vec3 partial_position_sums[gl_WorkGroupSize.x];
+shared vec3 partial_color_sums[gl_WorkGroupSize.x];
+shared float partial_coverage_sums[gl_WorkGroupSize.x];
+
+vec3 load_position(uint i) {
+  return vec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+}
+
+vec3 load_color(uint i) {
+  return vec3(colors[3 * i], colors[3 * i + 1], colors[3 * i + 2]);
+}
+
+void append_point(vec3 position, float radius, vec3 color) {
+  uint j = POINT_SIZE * atomicAdd(point_command[0], 1u);
+  points[j] = floatBitsToUint(position.x);
+  points[j + 1] = floatBitsToUint(position.y);
+  points[j + 2] = floatBitsToUint(position.z);
+  points[j + 3] = floatBitsToUint(radius);
+  points[j + 4] = packUnorm4x8(vec4(color, 1.0));
+}
+
+void append_mesh(uint i, vec3 position, float scale) {
+  uint k = atomicAdd(mesh_command[1], 1u);
+  mesh_objects[k] = i;
+  uint j = MESH_SIZE * k;
+  meshes[j] = floatBitsToUint(position.x);
+  meshes[j + 1] = floatBitsToUint(position.y);
+  meshes[j + 2] = floatBitsToUint(position.z);
+  meshes[j + 3] = floatBitsToUint(scale);
+  meshes[j + 4] = packUnorm4x8(vec4(load_color(i), 1.0));
+  meshes[j + 5] = floatBitsToUint(phases[i]);
+}
+
+// On-screen diameter in pixels of a sphere, or huge if the eye is inside.
+float pixels(vec3 center, float radius) {
+  float d = distance(eye, center);
+  return d <= radius ? 1e30 : 2.0 * radius * pixels_per_unit / d;
+}
+
+void main() {
+  uint c = gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+  if (c >= cluster_count) {
+    return;
+  }
+  Cluster cluster = clusters[c];
+  uint lane = gl_LocalInvocationIndex;
+
+  if (pixels(cluster.center, cluster.radius) < point_min_pixels) {
+    if (lane == 0) {
+      // A point covering the same area as all the objects together.
+      append_point(cluster.center, sqrt(cluster.coverage), cluster.color);
+    }
+    return;
+  }
+
+  vec3 position_sum = vec3(0.0);
+  vec3 color_sum = vec3(0.0);
+  float coverage_sum = 0.0;
+  for (uint k = lane; k < cluster.count; k += gl_WorkGroupSize.x) {
+    uint i = order[cluster.first + k];
+    vec3 position = load_position(i);
+    float scale = scales[i];
+    float p = pixels(position, SQRT_3 * scale);
+    if (p >= mesh_min_pixels) {
+      append_mesh(i, position, scale);
+    } else if (p >= point_min_pixels) {
+      append_point(position, scale, load_color(i));
+    } else {
+      float coverage = scale * scale;
+      position_sum += coverage * position;
+      color_sum += coverage * load_color(i);
+      coverage_sum += coverage;
+    }
+  }
+
+  // The sub-pixel objects of the cluster become a single point at their
+  // centroid, weighted by coverage like the cluster itself.
+  partial_position_sums[lane] = position_sum;
+  partial_color_sums[lane] = color_sum;
+  partial_coverage_sums[lane] = coverage_sum;
+  barrier();
+  for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride /= 2) {
+    if (lane < stride) {
+      partial_position_sums[lane] += partial_position_sums[lane + stride];
+      partial_color_sums[lane] += partial_color_sums[lane + stride];
+      partial_coverage_sums[lane] += partial_coverage_sums[lane + stride];
+    }
+    barrier();
+  }
+  if (lane == 0 && partial_coverage_sums[0] > 0.0) {
+    float coverage = partial_coverage_sums[0];
+    append_point(partial_position_sums[0] / coverage, sqrt(coverage), partial_color_sums[0] / coverage);
+  }
+}
@@ -0,0 +1,11 @@
+#version 460
+
+precision highp float;
+
+flat in vec3 point_color;
+
+out lowp vec4 frag_color;
+
+void main() {
+  frag_color = vec4(point_color, 1.0);
+}
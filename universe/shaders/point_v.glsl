@@ -0,0 +1,72 @@
+#version 460
+
+// Far objects and clusters of objects, drawn as screen-aligned squares as large
+// as they would appear on screen, but at least a pixel.
+
+// Same as in lights_c.glsl.
+const uvec3 CLUSTER_GRID = uvec3(16, 16, 24);
+const uint MAX_CLUSTER_LIGHTS = 128;
+
+layout(location = 0) uniform mat4 Projection;
+layout(location = 1) uniform vec3 eye;
+// On-screen size in pixels of a unit length at unit distance.
+layout(location = 2) uniform float pixels_per_unit;
+
+// Same lighting as the solid program.
+layout(location = 4) uniform vec3 ambient_color;
+layout(location = 5) uniform vec2 viewport_size;
+layout(location = 6) uniform float near;
+layout(location = 7) uniform float far;
+
+struct Light {
+  vec3 position;
+  float radius;
+  vec3 color;
+  float _padding;
+};
+
+layout(std430, binding = 0) readonly buffer Lights { Light lights[]; };
+layout(std430, binding = 1) readonly buffer ClusterLightCounts { uint cluster_light_counts[]; };
+layout(std430, binding = 2) readonly buffer ClusterLights { uint cluster_lights[]; };
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in float radius;
+layout(location = 2) in vec3 color;
+
+flat out vec3 point_color;
+
+uint cluster_index(vec4 clip) {
+  vec2 window = clamp(0.5 * clip.xy / clip.w + 0.5, 0.0, 1.0);
+  // The depth in view space, for a perspective projection.
+  float depth = clip.w;
+  uvec2 tile = min(uvec2(window * vec2(CLUSTER_GRID.xy)), CLUSTER_GRID.xy - 1u);
+  uint slice = uint(clamp(log(depth / near) / log(far / near) * float(CLUSTER_GRID.z), 0.0, float(CLUSTER_GRID.z - 1u)));
+  return tile.x + CLUSTER_GRID.x * (tile.y + CLUSTER_GRID.y * slice);
+}
+
+// Lighting of a surface facing the eye, which is all a point has to go by.
+vec3 compute_light(Light light, vec3 n) {
+  vec3 light_r = light.position - position;
+  float d = length(light_r);
+  float fade = clamp(1.0 - pow(d / light.radius, 4.0), 0.0, 1.0);
+  float diffuse = 15.0 * max(dot(n, light_r / d), 0.0) * fade * fade / (d * d);
+  return light.color * diffuse;
+}
+
+void main()
+{
+  gl_Position = Projection * vec4(position, 1.0);
+  vec3 to_eye = eye - position;
+  float d = length(to_eye);
+  vec3 n = to_eye / d;
+  vec3 light = ambient_color;
+  if (gl_Position.w > 0.0) {
+    uint c = cluster_index(gl_Position);
+    uint count = cluster_light_counts[c];
+    for (uint k = 0; k < count; ++k) {
+      light += compute_light(lights[cluster_lights[c * MAX_CLUSTER_LIGHTS + k]], n);
+    }
+  }
+  point_color = color * light;
+  gl_PointSize = max(1.0, 2.0 * radius * pixels_per_unit / d);
+}
@@ -0,0 +1,48 @@
+#version 460
+
+// Resamples the skybox cube map into a single image in one of the projections
+// of SkyboxProjection.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+const int EQUIRECTANGULAR = 1;
+const int OCTAHEDRAL = 2;
+const float PI = 3.14159265358979;
+
+layout(location = 0) uniform samplerCube skybox;
+layout(location = 1) uniform int projection;
+// Mip level of the cube map with texels about the size of the output pixels.
+layout(location = 2) uniform float lod;
+layout(rgba8, location = 3) uniform writeonly image2D dst;
+
+vec3 equirectangular_direction(vec2 uv) {
+  float longitude = (2.0 * uv.x - 1.0) * PI;
+  float latitude = (0.5 - uv.y) * PI;
+  return vec3(cos(latitude) * sin(longitude), sin(latitude), -cos(latitude) * cos(longitude));
+}
+
+vec3 octahedral_direction(vec2 uv) {
+  vec2 p = 2.0 * uv - 1.0;
+  vec3 d = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+  if (d.y < 0.0) {
+    // The lower hemisphere is folded out into the corners.
+    d.xz = (1.0 - abs(d.zx)) * vec2(d.x >= 0.0 ? 1.0 : -1.0, d.z >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(d);
+}
+
+void main() {
+  ivec2 size = imageSize(dst);
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(p, size))) {
+    return;
+  }
+  vec2 uv = (vec2(p) + 0.5) / vec2(size);
+  vec3 d = projection == OCTAHEDRAL ? octahedral_direction(uv) : equirectangular_direction(uv);
+  // The faces are rendered turned by 180 degrees against the cube map
+  // convention (see LOOKATS), so the components other than the major axis are
+  // flipped to land on the right texel.
+  vec3 a = abs(d);
+  vec3 major = a.x >= a.y && a.x >= a.z ? vec3(1.0, 0.0, 0.0) : a.y >= a.z ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+  imageStore(dst, p, textureLod(skybox, d * (2.0 * major - 1.0), lod));
+}
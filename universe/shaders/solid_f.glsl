@@ -2,34 +2,56 @@
 
 precision highp float;
 
-uniform vec4 color;
+// Same as in lights_c.glsl.
+const uvec3 CLUSTER_GRID = uvec3(16, 16, 24);
+const uint MAX_CLUSTER_LIGHTS = 128;
 
-uniform vec3 ambient_color;
-uniform vec3 light0_position;
-uniform vec3 light0_color;
-uniform vec3 light1_position;
-uniform vec3 light1_color;
+layout(location = 4) uniform vec3 ambient_color;
+layout(location = 5) uniform vec2 viewport_size;
+layout(location = 6) uniform float near;
+layout(location = 7) uniform float far;
+
+struct Light {
+  vec3 position;
+  float radius;
+  vec3 color;
+  float _padding;
+};
+
+// As assigned to the clusters by lights_c.glsl.
+layout(std430, binding = 0) readonly buffer Lights { Light lights[]; };
+layout(std430, binding = 1) readonly buffer ClusterLightCounts { uint cluster_light_counts[]; };
+layout(std430, binding = 2) readonly buffer ClusterLights { uint cluster_lights[]; };
 
 in vec3 frag_position;
 in vec3 frag_normal;
+flat in vec3 frag_albedo;
 
 out lowp vec4 frag_color;
 
-vec3 compute_light(vec3 light_position, vec3 light_color, vec3 n) {
-  vec3 light_r = light_position - frag_position;
+uint cluster_index() {
+  float z_ndc = 2.0 * gl_FragCoord.z - 1.0;
+  float depth = 2.0 * near * far / (far + near - z_ndc * (far - near));
+  uvec2 tile = min(uvec2(gl_FragCoord.xy / viewport_size * vec2(CLUSTER_GRID.xy)), CLUSTER_GRID.xy - 1u);
+  uint slice = uint(clamp(log(depth / near) / log(far / near) * float(CLUSTER_GRID.z), 0.0, float(CLUSTER_GRID.z - 1u)));
+  return tile.x + CLUSTER_GRID.x * (tile.y + CLUSTER_GRID.y * slice);
+}
+
+vec3 compute_light(Light light, vec3 n) {
+  vec3 light_r = light.position - frag_position;
   float d = length(light_r);
-  float diffuse = 15.0 * max(dot(frag_normal, light_r / d), 0.0) / (d * d);
-  return light_color * diffuse;
+  float fade = clamp(1.0 - pow(d / light.radius, 4.0), 0.0, 1.0);
+  float diffuse = 15.0 * max(dot(n, light_r / d), 0.0) * fade * fade / (d * d);
+  return light.color * diffuse;
 }
 
 void main() {
   vec3 n = normalize(frag_normal);
-  frag_color = vec4(
-    color.rgb * (
-      ambient_color +
-      compute_light(light0_position, light0_color, n) +
-      compute_light(light1_position, light1_color, n)
-    ),
-    color.w
-  );
+  uint c = cluster_index();
+  uint count = cluster_light_counts[c];
+  vec3 light = ambient_color;
+  for (uint k = 0; k < count; ++k) {
+    light += compute_light(lights[cluster_lights[c * MAX_CLUSTER_LIGHTS + k]], n);
+  }
+  frag_color = vec4(frag_albedo * light, 1.0);
 }
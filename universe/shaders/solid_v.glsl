@@ -1,18 +1,35 @@
 #version 460
 
-uniform mat4 Projection;
-uniform mat4 Model;
-uniform mat3 _Normal_model;
-in vec3 position;
-in vec3 normal;
+layout(location = 0) uniform mat4 Projection;
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+
+// Per instance.
+layout(location = 2) in vec3 instance_position;
+layout(location = 3) in float instance_scale;
+layout(location = 4) in vec3 instance_color;
+layout(location = 5) in float instance_phase;
 
 out vec3 frag_position;
 out vec3 frag_normal;
+flat out vec3 frag_albedo;
+
+// Same as glm::eulerAngleYXZ(yaw, pitch, 0).
+mat3 euler_angle_yx(float yaw, float pitch) {
+  float cy = cos(yaw), sy = sin(yaw);
+  float cp = cos(pitch), sp = sin(pitch);
+  mat3 Y = mat3(cy, 0.0, -sy, 0.0, 1.0, 0.0, sy, 0.0, cy);
+  mat3 X = mat3(1.0, 0.0, 0.0, 0.0, cp, sp, 0.0, -sp, cp);
+  return Y * X;
+}
 
 void main()
 {
-  vec4 model_position = Model * vec4(position, 1.0);
-  frag_normal = _Normal_model * normal;
-  frag_position = model_position.xyz;
-  gl_Position = Projection * model_position;
+  mat3 rotation = euler_angle_yx(2.0 * instance_phase, 3.0 * instance_phase);
+  vec3 model_position = instance_position + instance_scale * (rotation * position);
+  // The scale is uniform, so the rotation alone transforms the normals.
+  frag_normal = rotation * normal;
+  frag_position = model_position;
+  frag_albedo = instance_color;
+  gl_Position = Projection * vec4(model_position, 1.0);
 }
@@ -0,0 +1,74 @@
+#version 460
+
+precision highp float;
+
+// Emission-absorption raymarch through the bricked volume, up to the depth of
+// the scene drawn before. The indirection texture has a texel per brick of the
+// volume, holding the atlas slot of the brick and whether it is resident. Each
+// slot of the atlas has a brick with an apron of one voxel on every side, so
+// that filtering never reads from the neighboring slots.
+
+layout(location = 0) uniform mat4 InverseViewProjection;
+layout(location = 1) uniform vec3 eye;
+layout(location = 2) uniform vec3 origin;
+layout(location = 3) uniform float voxel_size;
+layout(location = 4) uniform ivec3 grid_size;
+layout(location = 5) uniform int brick_size;
+layout(location = 6) uniform vec3 atlas_size;
+layout(location = 7) uniform float density_scale;
+layout(location = 8) uniform int max_steps;
+layout(location = 9) uniform sampler3D atlas;
+layout(location = 10) uniform usampler3D indirection;
+layout(location = 11) uniform sampler2D depth;
+
+in vec2 ndc;
+
+out lowp vec4 frag_color;
+
+vec3 unproject(float ndc_z) {
+  vec4 p = InverseViewProjection * vec4(ndc, ndc_z, 1.0);
+  return p.xyz / p.w;
+}
+
+void main() {
+  vec3 dir = normalize(unproject(1.0) - eye);
+  float scene_depth = texelFetch(depth, ivec2(gl_FragCoord.xy), 0).r;
+  float scene_distance = scene_depth < 1.0 ? distance(eye, unproject(scene_depth * 2.0 - 1.0)) : 1e30;
+
+  // Clip the ray to the box of the volume. From here on, distances are in
+  // voxels.
+  vec3 ray_origin = (eye - origin) / voxel_size;
+  vec3 inv_dir = 1.0 / (dir + vec3(equal(dir, vec3(0.0))) * 1e-8);
+  vec3 t0 = -ray_origin * inv_dir;
+  vec3 t1 = (vec3(grid_size * brick_size) - ray_origin) * inv_dir;
+  vec3 t_min = min(t0, t1);
+  vec3 t_max = max(t0, t1);
+  float t_enter = max(max(max(t_min.x, t_min.y), t_min.z), 0.0);
+  float t_exit = min(min(min(t_max.x, t_max.y), t_max.z), scene_distance / voxel_size);
+  if (t_enter >= t_exit) {
+    discard;
+  }
+
+  // A step per voxel, unless that takes more than max_steps.
+  float step = max(1.0, (t_exit - t_enter) / float(max_steps));
+  float step_extinction = density_scale * step * voxel_size;
+  vec3 color = vec3(0.0);
+  float transmittance = 1.0;
+  for (float t = t_enter + 0.5 * step; t < t_exit && transmittance > 0.01; t += step) {
+    vec3 v = ray_origin + t * dir;
+    ivec3 brick = clamp(ivec3(floor(v / float(brick_size))), ivec3(0), grid_size - 1);
+    uvec4 entry = texelFetch(indirection, brick, 0);
+    if (entry.a == 0u) {
+      // Empty, or not streamed in yet.
+      continue;
+    }
+    vec3 texel = vec3(entry.xyz) * float(brick_size + 2) + 1.0 + (v - vec3(brick * brick_size));
+    vec4 voxel = texture(atlas, texel / atlas_size);
+    // Emits in proportion to what it absorbs.
+    float absorbed = 1.0 - exp(-voxel.a * step_extinction);
+    color += transmittance * absorbed * voxel.rgb;
+    transmittance *= 1.0 - absorbed;
+  }
+  // Blended with the color so far scaled by the transmittance.
+  frag_color = vec4(color, transmittance);
+}
@@ -6,5 +6,12 @@
 class SkyboxTask final : public ActiveTask<pb::SkyboxRequest, pb::SkyboxResponse> {
 public:
 	SkyboxTask(unique_ptr<Task> &&task)
-			: ActiveTask(task->request.task().skybox(), *task->response.mutable_skybox(), std::move(task)) { }
+			: ActiveTask(task->request().task().skybox(), *task->response().mutable_skybox(), std::move(task)) { }
+};
+
+// Never responds itself. The responses, one per position, are sent with forks.
+class SkyboxBatchTask final : public ActiveTask<pb::SkyboxBatchRequest, pb::SkyboxBatchResponse> {
+public:
+	SkyboxBatchTask(unique_ptr<Task> &&task)
+			: ActiveTask(task->request().task().skybox_batch(), *task->response().mutable_skybox_batch(), std::move(task)) { }
 };
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "skybox_delta.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#	include <emmintrin.h>
+#endif
+
+// Whether the two byte ranges are equal. Equivalent to memcmp() == 0, but
+// without the ordering, which lets the loop only OR the lane masks together
+// and test once at the end, instead of branching per chunk.
+static bool bytes_equal(const uint8_t *a, const uint8_t *b, size_t size) {
+	size_t i = 0;
+#if defined(__AVX2__)
+	__m256i diff = _mm256_setzero_si256();
+	for (; i + 32 <= size; i += 32) {
+		const __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		const __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		diff = _mm256_or_si256(diff, _mm256_xor_si256(va, vb));
+	}
+	if (!_mm256_testz_si256(diff, diff)) {
+		return false;
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	__m128i diff = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16) {
+		const __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		const __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		diff = _mm_or_si128(diff, _mm_xor_si128(va, vb));
+	}
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF) {
+		return false;
+	}
+#endif
+	uint8_t tail = 0;
+	for (; i < size; ++i) {
+		tail |= a[i] ^ b[i];
+	}
+	return tail == 0;
+}
+
+bool SkyboxFrameHistory::contains(uint64_t id, int width) const {
+	for (const auto &[key, frame] : frames) {
+		if (frame.id == id && (int)(key >> 32) == width) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SkyboxFrameHistory::push(uint64_t id, uint64_t base_id, int width, int height, const std::vector<uint8_t> &pixels, SkyboxDelta &delta) {
+	const uint64_t key = (uint64_t)width << 32 | (uint32_t)height;
+	auto it = frames.find(key);
+	if (it == frames.end()) {
+		frames[key] = {id, pixels};
+		return false;
+	}
+	Frame &frame = it->second;
+	const bool has_base = frame.id == base_id;
+	frame.id = id;
+	if (!has_base) {
+		frame.pixels = pixels;
+		return false;
+	}
+
+	const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	const size_t row_size = width * 3;
+	delta.tile_size = TILE_SIZE;
+	delta.tile_map.assign((tiles_x * tiles_y + 7) / 8, 0);
+	delta.changed_tile_count = 0;
+	delta.tile_pixels.clear();
+
+	for (int ty = 0; ty < tiles_y; ++ty) {
+		const int y0 = ty * TILE_SIZE;
+		const int tile_height = std::min(TILE_SIZE, height - y0);
+		for (int tx = 0; tx < tiles_x; ++tx) {
+			const int x0 = tx * TILE_SIZE;
+			const size_t tile_row_size = std::min(TILE_SIZE, width - x0) * 3;
+			const size_t offset = y0 * row_size + x0 * 3;
+
+			bool changed = false;
+			for (int y = 0; y < tile_height && !changed; ++y) {
+				changed = !bytes_equal(&pixels[offset + y * row_size], &frame.pixels[offset + y * row_size], tile_row_size);
+			}
+			if (!changed) {
+				continue;
+			}
+
+			const int tile_index = ty * tiles_x + tx;
+			delta.tile_map[tile_index / 8] |= 1 << (tile_index % 8);
+			const size_t tile_start = delta.tile_pixels.size();
+			delta.tile_pixels.resize(tile_start + TILE_SIZE * TILE_SIZE * 3, 0);
+			for (int y = 0; y < tile_height; ++y) {
+				std::copy_n(&pixels[offset + y * row_size], tile_row_size, &delta.tile_pixels[tile_start + y * TILE_SIZE * 3]);
+			}
+			++delta.changed_tile_count;
+		}
+	}
+
+	frame.pixels = pixels;
+	// Past half of the tiles, padding and the tile map eat most of the gain.
+	return 2 * delta.changed_tile_count <= tiles_x * tiles_y;
+}
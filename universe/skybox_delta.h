@@ -0,0 +1,47 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+// Tile-level difference between a skybox image and an earlier image of the
+// same dimensions.
+struct SkyboxDelta {
+	int tile_size = 0;
+	// One bit per tile, set if the tile changed. Tiles are in row-major order,
+	// bits within a byte from the least significant.
+	std::vector<uint8_t> tile_map;
+	int changed_tile_count = 0;
+	// The changed tiles in tile map order, stacked into an RGB image tile_size
+	// pixels wide. Tiles cut off by the image edge are padded with zeros.
+	std::vector<uint8_t> tile_pixels;
+};
+
+// Remembers the last skybox image of each size sent on a stream, so that the
+// next one can be sent as a delta against it.
+//
+// Keeps whole images rather than tile hashes. Comparing against the previous
+// pixels is as fast as hashing the new ones and cannot collide.
+class SkyboxFrameHistory {
+	struct Frame {
+		uint64_t id;
+		std::vector<uint8_t> pixels;
+	};
+	// Keyed by (width, height).
+	std::unordered_map<uint64_t, Frame> frames;
+
+public:
+	static constexpr int TILE_SIZE = 32;
+
+	// Records the RGB image as the last one of its dimensions, identified by id.
+	//
+	// If the previous image of these dimensions had base_id, also computes the
+	// delta against it and returns true. Returns false if there is no such image
+	// or if the delta would not be much smaller than the image itself, in which
+	// case it should be sent in full.
+	bool push(uint64_t id, uint64_t base_id, int width, int height, const std::vector<uint8_t> &pixels, SkyboxDelta &delta);
+
+	// Whether the last image of some height and the given width has the id.
+	bool contains(uint64_t id, int width) const;
+};
@@ -0,0 +1,106 @@
+#include "skybox_prefetch.h"
+
+#include <algorithm>
+
+#include "task.h"
+
+static bool matches(const SkyboxPrefetcher::Entry &entry, const glm::vec3 &position, int size, bool mipmaps) {
+	return entry.size == size
+			&& entry.mipmaps == mipmaps
+			&& glm::distance(entry.position, position) <= SkyboxPrefetcher::MATCH_DISTANCE;
+}
+
+bool SkyboxPrefetcher::take(const shared_ptr<TaskReactor> &reactor, const glm::vec3 &position, int size, bool mipmaps, std::vector<uint8_t> &pixels, int &mip_levels) {
+	if (!is_enabled()) {
+		return false;
+	}
+	Stream &stream = stream_of(reactor);
+	auto it = std::find_if(stream.entries.begin(), stream.entries.end(), [&](const Entry &entry) {
+		return entry.is_rendered && matches(entry, position, size, mipmaps);
+	});
+	if (it == stream.entries.end()) {
+		++stats.prefetch_misses;
+		return false;
+	}
+	++stats.prefetch_hits;
+	pixels = std::move(it->pixels);
+	mip_levels = it->mip_levels;
+	stream.entries.erase(it);
+	return true;
+}
+
+void SkyboxPrefetcher::observe(const shared_ptr<TaskReactor> &reactor, const glm::vec3 &position, int size, bool mipmaps) {
+	if (!is_enabled()) {
+		return;
+	}
+	Stream &stream = stream_of(reactor);
+	if (stream.position_count > 0) {
+		stream.velocity = position - stream.last_position;
+	}
+	stream.last_position = position;
+	++stream.position_count;
+
+	std::vector<Entry> entries;
+	if (stream.position_count >= 2 && glm::length(stream.velocity) > MATCH_DISTANCE) {
+		for (int step = 1; step <= options.lookahead; ++step) {
+			const glm::vec3 predicted = position + (float)step * stream.velocity;
+			auto it = std::find_if(stream.entries.begin(), stream.entries.end(), [&](const Entry &entry) {
+				return matches(entry, predicted, size, mipmaps);
+			});
+			if (it != stream.entries.end()) {
+				entries.push_back(std::move(*it));
+				stream.entries.erase(it);
+			} else {
+				entries.push_back({predicted, size, mipmaps});
+			}
+		}
+	}
+	discard(stream, stream.entries.begin(), stream.entries.end());
+	stream.entries = std::move(entries);
+}
+
+SkyboxPrefetcher::Entry *SkyboxPrefetcher::next_pending() {
+	Entry *next = nullptr;
+	for (auto it = streams.begin(); it != streams.end();) {
+		Stream &stream = it->second;
+		if (stream.reactor.expired()) {
+			discard(stream, stream.entries.begin(), stream.entries.end());
+			it = streams.erase(it);
+			continue;
+		}
+		// Entries are in order of distance, so the first pending one of each
+		// stream is the most urgent.
+		for (Entry &entry : stream.entries) {
+			if (!entry.is_rendered) {
+				if (!next) {
+					next = &entry;
+				}
+				break;
+			}
+		}
+		++it;
+	}
+	return next;
+}
+
+void SkyboxPrefetcher::rendered(Entry &entry, int mip_levels, const std::vector<uint8_t> &pixels) {
+	entry.is_rendered = true;
+	entry.mip_levels = mip_levels;
+	entry.pixels = pixels;
+	++stats.prefetch_renders;
+}
+
+SkyboxPrefetcher::Stream &SkyboxPrefetcher::stream_of(const shared_ptr<TaskReactor> &reactor) {
+	Stream &stream = streams[reactor.get()];
+	if (stream.reactor.expired()) {
+		// New stream, or a new one at the address of one that is gone.
+		discard(stream, stream.entries.begin(), stream.entries.end());
+		stream = {reactor};
+	}
+	return stream;
+}
+
+void SkyboxPrefetcher::discard(Stream &stream, std::vector<Entry>::iterator begin, std::vector<Entry>::iterator end) {
+	stats.prefetch_wasted += std::count_if(begin, end, [](const Entry &entry) { return entry.is_rendered; });
+	stream.entries.erase(begin, end);
+}
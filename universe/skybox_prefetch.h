@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "math.h"
+
+class TaskReactor;
+struct TaskStats;
+
+struct SkyboxPrefetchOptions {
+	// How many positions ahead along the extrapolated trajectory of a stream to
+	// prefetch. Prefetching is off if 0.
+	int lookahead = 0;
+	// Maximum number of skyboxes prefetched per idle frame.
+	int budget = 1;
+};
+
+// Predicts the next skybox requests of each stream by extrapolating the
+// positions of its last two requests, and keeps the predicted skyboxes, once
+// rendered, for when the actual requests come.
+//
+// Only accessed from the render thread.
+class SkyboxPrefetcher {
+public:
+	struct Entry {
+		glm::vec3 position;
+		int size;
+		bool mipmaps;
+		bool is_rendered = false;
+		int mip_levels = 0;
+		std::vector<uint8_t> pixels;
+	};
+
+	// How close a request must be to a predicted position to use its skybox.
+	static constexpr float MATCH_DISTANCE = 1e-3f;
+
+	const SkyboxPrefetchOptions options;
+
+	SkyboxPrefetcher(const SkyboxPrefetchOptions &options, TaskStats &stats)
+			: options(options), stats(stats) { }
+
+	bool is_enabled() const { return options.lookahead > 0; }
+
+	// If the skybox was prefetched for the stream, moves its pixels out and
+	// returns true.
+	bool take(const shared_ptr<TaskReactor> &stream, const glm::vec3 &position, int size, bool mipmaps, std::vector<uint8_t> &pixels, int &mip_levels);
+
+	// Records a request on the stream and updates the predictions. Rendered
+	// skyboxes that are no longer predicted are discarded.
+	void observe(const shared_ptr<TaskReactor> &stream, const glm::vec3 &position, int size, bool mipmaps);
+
+	// The next predicted skybox that is yet to be rendered, nearest first, or
+	// null if there is none. Once rendered, pass it to rendered().
+	Entry *next_pending();
+
+	void rendered(Entry &entry, int mip_levels, const std::vector<uint8_t> &pixels);
+
+private:
+	struct Stream {
+		weak_ptr<TaskReactor> reactor;
+		int position_count = 0;
+		glm::vec3 last_position;
+		glm::vec3 velocity;
+		std::vector<Entry> entries;
+	};
+
+	TaskStats &stats;
+	std::unordered_map<const TaskReactor *, Stream> streams;
+
+	Stream &stream_of(const shared_ptr<TaskReactor> &reactor);
+	void discard(Stream &stream, std::vector<Entry>::iterator begin, std::vector<Entry>::iterator end);
+};
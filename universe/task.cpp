@@ -1,88 +1,518 @@
 #include "task.h"
 
+#include <algorithm>
+#include <bit>
 #include <unordered_set>
 
+#include <common_cpp/log.h>
+
+Task::Task(const weak_ptr<TaskReactor> &reactor)
+		: reactor(reactor), arena(arena_block, ARENA_BLOCK_SIZE) {
+	reset(0);
+}
+
+void Task::reset(int step) {
+	// Reset() keeps the initial block, so this doesn't allocate unless the
+	// previous messages spilled over.
+	arena.Reset();
+	_step = step;
+	_request = google::protobuf::Arena::CreateMessage<Request>(&arena);
+	_response = google::protobuf::Arena::CreateMessage<Response>(&arena);
+}
+
+unique_ptr<Task> Task::next_step() const {
+	return make_step(_step + 1);
+}
+
+unique_ptr<Task> Task::fork() const {
+	return make_step(_step);
+}
+
+unique_ptr<Task> Task::make_step(int step) const {
+	shared_ptr<TaskReactor> reactor = this->reactor.lock();
+	if (!reactor) {
+		// Nowhere to send the response anyway.
+		unique_ptr<Task> task(new Task(this->reactor));
+		task->reset(step);
+		task->_request->CopyFrom(*_request);
+		return task;
+	}
+	reactor->step_started(id());
+	return reactor->new_task(*_request, step);
+}
+
+bool Task::is_superseded() const {
+	shared_ptr<TaskReactor> reactor = this->reactor.lock();
+	return reactor && reactor->latest_task_id(variant_case()) > id();
+}
+
+bool Task::is_cancelled() const {
+	shared_ptr<TaskReactor> reactor = this->reactor.lock();
+	return !reactor || reactor->is_task_cancelled(id());
+}
+
 void Task::done(unique_ptr<Task> &&task) {
 	shared_ptr<TaskReactor> reactor = task->reactor.lock();
 	if (!reactor) {
 		return;
 	}
+	task->_response->set_task_id(task->id());
 	reactor->done(std::move(task));
 }
 
+void Task::drop(unique_ptr<Task> &&task) {
+	shared_ptr<TaskReactor> reactor = task->reactor.lock();
+	if (reactor) {
+		reactor->drop(std::move(task));
+	}
+}
+
 ActiveTaskBase::~ActiveTaskBase() {
 	if (is_done) {
 		Task::done(std::move(task));
+	} else if (task) {
+		Task::drop(std::move(task));
 	}
-	// TODO: What should happen if it was not done?
+}
+
+void ActiveTaskBase::fail(grpc::StatusCode code, const std::string &message) {
+	Task::Response &response = task->response();
+	response.clear_variant();
+	response.mutable_error()->set_code(code);
+	response.mutable_error()->set_message(message);
+	is_done = true;
 }
 
 void TaskQueue::add(std::unique_ptr<Task> &&task) {
+	// Declared before the lock, so that if this is the last reference, the
+	// reactor is destroyed after unlocking, since it calls remove_stream().
+	shared_ptr<TaskReactor> reactor = task->lock_reactor();
+	if (!reactor) {
+		return;
+	}
 	std::lock_guard<std::mutex> lock(mut);
-	pending_tasks.emplace(std::move(task));
+	auto [it, is_new] = stream_queues.try_emplace(reactor.get());
+	StreamQueue &queue = it->second;
+	if (is_new) {
+		queue.tasks.reserve(limits.max_stream_tasks);
+		queue.weight = reactor->weight;
+	}
+	if (queue.tasks.empty()) {
+		active_streams.push(reactor.get());
+	}
+	task->_queued_time = std::chrono::steady_clock::now();
+	queue.tasks.push(std::move(task));
+}
+
+bool TaskQueue::try_admit() {
+	int count = in_flight_count.load();
+	do {
+		if (count >= limits.max_server_tasks) {
+			return false;
+		}
+	} while (!in_flight_count.compare_exchange_weak(count, count + 1));
+	return true;
+}
+
+void TaskQueue::admit() {
+	++in_flight_count;
+}
+
+void TaskQueue::release(int count) {
+	in_flight_count -= count;
 }
 
 unique_ptr<Task> TaskQueue::pop() {
 	std::lock_guard<std::mutex> lock(mut);
-	if (pending_tasks.empty()) {
+	if (active_streams.empty()) {
 		return nullptr;
-	} else {
-		unique_ptr<Task> task = std::move(pending_tasks.front());
-		pending_tasks.pop();
-		return task;
 	}
+
+	const TaskReactor *stream = active_streams.front();
+	StreamQueue &queue = stream_queues.at(stream);
+	if (queue.deficit <= 0) {
+		// The stream's turn begins.
+		queue.deficit = queue.weight;
+	}
+	unique_ptr<Task> task = std::move(queue.tasks.front());
+	queue.tasks.pop();
+	--queue.deficit;
+	task->_started_time = std::chrono::steady_clock::now();
+	trace::record("queue", task->id(), task->_queued_time, task->_started_time);
+
+	if (queue.tasks.empty()) {
+		// An idle stream doesn't save up its share for later.
+		queue.deficit = 0;
+		active_streams.pop();
+	} else if (queue.deficit <= 0) {
+		active_streams.pop();
+		active_streams.push(stream);
+	}
+	return task;
+}
+
+int TaskQueue::pending_count() {
+	std::lock_guard<std::mutex> lock(mut);
+	int count = 0;
+	for (const auto &[reactor, queue] : stream_queues) {
+		count += queue.tasks.size();
+	}
+	return count;
+}
+
+std::vector<unique_ptr<Task>> TaskQueue::remove_tasks(const TaskReactor *reactor, const std::function<bool(const Task &)> &predicate) {
+	std::vector<unique_ptr<Task>> removed_tasks;
+	std::lock_guard<std::mutex> lock(mut);
+	auto it = stream_queues.find(reactor);
+	if (it == stream_queues.end()) {
+		return removed_tasks;
+	}
+	StreamQueue &stream_queue = it->second;
+	RingQueue<unique_ptr<Task>> &queue = stream_queue.tasks;
+	for (size_t i = queue.size(); i > 0; --i) {
+		unique_ptr<Task> task = std::move(queue.front());
+		queue.pop();
+		if (predicate(*task)) {
+			removed_tasks.push_back(std::move(task));
+		} else {
+			queue.push(std::move(task));
+		}
+	}
+	if (queue.empty() && !removed_tasks.empty()) {
+		stream_queue.deficit = 0;
+		active_streams.erase_if([&](const TaskReactor *stream) { return stream == reactor; });
+	}
+	return removed_tasks;
+}
+
+int TaskQueue::remove_stream(const TaskReactor *reactor) {
+	// Destroyed after unlocking.
+	RingQueue<unique_ptr<Task>> removed_tasks;
+	std::lock_guard<std::mutex> lock(mut);
+	auto it = stream_queues.find(reactor);
+	if (it == stream_queues.end()) {
+		return 0;
+	}
+	removed_tasks = std::move(it->second.tasks);
+	stream_queues.erase(it);
+	active_streams.erase_if([&](const TaskReactor *stream) { return stream == reactor; });
+	return removed_tasks.size();
 }
 
 grpc::ServerBidiReactor<Task::Request, Task::Response> *TaskQueue::Stream(grpc::CallbackServerContext *ctx) {
-	std::cout << "Streaming man!" << std::endl;
-	return new TaskReactor(*this);
+	int weight = 1;
+	auto it = ctx->client_metadata().find(WEIGHT_METADATA_KEY);
+	if (it != ctx->client_metadata().end()) {
+		string value(it->second.data(), it->second.size());
+		try {
+			weight = std::clamp(std::stoi(value), 1, MAX_STREAM_WEIGHT);
+		} catch (const std::exception &) {
+			LOG(WARNING) << "Invalid " << WEIGHT_METADATA_KEY << ": " << value;
+		}
+	}
+	LOG(DEBUG) << "New task stream, weight " << weight;
+	return new TaskReactor(*this, weight);
+}
+
+TaskIdCounts::TaskIdCounts(int capacity)
+		: slots(std::bit_ceil(2 * (size_t)std::max(capacity, 1))) { }
+
+void TaskIdCounts::increment(TaskId id) {
+	size_t index = find(id);
+	if (slots[index].count == 0) {
+		if (2 * (id_count + 1) > slots.size()) {
+			std::vector<Slot> old_slots = std::move(slots);
+			slots.assign(2 * old_slots.size(), Slot());
+			for (const Slot &slot : old_slots) {
+				if (slot.count > 0) {
+					slots[find(slot.id)] = slot;
+				}
+			}
+			index = find(id);
+		}
+		slots[index].id = id;
+		++id_count;
+	}
+	++slots[index].count;
+}
+
+int TaskIdCounts::decrement(TaskId id) {
+	const size_t index = find(id);
+	Slot &slot = slots[index];
+	if (slot.count == 0) {
+		return 0;
+	}
+	const int count = --slot.count;
+	if (count == 0) {
+		erase_at(index);
+	}
+	return count;
+}
+
+// Fibonacci hashing, since task IDs are often sequential.
+size_t TaskIdCounts::home(TaskId id) const {
+	const uint64_t mixed = id * 0x9e3779b97f4a7c15ull;
+	return (mixed ^ (mixed >> 32)) & (slots.size() - 1);
 }
 
-TaskReactor::TaskReactor(TaskQueue &tasks)
-		: shared_this(this), tasks(tasks) {
+// Index of the slot holding the ID, or of the empty slot it would go to.
+size_t TaskIdCounts::find(TaskId id) const {
+	const size_t mask = slots.size() - 1;
+	size_t index = home(id);
+	while (slots[index].count > 0 && slots[index].id != id) {
+		index = (index + 1) & mask;
+	}
+	return index;
+}
+
+// Empties the slot and shifts back the entries after it that probed past it,
+// so that lookups never need tombstones.
+void TaskIdCounts::erase_at(size_t index) {
+	const size_t mask = slots.size() - 1;
+	size_t hole = index;
+	for (size_t i = (hole + 1) & mask; slots[i].count > 0; i = (i + 1) & mask) {
+		// The entry can fill the hole if the hole is between its home and it.
+		if (((i - home(slots[i].id)) & mask) >= ((i - hole) & mask)) {
+			slots[hole] = slots[i];
+			hole = i;
+		}
+	}
+	slots[hole] = Slot();
+	--id_count;
+}
+
+TaskReactor::TaskReactor(TaskQueue &tasks, int weight)
+		: shared_this(this)
+		, tasks(tasks)
+		, write_queue(tasks.limits.max_stream_tasks)
+		, in_flight_task_ids(tasks.limits.max_stream_tasks)
+		, weight(weight) {
+	free_tasks.reserve(tasks.limits.max_stream_tasks);
 	read_next();
 }
 
+TaskReactor::~TaskReactor() {
+	tasks.remove_stream(this);
+	// Tasks being processed will find the reactor gone and won't report back.
+	tasks.release(in_flight_count);
+}
+
 void TaskReactor::done(unique_ptr<Task> &&task) {
 	std::lock_guard<std::mutex> lock(mut);
+	if (is_finished || cancelled_task_ids.contains(task->id())) {
+		TaskId id = task->id();
+		recycle(std::move(task));
+		task_finished(id);
+		return;
+	}
 	write_queue.push(std::move(task));
 	write_next();
 }
 
+void TaskReactor::step_started(TaskId id) {
+	std::lock_guard<std::mutex> lock(mut);
+	++in_flight_count;
+	in_flight_task_ids.increment(id);
+	tasks.admit();
+}
+
+bool TaskReactor::is_task_cancelled(TaskId id) {
+	if (is_finished) {
+		return true;
+	}
+	std::lock_guard<std::mutex> lock(mut);
+	return cancelled_task_ids.contains(id);
+}
+
+void TaskReactor::drop(unique_ptr<Task> &&task) {
+	std::lock_guard<std::mutex> lock(mut);
+	TaskId id = task->id();
+	recycle(std::move(task));
+	task_finished(id);
+}
+
+unique_ptr<Task> TaskReactor::new_task(const Task::Request &request, int step) {
+	std::lock_guard<std::mutex> lock(mut);
+	unique_ptr<Task> task = new_task_locked(step);
+	task->_request->CopyFrom(request);
+	return task;
+}
+
+// Must be called with mut locked, or from the constructor.
+unique_ptr<Task> TaskReactor::new_task_locked(int step) {
+	if (free_tasks.empty()) {
+		return unique_ptr<Task>(new Task(shared_this));
+	}
+	unique_ptr<Task> task = std::move(free_tasks.back());
+	free_tasks.pop_back();
+	task->reset(step);
+	return task;
+}
+
+// Must be called with mut locked. The pool never holds more tasks than may be
+// in flight at once.
+void TaskReactor::recycle(unique_ptr<Task> &&task) {
+	if (free_tasks.size() < size_t(tasks.limits.max_stream_tasks)) {
+		free_tasks.push_back(std::move(task));
+	} else {
+		task.reset();
+	}
+}
+
+// Must be called with mut locked.
+void TaskReactor::task_finished(TaskId id) {
+	--in_flight_count;
+	tasks.release();
+	if (in_flight_task_ids.decrement(id) == 0) {
+		cancelled_task_ids.erase(id);
+	}
+	if (!is_reading && !is_read_closed && !is_finished && in_flight_count < tasks.limits.max_stream_tasks) {
+		read_next();
+	}
+	finish_if_idle();
+}
+
+void TaskReactor::cancel(const google::protobuf::RepeatedField<TaskId> &task_ids) {
+	std::lock_guard<std::mutex> lock(mut);
+	cancel_locked(task_ids);
+}
+
+// Must be called with mut locked. Pending tasks are removed right away, the
+// ones in progress are left to notice it through Task::is_cancelled.
+void TaskReactor::cancel_locked(const google::protobuf::RepeatedField<TaskId> &task_ids) {
+	std::unordered_set<TaskId> ids(task_ids.begin(), task_ids.end());
+	std::vector<unique_ptr<Task>> removed_tasks = tasks.remove_tasks(this, [&](const Task &task) {
+		return ids.contains(task.id());
+	});
+	tasks.stats.cancelled_pending += removed_tasks.size();
+	for (unique_ptr<Task> &task : removed_tasks) {
+		TaskId id = task->id();
+		recycle(std::move(task));
+		task_finished(id);
+	}
+	for (TaskId id : ids) {
+		if (in_flight_task_ids.contains(id)) {
+			cancelled_task_ids.insert(id);
+		}
+	}
+}
+
+// Must be called with mut locked. Once the client is done sending and all its
+// tasks are answered, the stream can end.
+void TaskReactor::finish_if_idle() {
+	if (is_read_closed && in_flight_count == 0 && !is_finished) {
+		is_finished = true;
+		Finish(grpc::Status::OK);
+	}
+}
+
+TaskId TaskReactor::latest_task_id(Task::VariantCase variant_case) {
+	std::lock_guard<std::mutex> lock(mut);
+	return latest_task_ids[variant_case];
+}
+
+// Must be called with mut locked, or from the constructor.
 void TaskReactor::read_next() {
-	read_target = make_unique<Task>(shared_this);
-	// const_cast is fine, because we own the task that we just created and it
-	// will not be accessed by anyone before the read finishes.
-	StartRead(const_cast<Task::Request *>(&read_target->request));
+	is_reading = true;
+	read_target = new_task_locked(0);
+	// Writing to the request is fine, because we own the task that we just
+	// created and it will not be accessed by anyone before the read finishes.
+	StartRead(read_target->_request);
 }
 
 void TaskReactor::OnReadDone(bool ok) {
-	std::cout << "OnReadDone" << std::endl;
+	LOG(DEBUG) << "OnReadDone";
+	const trace::Clock::time_point read_done_time = trace::now();
+	std::lock_guard<std::mutex> lock(mut);
 	if (!ok) {
+		is_reading = false;
+		is_read_closed = true;
+		finish_if_idle();
 		return;
 	}
-	std::lock_guard<std::mutex> lock(mut);
-	tasks.add(std::move(read_target));
-	read_next();
+	if (is_finished) {
+		is_reading = false;
+		return;
+	}
+
+	// Still counts as reading until the end, so that tasks finished by the
+	// cancellation below don't start another read.
+	const Task::Request &request = read_target->request();
+	if (request.cancel_task_ids_size() > 0) {
+		cancel_locked(request.cancel_task_ids());
+	}
+	if (!request.has_task()) {
+		recycle(std::move(read_target));
+		is_reading = false;
+		if (!is_finished && in_flight_count < tasks.limits.max_stream_tasks) {
+			read_next();
+		}
+		return;
+	}
+
+	++in_flight_count;
+	in_flight_task_ids.increment(read_target->id());
+	TaskId &latest_task_id = latest_task_ids[read_target->variant_case()];
+	latest_task_id = std::max(latest_task_id, read_target->id());
+	trace::record("read", read_target->id(), read_done_time, trace::Clock::now());
+	if (tasks.try_admit()) {
+		tasks.add(std::move(read_target));
+	} else {
+		// Shed the load. The error response is written like any other, so it
+		// still counts toward the stream limit until then.
+		auto &error = *read_target->_response->mutable_error();
+		error.set_code(grpc::StatusCode::RESOURCE_EXHAUSTED);
+		error.set_message("Server is at capacity of " + to_string(tasks.limits.max_server_tasks) + " tasks.");
+		read_target->_response->set_task_id(read_target->id());
+		tasks.admit();
+		write_queue.push(std::move(read_target));
+		write_next();
+	}
+
+	is_reading = false;
+	if (!is_finished && in_flight_count < tasks.limits.max_stream_tasks) {
+		read_next();
+	}
 }
 
+// Must be called with mut locked. gRPC allows only one write in flight, so the
+// next one is started from OnWriteDone.
 void TaskReactor::write_next() {
-	if (write_queue.empty()) {
+	if (is_writing || is_finished || write_queue.empty()) {
 		return;
 	}
-	StartWrite(&write_queue.front()->response);
+	is_writing = true;
+	write_started_time = trace::now();
+	StartWrite(write_queue.front()->_response);
 }
 
 void TaskReactor::OnWriteDone(bool ok) {
-	std::cout << "OnWriteDone" << std::endl;
+	LOG(DEBUG) << "OnWriteDone";
 	if (!ok) {
 		return;
 	}
 	std::lock_guard<std::mutex> lock(mut);
+	is_writing = false;
+	TaskId id = write_queue.front()->id();
+	trace::record("write", id, write_started_time, trace::Clock::now());
+	recycle(std::move(write_queue.front()));
 	write_queue.pop();
+	task_finished(id);
 	write_next();
 }
 
+// The client went away. Tasks in progress notice through Task::is_cancelled,
+// the pending ones are removed in OnDone.
+void TaskReactor::OnCancel() {
+	LOG(DEBUG) << "OnCancel";
+	std::lock_guard<std::mutex> lock(mut);
+	if (!is_finished) {
+		is_finished = true;
+		Finish(grpc::Status::CANCELLED);
+	}
+}
+
 void TaskReactor::OnDone() {
+	tasks.stats.cancelled_pending += tasks.remove_stream(this);
 	shared_this.reset();
 }
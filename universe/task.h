@@ -1,34 +1,106 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include <google/protobuf/arena.h>
+
+#include <common_cpp/ring_queue.h>
 #include <universe/proto/task.grpc.pb.h>
 
 #include "common.h"
+#include "skybox_delta.h"
+#include "trace.h"
 
 typedef uint64_t TaskId;
 class TaskReactor;
 
+// Tasks are pooled by their reactor and the request and response live in an
+// arena backed by a block inside the task, so that a stream in steady state
+// doesn't keep hitting the heap allocator.
 class Task final {
-	weak_ptr<TaskReactor> reactor;
-
 public:
 	typedef universepb::TaskRequest Request;
 	typedef pb::TaskResponse Response;
 	typedef pb::TaskRequest::VariantCase VariantCase;
 
-	const Request request;
-	Response response;
+private:
+	// Enough for the messages of all current variants. Messages that don't fit
+	// spill over to blocks allocated by the arena.
+	static constexpr size_t ARENA_BLOCK_SIZE = 2048;
+
+	weak_ptr<TaskReactor> reactor;
+	int _step = 0;
+	std::chrono::steady_clock::time_point _queued_time;
+	std::chrono::steady_clock::time_point _started_time;
+	alignas(std::max_align_t) char arena_block[ARENA_BLOCK_SIZE];
+	google::protobuf::Arena arena;
+	Request *_request;
+	Response *_response;
+
+public:
+	const Request &request() const { return *_request; }
+	Response &response() { return *_response; }
+
+	TaskId id() const { return _request->task_id(); }
+
+	VariantCase variant_case() const { return _request->task().variant_case(); }
+
+	// Tasks that respond in multiple steps are processed as a chain of Task
+	// objects, one per response. This is the index of this one in the chain.
+	int step() const { return _step; }
+
+	// When the task was last added to the queue, and when it was taken out of
+	// it to be processed.
+	std::chrono::steady_clock::time_point queued_time() const { return _queued_time; }
+	std::chrono::steady_clock::time_point started_time() const { return _started_time; }
 
-	Task(const shared_ptr<TaskReactor> &reactor)
-			: reactor(reactor) { }
+	// Creates the task for the next step. It has the same request, but a fresh
+	// response.
+	unique_ptr<Task> next_step() const;
 
-	VariantCase variant_case() const { return request.task().variant_case(); }
+	// Creates another task for the same step, to send an additional response
+	// with. For tasks that respond several times from a single step.
+	unique_ptr<Task> fork() const;
 
+	// Whether a newer task of the same variant has arrived on the stream since.
+	bool is_superseded() const;
+
+	// Whether the task was cancelled or its stream has ended. Long running tasks
+	// should check this between stages and give up if so.
+	bool is_cancelled() const;
+
+	// The reactor of the stream the task came from, or null if the stream is
+	// already gone.
+	shared_ptr<TaskReactor> lock_reactor() const { return reactor.lock(); }
+
+	// Sends the response of the task.
 	static void done(unique_ptr<Task> &&task);
+
+	// Discards the task without a response.
+	static void drop(unique_ptr<Task> &&task);
+
+private:
+	friend class TaskReactor;
+	friend class TaskQueue;
+
+	Task(const weak_ptr<TaskReactor> &reactor);
+
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	// Prepares a pooled task for reuse, with empty messages.
+	void reset(int step);
+
+	unique_ptr<Task> make_step(int step) const;
 };
 
 class ActiveTaskBase {
@@ -37,6 +109,23 @@ public:
 
 	void done() { is_done = true; }
 
+	// Responds with an error instead, without the variant. code is one of the
+	// gRPC status codes.
+	void fail(grpc::StatusCode code, const std::string &message);
+
+	// Takes the task over, to send its response later with Task::done(). The
+	// response must be complete by then, since it can't be reached from here
+	// anymore.
+	unique_ptr<Task> detach() { return std::move(task); }
+
+	int step() const { return task->step(); }
+	unique_ptr<Task> next_step() const { return task->next_step(); }
+	unique_ptr<Task> fork() const { return task->fork(); }
+	bool is_superseded() const { return task->is_superseded(); }
+	bool is_cancelled() const { return task->is_cancelled(); }
+	TaskId id() const { return task->id(); }
+	shared_ptr<TaskReactor> lock_reactor() const { return task->lock_reactor(); }
+
 protected:
 	unique_ptr<Task> task;
 	bool is_done = false;
@@ -60,41 +149,217 @@ protected:
 			, request(request)
 			, response(response) {
 		// Not a perfect check, but can detect some mistakes.
-		assert(task->request.task().variant_case() == task->response().variant_case());
+		assert(int(this->task->request().task().variant_case()) == int(this->task->response().variant_case()));
 	}
 };
 
+// Bounds on the number of tasks in flight, i.e. read from a stream but not yet
+// responded to. That covers queued tasks, the one being processed, and those
+// with responses waiting to be written.
+struct TaskLimits {
+	// Per stream. Once reached, the stream is not read from until some of its
+	// tasks finish, which pushes back on the client through gRPC flow control.
+	int max_stream_tasks = 16;
+	// Across all streams. Once reached, new tasks are rejected with
+	// RESOURCE_EXHAUSTED.
+	int max_server_tasks = 256;
+};
+
+// Counters reported in the job metrics.
+struct TaskStats {
+	// Work saved by cancellation.
+	//
+	// Tasks removed from the queue before their processing started.
+	std::atomic<int64_t> cancelled_pending = 0;
+	// Tasks abandoned during processing, by the stage they were about to enter.
+	std::atomic<int64_t> cancelled_before_render = 0;
+	std::atomic<int64_t> cancelled_before_encode = 0;
+
+	// Skybox prefetching, see SkyboxPrefetcher. Wasted renders are prefetched
+	// skyboxes discarded without being requested.
+	std::atomic<int64_t> prefetch_hits = 0;
+	std::atomic<int64_t> prefetch_misses = 0;
+	std::atomic<int64_t> prefetch_renders = 0;
+	std::atomic<int64_t> prefetch_wasted = 0;
+
+	// Occlusion culling of the skybox faces, summed over all the passes. Meshes
+	// are drawn either early, as visible in the last pass of the face, or late,
+	// as found visible by this one.
+	std::atomic<int64_t> occlusion_passes = 0;
+	std::atomic<int64_t> occlusion_drawn_early = 0;
+	std::atomic<int64_t> occlusion_drawn_late = 0;
+	std::atomic<int64_t> occlusion_frustum_culled = 0;
+	std::atomic<int64_t> occlusion_culled = 0;
+
+	// GPU time spent rendering skyboxes, including the lighting, for comparing
+	// scenes with different light counts.
+	std::atomic<int64_t> skybox_renders = 0;
+	std::atomic<int64_t> skybox_render_gpu_us = 0;
+
+	// Quality tier of the last skybox task, see QualityController, and the
+	// number of skyboxes rendered at a lowered quality.
+	std::atomic<int64_t> quality_tier = 0;
+	std::atomic<int64_t> degraded_skyboxes = 0;
+};
+
+// Tasks from all streams waiting to be processed. Each stream has its own
+// queue and pop() serves them by deficit round-robin, so a stream that bursts
+// many tasks doesn't hold up the others. A stream with weight w gets w tasks
+// served per round.
 class TaskQueue final : public universepb::TaskService::CallbackService {
+	// Kept from the first task of the stream until remove_stream(), so that a
+	// stream going idle and busy again doesn't allocate.
+	struct StreamQueue {
+		RingQueue<unique_ptr<Task>> tasks;
+		int weight = 1;
+		// Tasks the stream may still have served in the current round.
+		int deficit = 0;
+	};
+
 	std::mutex mut;
-	std::queue<unique_ptr<Task>> pending_tasks;
+	std::unordered_map<const TaskReactor *, StreamQueue> stream_queues;
+	// Streams with pending tasks, in round-robin order. The front one is being
+	// served.
+	RingQueue<const TaskReactor *> active_streams;
+	std::atomic<int> in_flight_count = 0;
 
 public:
+	// Client metadata key with the stream weight, a positive integer.
+	static constexpr const char *WEIGHT_METADATA_KEY = "task-weight";
+	static constexpr int MAX_STREAM_WEIGHT = 64;
+
+	const TaskLimits limits;
+	TaskStats stats;
+
+	TaskQueue(const TaskLimits &limits)
+			: limits(limits) { }
+
 	void add(unique_ptr<Task> &&task);
 
+	// Counts a new task as in flight, unless the server is at capacity, in which
+	// case returns false.
+	bool try_admit();
+
+	// Counts a new task as in flight, regardless of the limit. For the follow-up
+	// steps of tasks already admitted.
+	void admit();
+
+	// Counts tasks as no longer in flight.
+	void release(int count = 1);
+
 	unique_ptr<Task> pop();
 
+	// Number of tasks waiting, across all streams.
+	int pending_count();
+
+	// Removes the pending tasks of the stream for which the predicate holds.
+	std::vector<unique_ptr<Task>> remove_tasks(const TaskReactor *reactor, const std::function<bool(const Task &)> &predicate);
+
+	// Discards pending tasks of a stream that is going away. Returns how many
+	// there were.
+	int remove_stream(const TaskReactor *reactor);
+
 	grpc::ServerBidiReactor<Task::Request, Task::Response> *Stream(grpc::CallbackServerContext *ctx) override;
 };
 
+// Number of steps in flight per task ID, in an open-addressing table sized up
+// front, so that tracking tasks doesn't allocate. Grows only if it holds more
+// IDs than it was sized for.
+class TaskIdCounts {
+	struct Slot {
+		TaskId id = 0;
+		// 0 if the slot is empty.
+		int count = 0;
+	};
+
+	// Size is a power of two, at least twice the number of IDs.
+	std::vector<Slot> slots;
+	size_t id_count = 0;
+
+public:
+	explicit TaskIdCounts(int capacity);
+
+	bool contains(TaskId id) const { return slots[find(id)].count > 0; }
+
+	void increment(TaskId id);
+
+	// Returns the count left. The ID is forgotten once it reaches 0.
+	int decrement(TaskId id);
+
+private:
+	size_t home(TaskId id) const;
+	size_t find(TaskId id) const;
+	void erase_at(size_t index);
+};
+
+// A task stream, which stands for a single viewer, see TaskService.Stream in
+// task.proto. So the state of a viewer is kept here, e.g. skybox_history.
 class TaskReactor final : public grpc::ServerBidiReactor<Task::Request, Task::Response> {
 	std::mutex mut;
 	shared_ptr<TaskReactor> shared_this;
 	TaskQueue &tasks;
-	std::queue<unique_ptr<Task>> write_queue;
+	RingQueue<unique_ptr<Task>> write_queue;
 	unique_ptr<Task> read_target;
+	std::vector<unique_ptr<Task>> free_tasks;
+	std::unordered_map<Task::VariantCase, TaskId> latest_task_ids;
+	// Tasks of this stream in flight, see TaskLimits.
+	int in_flight_count = 0;
+	// Number of steps in flight for each task ID.
+	TaskIdCounts in_flight_task_ids;
+	// In flight tasks cancelled by the client.
+	std::unordered_set<TaskId> cancelled_task_ids;
+	// Set once the stream won't take any more writes.
+	std::atomic<bool> is_finished = false;
+	bool is_reading = false;
+	bool is_read_closed = false;
+	bool is_writing = false;
+	// When the response at the front of write_queue started being written, for
+	// tracing.
+	trace::Clock::time_point write_started_time;
 
 public:
-	TaskReactor(TaskQueue &tasks);
+	// Skyboxes last sent on this stream. Only accessed from the render thread.
+	SkyboxFrameHistory skybox_history;
+
+	// Share of the processing time relative to other streams, see TaskQueue.
+	const int weight;
+
+	TaskReactor(TaskQueue &tasks, int weight);
+	~TaskReactor();
 
 	const shared_ptr<TaskReactor> &shared() const { return shared_this; }
 
+	// ID of the most recent task of the given variant read from the stream.
+	TaskId latest_task_id(Task::VariantCase variant_case);
+
 	void done(unique_ptr<Task> &&task);
 
+	// Counts a follow-up step of a task in flight.
+	void step_started(TaskId id);
+
+	bool is_task_cancelled(TaskId id);
+
+	// Cancels tasks of the stream, as a request with cancel_task_ids does.
+	void cancel(const google::protobuf::RepeatedField<TaskId> &task_ids);
+
+	// Uncounts a task that ends without a response.
+	void drop(unique_ptr<Task> &&task);
+
+	// Takes a task from the pool, or creates one if there is none, for the given
+	// step of the request.
+	unique_ptr<Task> new_task(const Task::Request &request, int step);
+
 	void OnReadDone(bool ok) override;
 	void OnWriteDone(bool ok) override;
+	void OnCancel() override;
 	void OnDone() override;
 
 private:
 	void read_next();
 	void write_next();
+	void task_finished(TaskId id);
+	void cancel_locked(const google::protobuf::RepeatedField<TaskId> &task_ids);
+	void finish_if_idle();
+	unique_ptr<Task> new_task_locked(int step);
+	void recycle(unique_ptr<Task> &&task);
 };
\ No newline at end of file
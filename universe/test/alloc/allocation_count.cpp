@@ -0,0 +1,109 @@
+#include "allocation_count.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Replaces every form of the global operator new and delete, so that none of
+// the allocations slips by uncounted and each block goes back the way it came.
+// Kept in a file of its own, where the compiler can't pair the inlined
+// replacements with the built-in allocation functions.
+
+static std::atomic<int64_t> count = 0;
+
+int64_t allocation_count() {
+	return count.load();
+}
+
+// All blocks come from malloc() with room to align within, and the pointer to
+// free() stored right before the block, so that any form of delete can take a
+// block from any form of new.
+static void *allocate(size_t size, size_t alignment) noexcept {
+	++count;
+	void *base = std::malloc(size + alignment + sizeof(void *));
+	if (!base) {
+		return nullptr;
+	}
+	const uintptr_t block = ((uintptr_t)base + sizeof(void *) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	reinterpret_cast<void **>(block)[-1] = base;
+	return reinterpret_cast<void *>(block);
+}
+
+static void *allocate_or_throw(size_t size, size_t alignment) {
+	if (void *p = allocate(size, alignment)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+static void deallocate(void *p) noexcept {
+	if (p) {
+		std::free(static_cast<void **>(p)[-1]);
+	}
+}
+
+static constexpr size_t DEFAULT_ALIGNMENT = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+void *operator new(size_t size) {
+	return allocate_or_throw(size, DEFAULT_ALIGNMENT);
+}
+void *operator new[](size_t size) {
+	return allocate_or_throw(size, DEFAULT_ALIGNMENT);
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	return allocate(size, DEFAULT_ALIGNMENT);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return allocate(size, DEFAULT_ALIGNMENT);
+}
+void *operator new(size_t size, std::align_val_t alignment) {
+	return allocate_or_throw(size, (size_t)alignment);
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+	return allocate_or_throw(size, (size_t)alignment);
+}
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+	return allocate(size, (size_t)alignment);
+}
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+	return allocate(size, (size_t)alignment);
+}
+
+void operator delete(void *p) noexcept {
+	deallocate(p);
+}
+void operator delete[](void *p) noexcept {
+	deallocate(p);
+}
+void operator delete(void *p, size_t) noexcept {
+	deallocate(p);
+}
+void operator delete[](void *p, size_t) noexcept {
+	deallocate(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+	deallocate(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+	deallocate(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept {
+	deallocate(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept {
+	deallocate(p);
+}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+	deallocate(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+	deallocate(p);
+}
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+	deallocate(p);
+}
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+	deallocate(p);
+}
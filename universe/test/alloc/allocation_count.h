@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Number of heap allocations made so far by the whole binary, through any form
+// of the global operator new. Only available in binaries that link
+// allocation_count.cpp, which replaces them.
+int64_t allocation_count();
@@ -0,0 +1,43 @@
+#include <cstdint>
+
+#include <common_cpp/test.h>
+#include <universe/task.h>
+
+#include "allocation_count.h"
+
+// Reading a task, queueing, processing and writing its response, in steady
+// state, i.e. once the pools and queues have grown.
+TEST(task_round_trips_dont_allocate) {
+	const int max_stream_tasks = 4;
+	TaskQueue tasks({.max_stream_tasks = max_stream_tasks});
+	// Not bound to a call, see TestStream in task_test.cpp.
+	TaskReactor *reactor = new TaskReactor(tasks, 1);
+	Task::Request request;
+	TaskId next_id = 1;
+	auto round_trip = [&] {
+		// A few tasks in flight at once, as many as a stream may have.
+		for (int i = 0; i < max_stream_tasks; ++i) {
+			request.set_task_id(next_id);
+			reactor->step_started(next_id);
+			tasks.add(reactor->new_task(request, 0));
+			++next_id;
+		}
+		while (unique_ptr<Task> task = tasks.pop()) {
+			Task::done(std::move(task));
+		}
+		for (int i = 0; i < max_stream_tasks; ++i) {
+			reactor->OnWriteDone(true);
+		}
+	};
+
+	for (int i = 0; i < 10; ++i) {
+		round_trip();
+	}
+	const int64_t count_before = allocation_count();
+	for (int i = 0; i < 1000; ++i) {
+		round_trip();
+	}
+	EXPECT_EQ(allocation_count() - count_before, int64_t(0));
+	EXPECT_EQ(tasks.pending_count(), 0);
+	reactor->OnDone();
+}
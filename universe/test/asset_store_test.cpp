@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <random>
+#include <vector>
+
+#include <common_cpp/sha256.h>
+#include <common_cpp/test.h>
+#include <universe/asset_store.h>
+
+#include "test_dir.h"
+
+namespace fs = std::filesystem;
+
+// Random pixels hardly compress, so that each image takes about 4 bytes per
+// pixel as QOI: 384 KB, of which two fit in a megabyte but three don't.
+static constexpr int WIDTH = 384;
+static constexpr int HEIGHT = 256;
+
+static std::vector<uint8_t> image(uint32_t seed) {
+	std::mt19937 random(seed);
+	std::vector<uint8_t> pixels(WIDTH * HEIGHT * 3);
+	for (uint8_t &p : pixels) {
+		p = (uint8_t)random();
+	}
+	return pixels;
+}
+
+static void wait_for_writes(AssetStore &store) {
+	std::promise<void> written;
+	store.then([&] { written.set_value(); });
+	written.get_future().wait();
+}
+
+// Puts the image of the seed and returns its path once it is written.
+static string put(AssetStore &store, uint32_t seed, int width = WIDTH, int height = HEIGHT) {
+	string path;
+	store.put_qoi("skybox", image(seed), width, height, &path);
+	wait_for_writes(store);
+	return path;
+}
+
+TEST(asset_store_names_files_by_sha256) {
+	TestDir dir("asset_store_name");
+	AssetStore store({.dir = dir.path.string(), .budget_mb = 4});
+	const std::vector<uint8_t> pixels = image(1);
+	// The width and height, 384 and 256, little endian.
+	std::string bytes = {char(0x80), 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00};
+	bytes.append(pixels.begin(), pixels.end());
+	Sha256 sha;
+	sha.update(bytes);
+	const string name = "skybox_" + Sha256::to_hex(sha.digest()) + ".qoi";
+	EXPECT_EQ(AssetStore::qoi_name("skybox", pixels, WIDTH, HEIGHT), name);
+	EXPECT_EQ(put(store, 1), dir.path.string() + "/" + name);
+}
+
+TEST(asset_store_reuses_file_of_same_image) {
+	TestDir dir("asset_store_reuse");
+	AssetStore store({.dir = dir.path.string(), .budget_mb = 4});
+	const string a = put(store, 1);
+	EXPECT_EQ(put(store, 1), a);
+	EXPECT(put(store, 2) != a);
+	// Same bytes, other shape.
+	EXPECT(put(store, 1, HEIGHT, WIDTH) != a);
+	EXPECT(fs::exists(a));
+}
+
+TEST(asset_store_evicts_least_recently_stored) {
+	TestDir dir("asset_store_evict");
+	AssetStore store({.dir = dir.path.string(), .budget_mb = 1});
+	const string a = put(store, 1);
+	const string b = put(store, 2);
+	EXPECT(fs::exists(a));
+	EXPECT(fs::exists(b));
+
+	// Stored again, so b is the least recent now.
+	put(store, 1);
+	const string c = put(store, 3);
+	EXPECT(fs::exists(a));
+	EXPECT(!fs::exists(b));
+	EXPECT(fs::exists(c));
+
+	// Gone from the index too, so it is written again.
+	EXPECT_EQ(put(store, 2), b);
+	EXPECT(fs::exists(b));
+	EXPECT(!fs::exists(a));
+}
+
+TEST(asset_store_indexes_files_on_startup) {
+	TestDir dir("asset_store_startup");
+	string paths[3];
+	{
+		AssetStore store({.dir = dir.path.string(), .budget_mb = 2});
+		for (int i = 0; i < 3; ++i) {
+			paths[i] = put(store, i);
+		}
+	}
+	// Written in the same instant, as far as the file system can tell.
+	const auto time = fs::file_time_type::clock::now();
+	for (int i = 0; i < 3; ++i) {
+		EXPECT(fs::exists(paths[i]));
+		fs::last_write_time(paths[i], time + std::chrono::seconds(i));
+	}
+	const fs::path temp_path = paths[0] + ".tmp";
+	std::ofstream(temp_path) << "partial";
+	// Named after a hash the store doesn't use anymore.
+	const fs::path old_path = dir.path / "skybox_0123456789abcdef.qoi";
+	std::ofstream(old_path) << "old";
+
+	AssetStore store({.dir = dir.path.string(), .budget_mb = 1});
+	EXPECT(!fs::exists(temp_path));
+	EXPECT(!fs::exists(old_path));
+	// The oldest goes, to fit in the smaller budget.
+	EXPECT(!fs::exists(paths[0]));
+	EXPECT(fs::exists(paths[1]));
+	EXPECT(fs::exists(paths[2]));
+}
@@ -0,0 +1,80 @@
+#include <common_cpp/test.h>
+#include <universe/quality.h>
+
+// A quarter of the window settles the percentile.
+static constexpr int WINDOW = 16;
+static constexpr int SETTLED_COUNT = WINDOW / 4;
+
+static QualityOptions options() {
+	return {.latency_target_ms = 100.0f, .window = WINDOW};
+}
+
+// Records count responses at the current tier.
+static void record(QualityController &quality, int count, float wait_ms, float service_ms) {
+	const int tier = quality.current_tier();
+	for (int i = 0; i < count; ++i) {
+		quality.record(tier, wait_ms, service_ms);
+	}
+}
+
+TEST(quality_stays_best_when_disabled) {
+	QualityController quality({});
+	record(quality, WINDOW, 1000.0f, 1000.0f);
+	EXPECT_EQ(quality.pick(100), 0);
+}
+
+TEST(quality_stays_best_under_target) {
+	QualityController quality(options());
+	record(quality, WINDOW, 10.0f, 10.0f);
+	EXPECT_EQ(quality.pick(3), 0);
+}
+
+TEST(quality_lowers_for_predicted_latency) {
+	QualityController quality(options());
+	// Nothing to predict from yet.
+	EXPECT_EQ(quality.pick(100), 0);
+	record(quality, 1, 0.0f, 30.0f);
+	// Four tasks of 30 ms.
+	EXPECT_EQ(quality.pick(2), 0);
+	EXPECT_EQ(quality.pick(3), 1);
+}
+
+// The service time at the last tier says little about the next one, so each
+// step waits for a response at the new tier.
+TEST(quality_lowers_one_tier_per_response) {
+	QualityController quality(options());
+	record(quality, 1, 0.0f, 50.0f);
+	EXPECT_EQ(quality.pick(10), 1);
+	EXPECT_EQ(quality.pick(10), 1);
+	// Rendered before the change.
+	quality.record(0, 0.0f, 50.0f);
+	EXPECT_EQ(quality.pick(10), 1);
+	record(quality, 1, 0.0f, 50.0f);
+	EXPECT_EQ(quality.pick(10), 2);
+	record(quality, 1, 0.0f, 50.0f);
+	EXPECT_EQ(quality.pick(10), 3);
+	// The last one.
+	record(quality, 1, 0.0f, 50.0f);
+	EXPECT_EQ(quality.pick(10), 3);
+}
+
+TEST(quality_lowers_for_percentile_once_settled) {
+	QualityController quality(options());
+	// Waited long, but the queue is empty now.
+	record(quality, SETTLED_COUNT - 1, 200.0f, 1.0f);
+	EXPECT_EQ(quality.pick(0), 0);
+	record(quality, 1, 200.0f, 1.0f);
+	EXPECT_EQ(quality.pick(0), 1);
+}
+
+TEST(quality_raises_once_well_under_target) {
+	QualityController quality(options());
+	record(quality, 1, 0.0f, 50.0f);
+	EXPECT_EQ(quality.pick(10), 1);
+	record(quality, SETTLED_COUNT - 1, 10.0f, 10.0f);
+	EXPECT_EQ(quality.pick(0), 1);
+	record(quality, 1, 10.0f, 10.0f);
+	// Twice the service time must be well under the target too.
+	EXPECT_EQ(quality.pick(2), 1);
+	EXPECT_EQ(quality.pick(0), 0);
+}
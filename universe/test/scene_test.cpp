@@ -0,0 +1,126 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include <common_cpp/test.h>
+#include <universe/scene.h>
+
+#include "test_dir.h"
+
+namespace fs = std::filesystem;
+
+static SceneBuffer test_scene() {
+	SceneBuffer scene;
+	scene.push({1, 2, 3}, 0.5f, {1, 0, 0}, 0.25f);
+	scene.push({-4, 5, -6}, 2.0f, {0, 1, 0}, 0.5f);
+	scene.push({7, -8, 9}, 1.5f, {0, 0, 1}, 0.75f);
+	scene.push_light({10, 0, 0}, 100.0f, {1, 1, 0.5f});
+	scene.push_light({0, -10, 0}, 50.0f, {0.5f, 1, 1});
+	return scene;
+}
+
+static string write_scene(const TestDir &dir) {
+	const string path = (dir.path / "scene.scn").string();
+	SceneFile::write(path, test_scene().columns(), 42);
+	return path;
+}
+
+static bool opens(const string &path) {
+	try {
+		SceneFile file(path);
+		return true;
+	} catch (const std::runtime_error &) {
+		return false;
+	}
+}
+
+TEST(scene_file_round_trips) {
+	TestDir dir("scene_round_trip");
+	const string path = write_scene(dir);
+	const SceneBuffer scene = test_scene();
+	SceneFile file(path);
+	EXPECT_EQ(file.header().version, SceneFile::VERSION);
+	EXPECT_EQ(file.header().seed, uint64_t(42));
+
+	const SceneColumns &columns = file.columns();
+	EXPECT_EQ(columns.count, size_t(3));
+	for (size_t i = 0; i < columns.count; ++i) {
+		EXPECT(columns.positions[i] == scene.positions[i]);
+		EXPECT_EQ(columns.scales[i], scene.scales[i]);
+		EXPECT(columns.colors[i] == scene.colors[i]);
+		EXPECT_EQ(columns.phases[i], scene.phases[i]);
+	}
+	EXPECT_EQ(columns.light_count, size_t(2));
+	for (size_t i = 0; i < columns.light_count; ++i) {
+		EXPECT(columns.lights[i].position == scene.lights[i].position);
+		EXPECT_EQ(columns.lights[i].radius, scene.lights[i].radius);
+		EXPECT(columns.lights[i].color == scene.lights[i].color);
+	}
+}
+
+TEST(scene_file_reads_version_1_without_lights) {
+	TestDir dir("scene_v1");
+	const string path = write_scene(dir);
+	// The version 2 fields stay in the file, but past the header.
+	overwrite(path, offsetof(SceneFileHeader, version), uint32_t(1));
+	overwrite(path, offsetof(SceneFileHeader, header_size), uint32_t(offsetof(SceneFileHeader, light_count)));
+	SceneFile file(path);
+	EXPECT_EQ(file.columns().count, size_t(3));
+	EXPECT_EQ(file.columns().scales[1], 2.0f);
+	EXPECT_EQ(file.columns().light_count, size_t(0));
+	EXPECT(!file.columns().lights);
+}
+
+TEST(scene_file_rejects_bad_header) {
+	TestDir dir("scene_header");
+	const string path = write_scene(dir);
+	EXPECT(opens(path));
+
+	overwrite(path, 0, 'X');
+	EXPECT(!opens(path));
+	overwrite(path, 0, SceneFile::MAGIC[0]);
+	EXPECT(opens(path));
+
+	overwrite(path, offsetof(SceneFileHeader, version), SceneFile::VERSION + 1);
+	EXPECT(!opens(path));
+	overwrite(path, offsetof(SceneFileHeader, version), SceneFile::VERSION);
+
+	overwrite(path, offsetof(SceneFileHeader, header_size), uint32_t(fs::file_size(path) + 1));
+	EXPECT(!opens(path));
+	// Too short for version 2, which has the light fields.
+	overwrite(path, offsetof(SceneFileHeader, header_size), uint32_t(offsetof(SceneFileHeader, light_count)));
+	EXPECT(!opens(path));
+}
+
+TEST(scene_file_rejects_bad_column_offsets) {
+	TestDir dir("scene_columns");
+	const string path = write_scene(dir);
+	const uint64_t file_size = fs::file_size(path);
+	uint64_t scales_offset, lights_offset;
+	{
+		SceneFile file(path);
+		scales_offset = file.header().scales_offset;
+		lights_offset = file.header().lights_offset;
+	}
+
+	overwrite(path, offsetof(SceneFileHeader, scales_offset), scales_offset + 4);
+	EXPECT(!opens(path));
+	// Aligned, but past the end.
+	const uint64_t past_end = (file_size + SceneFile::ALIGNMENT - 1) / SceneFile::ALIGNMENT * SceneFile::ALIGNMENT;
+	overwrite(path, offsetof(SceneFileHeader, scales_offset), past_end);
+	EXPECT(!opens(path));
+	overwrite(path, offsetof(SceneFileHeader, scales_offset), scales_offset);
+	EXPECT(opens(path));
+	// More objects than the columns have room for.
+	overwrite(path, offsetof(SceneFileHeader, object_count), uint64_t(1) << 62);
+	EXPECT(!opens(path));
+	overwrite(path, offsetof(SceneFileHeader, object_count), uint64_t(3));
+
+	overwrite(path, offsetof(SceneFileHeader, lights_offset), lights_offset + SceneFile::ALIGNMENT);
+	EXPECT(!opens(path));
+	overwrite(path, offsetof(SceneFileHeader, lights_offset), lights_offset);
+	overwrite(path, offsetof(SceneFileHeader, light_count), uint64_t(3));
+	EXPECT(!opens(path));
+	overwrite(path, offsetof(SceneFileHeader, light_count), ~uint64_t(0));
+	EXPECT(!opens(path));
+}
@@ -0,0 +1,119 @@
+#include <cstdint>
+#include <vector>
+
+#include <common_cpp/test.h>
+#include <universe/skybox_delta.h>
+
+// 4 by 3 tiles, the last column and row cut off by the edge.
+static constexpr int WIDTH = 100;
+static constexpr int HEIGHT = 70;
+
+static std::vector<uint8_t> gradient() {
+	std::vector<uint8_t> pixels(WIDTH * HEIGHT * 3);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		pixels[i] = (uint8_t)(i * 7);
+	}
+	return pixels;
+}
+
+static void set_pixel(std::vector<uint8_t> &pixels, int x, int y, uint8_t value) {
+	for (int c = 0; c < 3; ++c) {
+		pixels[(y * WIDTH + x) * 3 + c] = value;
+	}
+}
+
+static bool is_tile_set(const SkyboxDelta &delta, int index) {
+	return delta.tile_map[index / 8] & (1 << (index % 8));
+}
+
+TEST(skybox_delta_needs_earlier_image) {
+	SkyboxFrameHistory history;
+	SkyboxDelta delta;
+	EXPECT(!history.push(1, 0, WIDTH, HEIGHT, gradient(), delta));
+	EXPECT(history.contains(1, WIDTH));
+	EXPECT(!history.contains(1, WIDTH + 1));
+	EXPECT(!history.contains(2, WIDTH));
+}
+
+TEST(skybox_delta_sends_changed_tiles) {
+	SkyboxFrameHistory history;
+	SkyboxDelta delta;
+	std::vector<uint8_t> pixels = gradient();
+	history.push(1, 0, WIDTH, HEIGHT, pixels, delta);
+
+	// In tile (1, 0), at (5, 2) within it.
+	set_pixel(pixels, 37, 2, 0xab);
+	EXPECT(history.push(2, 1, WIDTH, HEIGHT, pixels, delta));
+	EXPECT_EQ(delta.tile_size, SkyboxFrameHistory::TILE_SIZE);
+	EXPECT_EQ(delta.changed_tile_count, 1);
+	EXPECT_EQ(delta.tile_map.size(), size_t(2));
+	for (int i = 0; i < 12; ++i) {
+		EXPECT_EQ(is_tile_set(delta, i), i == 1);
+	}
+	const int tile_size = SkyboxFrameHistory::TILE_SIZE;
+	EXPECT_EQ(delta.tile_pixels.size(), size_t(tile_size * tile_size * 3));
+	EXPECT_EQ(delta.tile_pixels[(2 * tile_size + 5) * 3], 0xab);
+	// The rest of the tile is the new image too.
+	EXPECT_EQ(delta.tile_pixels[0], pixels[32 * 3]);
+	EXPECT(history.contains(2, WIDTH));
+	EXPECT(!history.contains(1, WIDTH));
+}
+
+TEST(skybox_delta_pads_edge_tiles) {
+	SkyboxFrameHistory history;
+	SkyboxDelta delta;
+	std::vector<uint8_t> pixels = gradient();
+	history.push(1, 0, WIDTH, HEIGHT, pixels, delta);
+
+	// The last pixel, past the last full 32 bytes of its row.
+	set_pixel(pixels, WIDTH - 1, HEIGHT - 1, 0xcd);
+	EXPECT(history.push(2, 1, WIDTH, HEIGHT, pixels, delta));
+	EXPECT_EQ(delta.changed_tile_count, 1);
+	EXPECT(is_tile_set(delta, 11));
+	const int tile_size = SkyboxFrameHistory::TILE_SIZE;
+	// The tile is 4 by 6 pixels, within a full tile of zeros.
+	EXPECT_EQ(delta.tile_pixels[(5 * tile_size + 3) * 3], 0xcd);
+	EXPECT_EQ(delta.tile_pixels[(5 * tile_size + 4) * 3], 0);
+	EXPECT_EQ(delta.tile_pixels[(6 * tile_size) * 3], 0);
+}
+
+TEST(skybox_delta_resends_after_base_mismatch) {
+	SkyboxFrameHistory history;
+	SkyboxDelta delta;
+	std::vector<uint8_t> pixels = gradient();
+	history.push(1, 0, WIDTH, HEIGHT, pixels, delta);
+
+	set_pixel(pixels, 0, 0, 1);
+	// The client has some other image.
+	EXPECT(!history.push(2, 7, WIDTH, HEIGHT, pixels, delta));
+	// But it has this one now, so the next push is a delta against it.
+	set_pixel(pixels, 0, 0, 2);
+	EXPECT(history.push(3, 2, WIDTH, HEIGHT, pixels, delta));
+	EXPECT_EQ(delta.changed_tile_count, 1);
+	EXPECT(is_tile_set(delta, 0));
+}
+
+TEST(skybox_delta_sends_full_image_when_most_tiles_change) {
+	SkyboxFrameHistory history;
+	SkyboxDelta delta;
+	std::vector<uint8_t> pixels = gradient();
+	history.push(1, 0, WIDTH, HEIGHT, pixels, delta);
+
+	for (int y = 0; y < HEIGHT; y += SkyboxFrameHistory::TILE_SIZE) {
+		for (int x = 0; x < WIDTH; x += SkyboxFrameHistory::TILE_SIZE) {
+			set_pixel(pixels, x, y, 0);
+		}
+	}
+	EXPECT(!history.push(2, 1, WIDTH, HEIGHT, pixels, delta));
+	EXPECT_EQ(delta.changed_tile_count, 12);
+}
+
+TEST(skybox_delta_keeps_sizes_apart) {
+	SkyboxFrameHistory history;
+	SkyboxDelta delta;
+	history.push(1, 0, WIDTH, HEIGHT, gradient(), delta);
+	std::vector<uint8_t> small(32 * 32 * 3, 0);
+	EXPECT(!history.push(2, 1, 32, 32, small, delta));
+	EXPECT(history.contains(1, WIDTH));
+	EXPECT(history.contains(2, 32));
+}
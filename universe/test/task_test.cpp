@@ -0,0 +1,241 @@
+#include <atomic>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <common_cpp/test.h>
+#include <universe/task.h>
+
+TEST(task_queue_admits_up_to_server_limit) {
+	TaskQueue tasks({.max_stream_tasks = 4, .max_server_tasks = 2});
+	EXPECT(tasks.try_admit());
+	EXPECT(tasks.try_admit());
+	EXPECT(!tasks.try_admit());
+
+	// Follow-up steps of admitted tasks go over the limit.
+	tasks.admit();
+	EXPECT(!tasks.try_admit());
+	tasks.release(2);
+	EXPECT(tasks.try_admit());
+	EXPECT(!tasks.try_admit());
+}
+
+TEST(task_queue_admits_exactly_limit_under_contention) {
+	const int limit = 100;
+	TaskQueue tasks({.max_stream_tasks = 4, .max_server_tasks = limit});
+	std::atomic<int> admitted_count = 0;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 8; ++i) {
+		threads.emplace_back([&] {
+			for (int j = 0; j < 1000; ++j) {
+				admitted_count += tasks.try_admit();
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	EXPECT_EQ(admitted_count.load(), limit);
+}
+
+// A stream that isn't bound to a call. gRPC holds its reads and writes back
+// until it would be, so tasks can be fed to the queue directly.
+class TestStream {
+public:
+	TaskReactor *const reactor;
+
+	TestStream(TaskQueue &tasks, int weight)
+			: reactor(new TaskReactor(tasks, weight)) { }
+	~TestStream() { reactor->OnDone(); }
+
+	void add(TaskQueue &tasks, TaskId id) {
+		Task::Request request;
+		request.set_task_id(id);
+		tasks.add(reactor->new_task(request, 0));
+	}
+
+	// Adds a task counted as in flight, as if it was read from the stream.
+	void start(TaskQueue &tasks, TaskId id) {
+		reactor->step_started(id);
+		add(tasks, id);
+	}
+
+	void cancel(TaskId id) {
+		Task::Request request;
+		request.add_cancel_task_ids(id);
+		reactor->cancel(request.cancel_task_ids());
+	}
+};
+
+// Pops count tasks and returns which stream each came from.
+static std::vector<const TaskReactor *> pop_streams(TaskQueue &tasks, int count) {
+	std::vector<const TaskReactor *> streams;
+	for (int i = 0; i < count; ++i) {
+		unique_ptr<Task> task = tasks.pop();
+		if (!task) {
+			break;
+		}
+		streams.push_back(task->lock_reactor().get());
+	}
+	return streams;
+}
+
+TEST(task_queue_serves_streams_by_weight) {
+	TaskQueue tasks({});
+	TestStream a(tasks, 1);
+	TestStream b(tasks, 3);
+	for (int i = 0; i < 10; ++i) {
+		a.add(tasks, i);
+	}
+	for (int i = 0; i < 10; ++i) {
+		b.add(tasks, 100 + i);
+	}
+	EXPECT_EQ(tasks.pending_count(), 20);
+
+	const TaskReactor *A = a.reactor;
+	const TaskReactor *B = b.reactor;
+	const std::vector<const TaskReactor *> expected = {
+		A, B, B, B, A, B, B, B, A, B, B, B, A, B, A, A, A, A, A, A,
+	};
+	EXPECT(pop_streams(tasks, 21) == expected);
+	EXPECT_EQ(tasks.pending_count(), 0);
+}
+
+TEST(task_queue_keeps_order_within_stream) {
+	TaskQueue tasks({});
+	TestStream a(tasks, 2);
+	for (int i = 1; i <= 5; ++i) {
+		a.add(tasks, i);
+	}
+	for (TaskId id = 1; id <= 5; ++id) {
+		EXPECT_EQ(tasks.pop()->id(), id);
+	}
+	EXPECT(!tasks.pop());
+}
+
+// A light stream waits for at most one turn of a heavy stream that saturates
+// the queue, however many tasks the heavy one has queued.
+TEST(task_queue_bounds_latency_of_light_stream) {
+	const int heavy_weight = 4;
+	TaskQueue tasks({});
+	TestStream heavy(tasks, heavy_weight);
+	TestStream light(tasks, 1);
+	for (int i = 0; i < 1000; ++i) {
+		heavy.add(tasks, i);
+	}
+
+	for (int round = 0; round < 20; ++round) {
+		// Arrives at various points of the heavy stream's turn.
+		pop_streams(tasks, round % (heavy_weight + 1));
+		light.add(tasks, 10'000 + round);
+		int wait = 0;
+		while (tasks.pop()->lock_reactor().get() != light.reactor) {
+			++wait;
+		}
+		EXPECT(wait <= heavy_weight);
+	}
+	EXPECT(tasks.pending_count() > 0);
+}
+
+TEST(task_queue_removes_stream) {
+	TaskQueue tasks({});
+	TestStream a(tasks, 1);
+	{
+		TestStream b(tasks, 1);
+		a.add(tasks, 1);
+		b.add(tasks, 2);
+		b.add(tasks, 3);
+		a.add(tasks, 4);
+		EXPECT_EQ(tasks.remove_stream(b.reactor), 2);
+	}
+	EXPECT_EQ(tasks.pop()->id(), TaskId(1));
+	EXPECT_EQ(tasks.pop()->id(), TaskId(4));
+	EXPECT(!tasks.pop());
+}
+
+TEST(task_cancel_removes_pending_task) {
+	TaskQueue tasks({.max_server_tasks = 3});
+	TestStream stream(tasks, 1);
+	for (TaskId id = 1; id <= 3; ++id) {
+		stream.start(tasks, id);
+	}
+	EXPECT(!tasks.try_admit());
+
+	stream.cancel(2);
+	EXPECT_EQ(tasks.pending_count(), 2);
+	EXPECT_EQ(tasks.stats.cancelled_pending.load(), int64_t(1));
+	EXPECT(tasks.try_admit());
+	EXPECT(!tasks.try_admit());
+	EXPECT_EQ(tasks.pop()->id(), TaskId(1));
+	EXPECT_EQ(tasks.pop()->id(), TaskId(3));
+	EXPECT(!tasks.pop());
+}
+
+TEST(task_cancel_marks_task_in_progress) {
+	TaskQueue tasks({.max_server_tasks = 2});
+	TestStream stream(tasks, 1);
+	stream.start(tasks, 1);
+	stream.start(tasks, 2);
+	unique_ptr<Task> task = tasks.pop();
+	EXPECT_EQ(task->id(), TaskId(1));
+
+	stream.cancel(1);
+	EXPECT(task->is_cancelled());
+	EXPECT_EQ(tasks.stats.cancelled_pending.load(), int64_t(0));
+	EXPECT_EQ(tasks.pending_count(), 1);
+	EXPECT(!tasks.pop()->is_cancelled());
+
+	// Its response is discarded, and the admission released.
+	EXPECT(!tasks.try_admit());
+	Task::done(std::move(task));
+	EXPECT(tasks.try_admit());
+	EXPECT(!tasks.try_admit());
+}
+
+TEST(task_stream_end_releases_its_tasks) {
+	TaskQueue tasks({.max_server_tasks = 3});
+	TaskReactor *reactor = new TaskReactor(tasks, 1);
+	Task::Request request;
+	for (TaskId id = 1; id <= 3; ++id) {
+		request.set_task_id(id);
+		reactor->step_started(id);
+		tasks.add(reactor->new_task(request, 0));
+	}
+	unique_ptr<Task> in_progress = tasks.pop();
+	EXPECT(!tasks.try_admit());
+
+	reactor->OnDone();
+	EXPECT_EQ(tasks.pending_count(), 0);
+	EXPECT_EQ(tasks.stats.cancelled_pending.load(), int64_t(2));
+	EXPECT(in_progress->is_cancelled());
+	Task::done(std::move(in_progress));
+	for (int i = 0; i < 3; ++i) {
+		EXPECT(tasks.try_admit());
+	}
+	EXPECT(!tasks.try_admit());
+}
+
+TEST(task_id_counts_match_map) {
+	TaskIdCounts counts(8);
+	std::unordered_map<TaskId, int> expected;
+	std::mt19937 random(1);
+	for (int i = 0; i < 100'000; ++i) {
+		// Few enough IDs to collide a lot, and sometimes more than it was sized
+		// for, so that it grows.
+		const TaskId id = random() % (i < 50'000 ? 24 : 64);
+		if (random() % 2) {
+			counts.increment(id);
+			++expected[id];
+		} else {
+			auto it = expected.find(id);
+			const int left = it == expected.end() ? 0 : --it->second;
+			if (it != expected.end() && left == 0) {
+				expected.erase(it);
+			}
+			EXPECT_EQ(counts.decrement(id), left);
+		}
+		const TaskId probe = random() % 64;
+		EXPECT_EQ(counts.contains(probe), expected.contains(probe));
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <system_error>
+
+#include <universe/common.h>
+
+// Directory of its own for each test, deleted afterwards.
+class TestDir {
+public:
+	const std::filesystem::path path;
+
+	TestDir(const string &name)
+			: path(std::filesystem::temp_directory_path() / ("spejs_" + name + "_" + to_string(std::random_device()()))) {
+		std::filesystem::create_directories(path);
+	}
+	~TestDir() {
+		std::error_code error;
+		std::filesystem::remove_all(path, error);
+	}
+};
+
+// Overwrites the bytes of the value at the offset in the file, e.g. to corrupt
+// a field of a header.
+template <class T>
+void overwrite(const std::filesystem::path &path, uint64_t offset, const T &value) {
+	std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+	file.seekp(offset);
+	file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
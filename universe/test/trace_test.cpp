@@ -0,0 +1,30 @@
+#include <string>
+#include <thread>
+
+#include <common_cpp/test.h>
+#include <universe/trace.h>
+
+static int count_of(const string &s, const string &part) {
+	int count = 0;
+	for (size_t i = s.find(part); i != string::npos; i = s.find(part, i + 1)) {
+		++count;
+	}
+	return count;
+}
+
+TEST(trace_reuses_buffers_of_exited_threads) {
+	trace::set_enabled(true);
+	for (int i = 0; i < 10; ++i) {
+		std::thread([i] {
+			trace::set_thread_name("trace_test_" + to_string(i));
+			trace::Span span("trace_test_span");
+		}).join();
+	}
+	const string json = trace::dump_json(/* clear */ true);
+	trace::set_enabled(false);
+	// Each thread took the buffer over from the one before, so only the events
+	// of the last one are left, but those are, even though it exited.
+	EXPECT_EQ(count_of(json, "trace_test_span"), 1);
+	EXPECT_EQ(count_of(json, "trace_test_"), 2);
+	EXPECT(json.find("trace_test_9") != string::npos);
+}
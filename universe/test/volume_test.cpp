@@ -0,0 +1,187 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <common_cpp/test.h>
+#include <universe/volume.h>
+
+#include "test_dir.h"
+
+namespace fs = std::filesystem;
+
+static std::byte voxel_byte(const glm::ivec3 &coords, size_t i) {
+	return std::byte(coords.x * 31 + coords.y * 7 + coords.z * 3 + i);
+}
+
+// Writes a volume of the grid size, with every brick except those at an odd x,
+// which are empty.
+static string write_volume(const TestDir &dir, const glm::ivec3 &grid_size, uint32_t brick_size) {
+	const string path = (dir.path / "volume.vol").string();
+	VolumeFileHeader header = {};
+	header.grid_size = grid_size;
+	header.brick_size = brick_size;
+	header.origin = glm::vec3(0.0f, 0.0f, 0.0f);
+	header.voxel_size = 1;
+	const size_t brick_bytes = VolumeFile::brick_bytes(brick_size);
+	VolumeFile::write(path, header, [&](const glm::ivec3 &coords, std::byte *voxels) {
+		for (size_t i = 0; i < brick_bytes; ++i) {
+			voxels[i] = voxel_byte(coords, i);
+		}
+		return coords.x % 2 == 0;
+	});
+	return path;
+}
+
+static bool opens(const string &path) {
+	try {
+		VolumeFile file(path);
+		return true;
+	} catch (const std::runtime_error &) {
+		return false;
+	}
+}
+
+TEST(volume_file_round_trips) {
+	TestDir dir("volume_round_trip");
+	const string path = write_volume(dir, glm::ivec3(4, 2, 3), 2);
+	VolumeFile file(path);
+	EXPECT_EQ(file.header().grid_size.x, 4);
+	EXPECT_EQ(file.header().grid_size.y, 2);
+	EXPECT_EQ(file.header().grid_size.z, 3);
+	EXPECT_EQ(file.header().brick_size, uint32_t(2));
+	EXPECT_EQ(file.header().voxel_size, 1.0f);
+	EXPECT_EQ(file.brick_bytes(), size_t(4 * 4 * 4 * 4));
+
+	// Half the bricks, in the order they were written.
+	EXPECT_EQ(file.bricks().size(), size_t(12));
+	std::vector<std::byte> voxels(file.brick_bytes());
+	size_t index = 0;
+	for (int z = 0; z < 3; ++z) {
+		for (int y = 0; y < 2; ++y) {
+			for (int x = 0; x < 4; x += 2, ++index) {
+				const VolumeBrickEntry &entry = file.bricks()[index];
+				EXPECT_EQ(entry.coords.x, x);
+				EXPECT_EQ(entry.coords.y, y);
+				EXPECT_EQ(entry.coords.z, z);
+				EXPECT_EQ(entry.offset % VolumeFile::ALIGNMENT, uint64_t(0));
+				file.read_brick(index, voxels.data());
+				for (size_t i = 0; i < voxels.size(); ++i) {
+					EXPECT(voxels[i] == voxel_byte(entry.coords, i));
+				}
+			}
+		}
+	}
+}
+
+TEST(volume_file_rejects_truncated_file) {
+	TestDir dir("volume_truncated");
+	const string path = write_volume(dir, glm::ivec3(2, 1, 1), 2);
+	EXPECT(opens(path));
+	// Cuts into the brick table.
+	fs::resize_file(path, fs::file_size(path) - 1);
+	EXPECT(!opens(path));
+	fs::resize_file(path, sizeof(VolumeFileHeader) - 1);
+	EXPECT(!opens(path));
+}
+
+TEST(volume_file_rejects_brick_outside_grid) {
+	TestDir dir("volume_outside");
+	const string path = write_volume(dir, glm::ivec3(2, 1, 1), 2);
+	const uint64_t bricks_offset = VolumeFile(path).header().bricks_offset;
+	overwrite(path, bricks_offset + offsetof(VolumeBrickEntry, coords), glm::ivec3(0, 1, 0));
+	EXPECT(!opens(path));
+	overwrite(path, bricks_offset + offsetof(VolumeBrickEntry, coords), glm::ivec3(-1, 0, 0));
+	EXPECT(!opens(path));
+}
+
+TEST(volume_file_rejects_bad_header_size) {
+	TestDir dir("volume_header_size");
+	const string path = write_volume(dir, glm::ivec3(2, 1, 1), 2);
+	overwrite(path, offsetof(VolumeFileHeader, header_size), uint32_t(sizeof(VolumeFileHeader) - 4));
+	EXPECT(!opens(path));
+	overwrite(path, offsetof(VolumeFileHeader, header_size), uint32_t(fs::file_size(path) + 1));
+	EXPECT(!opens(path));
+	overwrite(path, offsetof(VolumeFileHeader, header_size), uint32_t(sizeof(VolumeFileHeader)));
+	EXPECT(opens(path));
+}
+
+TEST(volume_file_rejects_oversized_bricks) {
+	TestDir dir("volume_brick_size");
+	const string path = write_volume(dir, glm::ivec3(2, 1, 1), 2);
+	overwrite(path, offsetof(VolumeFileHeader, brick_size), VolumeFile::MAX_BRICK_SIZE + 1);
+	EXPECT(!opens(path));
+	// (2^22)^3 * 4 bytes per brick wraps around to 0, which any bounds check
+	// passes.
+	overwrite(path, offsetof(VolumeFileHeader, brick_size), (uint32_t(1) << 22) - 2);
+	EXPECT(!opens(path));
+}
+
+TEST(bricked_volume_rejects_budget_without_slots) {
+	TestDir dir("volume_budget");
+	// A megabyte per brick.
+	const string path = write_volume(dir, glm::ivec3(1, 1, 1), 62);
+	bool is_rejected = false;
+	try {
+		BrickedVolume volume({.path = path, .budget_mb = 0});
+	} catch (const std::runtime_error &) {
+		is_rejected = true;
+	}
+	EXPECT(is_rejected);
+	BrickedVolume volume({.path = path, .budget_mb = 1});
+	EXPECT_EQ(volume.slot_count(), 1);
+}
+
+// Uploads and evictions, by slot and brick x, in the order they happen.
+struct VolumeEvents {
+	std::vector<std::pair<int, int>> uploads;
+	std::vector<std::pair<int, int>> evictions;
+};
+
+// Updates until the loader has handed over as many uploads in total, as it
+// reads the bricks in the background.
+static void update_until(BrickedVolume &volume, VolumeEvents &events, size_t upload_count) {
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (events.uploads.size() < upload_count && std::chrono::steady_clock::now() < deadline) {
+		volume.update(
+				[&](int slot, const glm::ivec3 &coords, const std::byte *) { events.uploads.emplace_back(slot, coords.x); },
+				[&](int slot, const glm::ivec3 &coords) { events.evictions.emplace_back(slot, coords.x); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+TEST(bricked_volume_evicts_farthest_brick) {
+	TestDir dir("volume_evict");
+	// Bricks of a megabyte in a row along x, every other one present: 62 voxels
+	// wide, centered at x = 31, 155, 279 and 403.
+	const string path = write_volume(dir, glm::ivec3(8, 1, 1), 62);
+	const auto center = [](int x) { return glm::vec3(62.0f * x + 31, 31.0f, 31.0f); };
+	BrickedVolume volume({.path = path, .budget_mb = 2, .load_radius = 1, .recent_position_count = 1});
+	EXPECT_EQ(volume.slot_count(), 2);
+	VolumeEvents events;
+
+	volume.focus(center(2));
+	update_until(volume, events, 1);
+	volume.focus(center(0));
+	update_until(volume, events, 2);
+	EXPECT_EQ(volume.resident_count(), 2);
+	EXPECT(events.evictions.empty());
+
+	// Brick 0 arrived last, but is the farthest from the recent position.
+	volume.focus(center(4));
+	update_until(volume, events, 3);
+	const std::vector<std::pair<int, int>> expected_uploads = {{0, 2}, {1, 0}, {1, 4}};
+	std::vector<std::pair<int, int>> expected_evictions = {{1, 0}};
+	EXPECT(events.uploads == expected_uploads);
+	EXPECT(events.evictions == expected_evictions);
+
+	volume.focus(center(6));
+	update_until(volume, events, 4);
+	expected_evictions.emplace_back(0, 2);
+	EXPECT(events.evictions == expected_evictions);
+	EXPECT(events.uploads.back() == std::make_pair(0, 6));
+	EXPECT_EQ(volume.resident_count(), 2);
+}
@@ -0,0 +1,145 @@
+#include <cmath>
+#include <map>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <common_cpp/test.h>
+#include <universe/world.h>
+
+typedef std::tuple<int, int, int> ChunkCoords;
+
+static constexpr float CHUNK_SIZE = 64.0f;
+
+static WorldOptions test_options(int max_chunks, int load_radius) {
+	return {
+		.max_chunks = max_chunks,
+		.seed = 7,
+		.chunk_size = CHUNK_SIZE,
+		.objects_per_chunk = 16,
+		.load_radius = load_radius,
+		.recent_position_count = 1,
+		.thread_count = 2,
+	};
+}
+
+static glm::vec3 chunk_center(int x, int y = 0, int z = 0) {
+	return (glm::vec3((float)x, (float)y, (float)z) + 0.5f) * CHUNK_SIZE;
+}
+
+// Objects lie within their chunk, which tells which one an upload is of.
+static ChunkCoords chunk_of(const SceneBuffer &objects) {
+	const glm::vec3 &p = objects.positions[0];
+	return {(int)std::floor(p.x / CHUNK_SIZE), (int)std::floor(p.y / CHUNK_SIZE), (int)std::floor(p.z / CHUNK_SIZE)};
+}
+
+// Records the uploads, and which chunk each slot holds.
+struct WorldUploads {
+	std::vector<std::pair<int, ChunkCoords>> uploads;
+	std::map<int, ChunkCoords> slots;
+	std::map<ChunkCoords, std::vector<glm::vec3>> positions;
+
+	ChunkedWorld::UploadFunction function() {
+		return [this](int slot, const SceneBuffer &objects) {
+			const ChunkCoords coords = chunk_of(objects);
+			uploads.emplace_back(slot, coords);
+			slots[slot] = coords;
+			positions[coords] = objects.positions;
+		};
+	}
+
+	// Chunks of the resident slots.
+	std::set<ChunkCoords> resident(ChunkedWorld &world) const {
+		std::set<ChunkCoords> chunks;
+		for (const ChunkedWorld::ResidentChunk &chunk : world.resident_chunks()) {
+			chunks.insert(slots.at(chunk.slot));
+		}
+		return chunks;
+	}
+};
+
+static std::set<ChunkCoords> chunks_around(int x, int radius) {
+	std::set<ChunkCoords> chunks;
+	for (int dx = -radius; dx <= radius; ++dx) {
+		for (int dy = -radius; dy <= radius; ++dy) {
+			for (int dz = -radius; dz <= radius; ++dz) {
+				if (dx * dx + dy * dy + dz * dz <= radius * radius) {
+					chunks.insert({x + dx, dy, dz});
+				}
+			}
+		}
+	}
+	return chunks;
+}
+
+TEST(world_generates_same_chunk_every_time) {
+	WorldUploads a, b;
+	{
+		ChunkedWorld world(test_options(64, 1));
+		world.load_around(chunk_center(0), a.function());
+	}
+	{
+		ChunkedWorld world(test_options(64, 1));
+		world.load_around(chunk_center(0), b.function());
+	}
+	EXPECT_EQ(a.positions.size(), size_t(7));
+	EXPECT(a.positions == b.positions);
+	// But each chunk differently.
+	EXPECT(a.positions[ChunkCoords(0, 0, 0)] != a.positions[ChunkCoords(1, 0, 0)]);
+
+	WorldUploads other_seed;
+	WorldOptions options = test_options(64, 1);
+	options.seed = 8;
+	ChunkedWorld world(options);
+	world.load_around(chunk_center(0), other_seed.function());
+	EXPECT(a.positions[ChunkCoords(0, 0, 0)] != other_seed.positions[ChunkCoords(0, 0, 0)]);
+}
+
+TEST(world_evicts_farthest_chunk) {
+	ChunkedWorld world(test_options(2, 0));
+	WorldUploads uploads;
+	world.load_around(chunk_center(5), uploads.function());
+	world.load_around(chunk_center(0), uploads.function());
+	// Chunk 0 arrived last, but is the farthest from chunk 4.
+	world.load_around(chunk_center(4), uploads.function());
+	// Then chunk 4 is the farther from chunk 9, though chunk 5 is the oldest.
+	world.load_around(chunk_center(9), uploads.function());
+
+	const std::vector<std::pair<int, ChunkCoords>> expected = {
+		{0, {5, 0, 0}},
+		{1, {0, 0, 0}},
+		{1, {4, 0, 0}},
+		{1, {9, 0, 0}},
+	};
+	EXPECT(uploads.uploads == expected);
+	const std::set<ChunkCoords> expected_resident = {{5, 0, 0}, {9, 0, 0}};
+	EXPECT(uploads.resident(world) == expected_resident);
+}
+
+TEST(world_load_around_waits_for_all_chunks) {
+	const int radius = 2;
+	// Exactly the chunks within the radius, so that each load evicts the last.
+	const int chunk_count = chunks_around(0, radius).size();
+	ChunkedWorld world(test_options(chunk_count, radius));
+	WorldUploads uploads;
+	for (int x : {0, 10, 1}) {
+		world.load_around(chunk_center(x), uploads.function());
+		EXPECT(uploads.resident(world) == chunks_around(x, radius));
+		for (const ChunkedWorld::ResidentChunk &chunk : world.resident_chunks()) {
+			EXPECT_EQ(chunk.count, 16);
+		}
+	}
+}
+
+TEST(world_has_no_chunks_out_of_bounds) {
+	const int limit = ChunkedWorld::COORD_LIMIT;
+	ChunkedWorld world(test_options(8, 0));
+	WorldUploads uploads;
+	world.load_around(chunk_center(-limit), uploads.function());
+	// Would have the same key as the chunk at -limit, if it was loaded.
+	world.load_around(chunk_center(limit), uploads.function());
+	world.load_around(glm::vec3(1e30f, 0.0f, 0.0f), uploads.function());
+	const std::vector<std::pair<int, ChunkCoords>> expected = {{0, {-limit, 0, 0}}};
+	EXPECT(uploads.uploads == expected);
+}
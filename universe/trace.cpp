@@ -0,0 +1,173 @@
+#include "trace.h"
+
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+// Per thread, so 2 MB for a thread that records at all.
+constexpr size_t EVENTS_PER_THREAD = 1 << 16;
+
+struct Event {
+	const char *name;
+	uint64_t task_id;
+	Clock::time_point begin;
+	Clock::time_point end;
+};
+
+struct ThreadBuffer {
+	// Only ever contended by dump_json() and by a thread taking it over.
+	std::mutex mut;
+	int tid;
+	string name;
+	// Ring of events, allocated on the first one. Once full, next is the oldest.
+	std::vector<Event> events;
+	size_t next = 0;
+};
+
+// Timestamps are relative to the start of the process.
+const Clock::time_point EPOCH = Clock::now();
+
+std::mutex registry_mut;
+// Buffers of all the threads that recorded, kept past the thread exiting so
+// that its events still get dumped, until another thread takes it over.
+std::vector<shared_ptr<ThreadBuffer>> registry;
+// Buffers of the exited threads, so that threads coming and going, like those
+// of the gRPC pool, don't take another 2 MB each.
+std::vector<shared_ptr<ThreadBuffer>> free_buffers;
+int last_tid = 0;
+
+// Frees the buffer of the thread when it exits.
+struct LocalBuffer {
+	shared_ptr<ThreadBuffer> buffer;
+
+	~LocalBuffer() {
+		if (buffer) {
+			std::lock_guard<std::mutex> lock(registry_mut);
+			free_buffers.push_back(std::move(buffer));
+		}
+	}
+};
+
+thread_local LocalBuffer local_buffer;
+
+ThreadBuffer &get_local_buffer() {
+	shared_ptr<ThreadBuffer> &buffer = local_buffer.buffer;
+	if (!buffer) {
+		std::lock_guard<std::mutex> lock(registry_mut);
+		if (free_buffers.empty()) {
+			buffer = std::make_shared<ThreadBuffer>();
+			registry.push_back(buffer);
+		} else {
+			buffer = std::move(free_buffers.back());
+			free_buffers.pop_back();
+		}
+		// A new thread on the timeline. The events of the exited thread go, but
+		// their memory is kept.
+		std::lock_guard<std::mutex> buffer_lock(buffer->mut);
+		buffer->tid = ++last_tid;
+		buffer->name.clear();
+		buffer->events.clear();
+		buffer->next = 0;
+	}
+	return *buffer;
+}
+
+int64_t to_us(Clock::time_point time) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(time - EPOCH).count();
+}
+
+void write_json_string(std::ostream &out, const string_view &s) {
+	out << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			out << '\\';
+		}
+		out << c;
+	}
+	out << '"';
+}
+
+}  // namespace
+
+namespace detail {
+
+std::atomic<bool> is_enabled = false;
+thread_local uint64_t task_id = 0;
+
+void record(const char *name, uint64_t task_id, Clock::time_point begin, Clock::time_point end) {
+	ThreadBuffer &buffer = get_local_buffer();
+	std::lock_guard<std::mutex> lock(buffer.mut);
+	const Event event = {.name = name, .task_id = task_id, .begin = begin, .end = end};
+	if (buffer.events.size() < EVENTS_PER_THREAD) {
+		if (buffer.events.empty()) {
+			buffer.events.reserve(EVENTS_PER_THREAD);
+		}
+		buffer.events.push_back(event);
+	} else {
+		buffer.events[buffer.next] = event;
+		buffer.next = (buffer.next + 1) % EVENTS_PER_THREAD;
+	}
+}
+
+}  // namespace detail
+
+void set_enabled(bool enabled) {
+	detail::is_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void set_thread_name(const string &name) {
+	ThreadBuffer &buffer = get_local_buffer();
+	std::lock_guard<std::mutex> lock(buffer.mut);
+	buffer.name = name;
+}
+
+string dump_json(bool clear) {
+	std::vector<shared_ptr<ThreadBuffer>> buffers;
+	{
+		std::lock_guard<std::mutex> lock(registry_mut);
+		buffers = registry;
+	}
+
+	std::ostringstream out;
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool is_first = true;
+	auto begin_event = [&]() -> std::ostream & {
+		out << (is_first ? "\n" : ",\n");
+		is_first = false;
+		return out;
+	};
+	for (const shared_ptr<ThreadBuffer> &buffer : buffers) {
+		std::lock_guard<std::mutex> lock(buffer->mut);
+		if (!buffer->name.empty()) {
+			begin_event() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+										<< ",\"args\":{\"name\":";
+			write_json_string(out, buffer->name);
+			out << "}}";
+		}
+		const size_t count = buffer->events.size();
+		for (size_t i = 0; i < count; ++i) {
+			const Event &event = buffer->events[(buffer->next + i) % count];
+			const int64_t begin_us = to_us(event.begin);
+			begin_event() << "{\"name\":";
+			write_json_string(out, event.name);
+			out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << begin_us
+					<< ",\"dur\":" << to_us(event.end) - begin_us;
+			if (event.task_id) {
+				out << ",\"args\":{\"task_id\":" << event.task_id << "}";
+			}
+			out << "}";
+		}
+		if (clear) {
+			buffer->events.clear();
+			buffer->next = 0;
+		}
+	}
+	out << "\n]}\n";
+	return out.str();
+}
+
+}  // namespace trace
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "common.h"
+
+// Records spans of the work done for tasks, like reading a request, rendering a
+// cubemap face or writing a response, to be viewed on a timeline in
+// chrome://tracing or Perfetto.
+//
+// Each thread records into a ring buffer of its own, so recording never waits
+// on another thread, and only the latest events of a thread are kept. While
+// tracing is disabled, which it is by default, a span costs a relaxed atomic
+// load, so the spans can stay in production builds.
+namespace trace {
+
+typedef std::chrono::steady_clock Clock;
+
+namespace detail {
+
+extern std::atomic<bool> is_enabled;
+extern thread_local uint64_t task_id;
+
+void record(const char *name, uint64_t task_id, Clock::time_point begin, Clock::time_point end);
+
+}  // namespace detail
+
+inline bool is_enabled() {
+	return detail::is_enabled.load(std::memory_order_relaxed);
+}
+
+// Starts or stops recording. Events recorded so far are kept either way.
+void set_enabled(bool enabled);
+
+// Names the calling thread on the timeline.
+void set_thread_name(const string &name);
+
+// Task the spans of the calling thread are tagged with, 0 if none.
+inline uint64_t current_task_id() {
+	return detail::task_id;
+}
+
+// Current time if tracing is enabled, to record() a span from later, and the
+// zero time point otherwise.
+inline Clock::time_point now() {
+	return is_enabled() ? Clock::now() : Clock::time_point();
+}
+
+// Records a span that already ended, e.g. one that began on another thread.
+// Skipped if it began at the zero time point. The name must outlive the trace,
+// e.g. be a literal.
+inline void record(const char *name, uint64_t task_id, Clock::time_point begin, Clock::time_point end) {
+	if (is_enabled() && begin != Clock::time_point()) {
+		detail::record(name, task_id, begin, end);
+	}
+}
+
+// Returns the recorded events as Chrome trace event JSON. If clear, they are
+// dropped after.
+string dump_json(bool clear = false);
+
+// Tags the spans of the calling thread with the task, until destroyed.
+class TaskScope {
+	const uint64_t previous_task_id;
+
+public:
+	explicit TaskScope(uint64_t task_id)
+			: previous_task_id(detail::task_id) {
+		detail::task_id = task_id;
+	}
+	TaskScope(const TaskScope &) = delete;
+	~TaskScope() { detail::task_id = previous_task_id; }
+};
+
+// Records a span from construction to destruction, tagged with the current
+// task. Whether it is recorded is decided up front, so that a span never ends
+// up half-timed. The name must outlive the trace, e.g. be a literal.
+class Span {
+	const char *const name;
+	const uint64_t task_id;
+	const bool is_recording;
+	Clock::time_point begin;
+
+public:
+	explicit Span(const char *name)
+			: name(name), task_id(detail::task_id), is_recording(is_enabled()) {
+		if (is_recording) {
+			begin = Clock::now();
+		}
+	}
+	Span(const Span &) = delete;
+	~Span() {
+		if (is_recording) {
+			detail::record(name, task_id, begin, Clock::now());
+		}
+	}
+};
+
+}  // namespace trace
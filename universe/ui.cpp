@@ -1,31 +1,45 @@
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
 #include <cstdlib>
+#include <numbers>
 
-#include <qoi.h>
+#include <common_cpp/log.h>
+#include <common_cpp/pixels.h>
 
 #include "proto.h"
 #include "rpc.h"
 #include "shaders.h"
 #include "skybox.h"
 #include "task.h"
+#include "trace.h"
 #include "ui.h"
 
 // GLFW must be after OpenGL
 #include <GLFW/glfw3.h>
 
-glm::vec3 light0_offset = {0, 0, -1};
-glm::vec3 light1_offset = {5, -5, -5};
+// Lights that move along with the camera, on top of the lights of the scene.
+// The positions are relative to the camera.
+const SceneLight CAMERA_LIGHTS[] = {
+	{.position = {0.0f, 0.0f, -1.0f}, .radius = 60.0f, .color = {0.9f, 0.9f, 0.3f}},
+	{.position = {5.0f, -5.0f, -5.0f}, .radius = 60.0f, .color = {0.4f, 0.4f, 0.8f}},
+};
 
-UI::UI(TaskQueue &tasks)
-		: tasks(tasks) {
+UI::UI(TaskQueue &tasks, const SceneColumns &scene, const LodOptions &lod_options, const WorldOptions &world_options, const VolumeOptions &volume_options, const SkyboxPrefetchOptions &prefetch_options, const AssetStoreOptions &asset_options, const QualityOptions &quality_options)
+		: tasks(tasks), quality(quality_options), assets(asset_options), skybox_prefetcher(prefetch_options, tasks.stats), scene(scene), lod_options(lod_options) {
 	if (!glfwInit()) {
 		throw std::runtime_error("Failed to initialize GLFW");
 	}
+	if (world_options.max_chunks > 0) {
+		world = make_unique<ChunkedWorld>(world_options);
+	}
+	if (!volume_options.path.empty()) {
+		volume = make_unique<BrickedVolume>(volume_options);
+	}
 }
 
 UI::~UI() {
-	if (skybox_pixels) {
-		delete[] skybox_pixels;
-	}
 	glfwTerminate();
 }
 
@@ -38,23 +52,11 @@ UI *ui(GLFWwindow *window) {
 	return static_cast<UI *>(glfwGetWindowUserPointer(window));
 }
 
-float randf(float min, float max) {
-	float t = (float)std::rand() / RAND_MAX;
-	return (1 - t) * min + t * max;
-}
-
-float randf() {
-	return randf(0, 1);
-}
-
-float randsgn() {
-	return std::rand() % 2 == 0 ? -1.0f : 1.0f;
-}
-
 void UI::event_loop(const RpcServer *rpc_server) {
 	if (window) {
 		throw std::runtime_error("Event loop already running");
 	}
+	trace::set_thread_name("render");
 
 	const int width = 1600;
 	const int height = 1200;
@@ -97,105 +99,55 @@ void UI::event_loop(const RpcServer *rpc_server) {
 
 	const auto &s = shaders.solid_program;
 	glUseProgram(s.program_id);
-	glm::mat4 m = glm::identity<glm::mat4>();
-	m = glm::translate(m, {0, 0, -10});
-	std::cout << glm::to_string(m) << std::endl;
 	s.ambient_color = {0.2, 0.2, 0.2};
-	s.light0_color = {0.9, 0.9, 0.3};
-	s.light0_position = light0_offset;
-	s.light1_color = {0.4, 0.4, 0.8};
-	s.light1_position = light1_offset;
 
 	cube_vertices.bind([&](auto builder, auto base) {
 		builder.enable_attribute(s.position, base->position);
 		builder.enable_attribute(s.normal, base->normal);
 	});
 
+	const auto &pp = shaders.point_program;
+	glUseProgram(pp.program_id);
+	pp.ambient_color = {0.2, 0.2, 0.2};
+
 	glEnable(GL_CULL_FACE);
 	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_PROGRAM_POINT_SIZE);
 
 	glfwSetWindowUserPointer(window, this);
 	glfwSetKeyCallback(window, [](GLFWwindow *window, int key, int scancode, int action, int mods) {
 		ui(window)->on_key(key, scancode, action, mods);
 	});
 
-	int skybox_size = 512;
-	gl_error_guard(glCreateFramebuffers(1, &skybox_framebuffer));
-	GLuint skybox_renderbuffers[2];
-	gl_error_guard(glCreateRenderbuffers(2, skybox_renderbuffers));
-	GLuint skybox_color_renderbuffer = skybox_renderbuffers[0];
-	gl_error_guard(glNamedRenderbufferStorage(skybox_color_renderbuffer, GL_RGB8, skybox_size, skybox_size));
-	GLuint skybox_depth_renderbuffer = skybox_renderbuffers[1];
-	gl_error_guard(glNamedRenderbufferStorage(skybox_depth_renderbuffer, GL_DEPTH_COMPONENT24, skybox_size, skybox_size));
-	gl_error_guard(glNamedFramebufferRenderbuffer(skybox_framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, skybox_color_renderbuffer));
-	gl_error_guard(glNamedFramebufferRenderbuffer(skybox_framebuffer, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, skybox_depth_renderbuffer));
-	GLenum status = glCheckNamedFramebufferStatus(skybox_framebuffer, GL_FRAMEBUFFER);
-	std::cout << "Skybox framebuffer status: " << gl::enum_string(status) << std::endl;
+	// Rows of tightly packed RGB skybox pixels are not 4-byte aligned in
+	// general, e.g. the smallest mip levels.
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
 	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, (GLint *)&default_frmaebuffer);
-	std::cout << "Default framebuffer: " << default_frmaebuffer << std::endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, skybox_framebuffer);
-
-	skybox_pixels = new uint8_t[6 * skybox_size * skybox_size * 3];
-
-	CubeInstance cube;
-	cube.phase = 0.0f;
-	cube.scale = 1.0f;
-
-	cube.position = {1.0f, 0.0f, 0.0f};
-	cube.color = {1.0f, 0.0f, 0.0f};
-	cubes.push_back(cube);
-	cube.position = {-1.0f, 0.0f, 0.0f};
-	cube.color = {0.5f, 0.5f, 0.0f};
-	cubes.push_back(cube);
-	cube.position = {0.0f, 1.0f, 0.0f};
-	cube.color = {0.0f, 1.0f, 0.0f};
-	cubes.push_back(cube);
-	cube.position = {0.0f, -1.0f, 0.0f};
-	cube.color = {0.0f, 0.5f, 0.5f};
-	cubes.push_back(cube);
-	cube.position = {0.0f, 0.0f, 1.0f};
-	cube.color = {0.0f, 0.0f, 1.0f};
-	cubes.push_back(cube);
-	cube.position = {0.0f, 0.0f, -1.0f},
-	cube.color = {0.5f, 0.0f, 0.5f};
-	cubes.push_back(cube);
-
-	cube.phase = 1.0f;
-	cube.scale = 0.2f;
-	for (int i = 0; i < 6; ++i) {
-		glm::vec3 p0 = cubes[i].position;
-		for (int j = 0; j < 6; ++j) {
-			auto const &c1 = cubes[j];
-			cube.position = p0 + 0.15f * c1.position;
-			cube.color = 0.9f * c1.color;
-			cubes.push_back(cube);
-		}
-	}
+	LOG(DEBUG) << "Default framebuffer: " << default_frmaebuffer;
 
-	for (auto &cube : cubes) {
-		cube.position *= 10.0f;
+	// Allocate up front the levels that every progressive request goes through.
+	for (int size = PROGRESSIVE_SKYBOX_SIZE; size <= SKYBOX_SIZE; size *= 2) {
+		skybox_target(size);
 	}
 
-	for (int i = 0; i < 200; ++i) {
-		glm::vec3 p = {randf(-10, 10), randf(-10, 10), randf(-10, 10)};
-		glm::normalize(p);
-		p *= randf(3, 10);
-		cubes.push_back({
-			p, // position
-			{randf(), randf(), randf()}, // color
-			randf(-10, 10), // phase
-			randf(1.0, 4.0), // scale
-		});
+	staging_buffer.create(STAGING_REGION_SIZE);
+	upload_scene();
+	upload_lights();
+	for (RenderStatsFrame &frame : render_stats_frames) {
+		gl_error_guard(glCreateQueries(GL_TIME_ELAPSED, 1, &frame.timer_query));
+		gl_error_guard(glCreateBuffers(1, &frame.counter_buffer));
+		glNamedBufferStorage(frame.counter_buffer, 6 * OCCLUSION_COMMAND_STRIDE, nullptr, 0);
+	}
+	if (world) {
+		create_world_buffers();
+	}
+	if (volume) {
+		create_volume_textures();
 	}
-
-	cube.position = {0.0f, 0.0f, 0.0f};
-	cube.color = {0.0f, 0.0f, 0.0f};
-	cube.scale = 0.2f;
-	cube.phase = 0.0;
-	cubes.push_back(cube);
 
 	while (!glfwWindowShouldClose(window) && rpc_server->is_running()) {
+		staging_buffer.next_frame();
 		glBindFramebuffer(GL_FRAMEBUFFER, default_frmaebuffer);
 		glViewport(0, 0, width, height);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -204,28 +156,19 @@ void UI::event_loop(const RpcServer *rpc_server) {
 		// glBindVertexArray(vertex_array);
 		// glDrawArrays(GL_TRIANGLES, 0, 3);
 
-		glUseProgram(s.program_id);
-		glBindVertexArray(cube_vertex_array);
 		glm::mat4 tr = glm::translate(glm::identity<glm::mat4>(), {0, -5, -20});
 		tr = glm::rotate(tr, 0.2f * (float)glfwGetTime(), {0, 1, 0});
-		s.Projection = glm::perspective(glm::radians(90.0f), aspect, 0.1f, 100.0f) * tr;
-		s.light0_position = cubes.back().position + light0_offset;
-		s.light1_position = cubes.back().position + light1_offset;
-		for (auto &cube : cubes) {
-			float t = cube.phase;  //(float)glfwGetTime() + cube.phase;
-			cube.Model = glm::identity<glm::mat4>();
-			cube.Model = glm::translate(cube.Model, cube.position);
-			cube.Model = glm::scale(cube.Model, {cube.scale, cube.scale, cube.scale});
-			cube.Model *= glm::eulerAngleYXZ(t * 2.0f, t * 3.0f, 0.0f);
-			cube.Normal_model = glm::inverseTranspose(glm::mat3(cube.Model));
-
-			s.Model = cube.Model;
-			s.Normal_model = cube.Normal_model;
-			s.color = glm::vec4(cube.color, 1.0f);
-
-			glDrawArrays(GL_TRIANGLES, 0, cube_vertices.vertex_count());
-		}
+		// With a 90 degree field of view, a unit length at unit distance spans
+		// half the height.
+		select_lod(glm::vec3(glm::inverse(tr)[3]), height / 2.0f);
+		draw_scene({.view = tr, .fov_y = glm::radians(90.0f), .viewport_size = {width, height}});
 
+		if (world) {
+			world->update([this](int slot, const SceneBuffer &objects) { upload_chunk(slot, objects); });
+		}
+		if (volume) {
+			update_volume();
+		}
 		process_tasks();
 
 		glfwSwapBuffers(window);
@@ -240,23 +183,485 @@ void UI::on_key(int key, int scancode, int action, int mods) {
 	}
 }
 
+// Uploads the scene columns and its clusters for the level of detail pass, and
+// allocates the buffers it selects the meshes and points into. Each column goes
+// to the GPU straight from wherever the scene keeps it, e.g. a mapped scene
+// file.
+void UI::upload_scene() {
+	const auto &s = shaders.solid_program;
+	const auto &pp = shaders.point_program;
+	instance_positions.buffer_data(scene.positions, scene.count);
+	instance_scales.buffer_data(scene.scales, scene.count);
+	instance_colors.buffer_data(scene.colors, scene.count);
+	instance_phases.buffer_data(scene.phases, scene.count);
+
+	const SceneClusters clusters = SceneClusters::build(scene, lod_options.cluster_size);
+	lod_cluster_count = clusters.clusters.size();
+	gl_error_guard(glCreateBuffers(1, &lod_cluster_buffer));
+	glNamedBufferData(lod_cluster_buffer, clusters.clusters.size() * sizeof(SceneCluster), clusters.clusters.data(), GL_STATIC_DRAW);
+	gl_error_guard(glCreateBuffers(1, &lod_order_buffer));
+	glNamedBufferData(lod_order_buffer, clusters.order.size() * sizeof(uint32_t), clusters.order.data(), GL_STATIC_DRAW);
+	gl_error_guard(glCreateBuffers(1, &lod_command_buffer));
+	glNamedBufferData(lod_command_buffer, 8 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	// Every object is either a mesh or a point, and on top of that each cluster
+	// may add a point for its merged objects.
+	lod_meshes.allocate(scene.count);
+	lod_points.allocate(scene.count + lod_cluster_count);
+	gl_error_guard(glCreateBuffers(1, &lod_mesh_object_buffer));
+	glNamedBufferData(lod_mesh_object_buffer, scene.count * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+	// Nothing is visible to begin with, so the first pass of each face draws
+	// everything in the late phase.
+	const std::vector<GLuint> visibility(scene.count, 0);
+	gl_error_guard(glCreateBuffers(1, &occlusion_visibility_buffer));
+	glNamedBufferData(occlusion_visibility_buffer, visibility.size() * sizeof(GLuint), visibility.data(), GL_DYNAMIC_DRAW);
+	gl_error_guard(glCreateBuffers(1, &occlusion_command_buffer));
+	glNamedBufferData(occlusion_command_buffer, 6 * OCCLUSION_COMMAND_STRIDE, nullptr, GL_DYNAMIC_DRAW);
+	culled_meshes.allocate(scene.count);
+
+	glBindVertexArray(cube_vertex_array);
+	lod_meshes.bind([&](auto builder, auto base) {
+		builder.enable_attribute(s.instance_position, base->position);
+		builder.enable_attribute(s.instance_scale, base->scale);
+		builder.enable_attribute(s.instance_color, base->color);
+		builder.enable_attribute(s.instance_phase, base->phase);
+	}, /* divisor */ 1);
+
+	gl_error_guard(glCreateVertexArrays(1, &culled_vertex_array));
+	glBindVertexArray(culled_vertex_array);
+	cube_vertices.bind([&](auto builder, auto base) {
+		builder.enable_attribute(s.position, base->position);
+		builder.enable_attribute(s.normal, base->normal);
+	});
+	culled_meshes.bind([&](auto builder, auto base) {
+		builder.enable_attribute(s.instance_position, base->position);
+		builder.enable_attribute(s.instance_scale, base->scale);
+		builder.enable_attribute(s.instance_color, base->color);
+		builder.enable_attribute(s.instance_phase, base->phase);
+	}, /* divisor */ 1);
+
+	gl_error_guard(glCreateVertexArrays(1, &point_vertex_array));
+	glBindVertexArray(point_vertex_array);
+	lod_points.bind([&](auto builder, auto base) {
+		builder.enable_attribute(pp.position, base->position);
+		builder.enable_attribute(pp.radius, base->radius);
+		builder.enable_attribute(pp.color, base->color);
+	});
+	LOG(INFO) << "Uploaded scene of " << scene.count << " objects in " << lod_cluster_count << " clusters";
+}
+
+// Copies the data into the buffer through the staging buffer. Unlike
+// glNamedBufferSubData(), this never makes the driver wait for, or copy around,
+// the commands still using the buffer.
+template <typename T, size_t N>
+void UI::stage(GLuint buffer_id, GLintptr offset, const T (&data)[N]) {
+	const auto staged = staging_buffer.push(data);
+	glCopyNamedBufferSubData(staged.buffer_id, buffer_id, staged.offset, offset, staged.size_bytes());
+}
+
+// Runs the bound compute program on the given number of workgroups, spread over
+// two dimensions because each is limited to 65535 workgroups.
+static void dispatch_compute(GLuint workgroup_count) {
+	if (workgroup_count == 0) {
+		return;
+	}
+	const GLuint x = std::min(workgroup_count, 65535u);
+	glDispatchCompute(x, (workgroup_count + x - 1) / x, 1);
+}
+
+// Selects which objects of the scene draw_scene() draws as meshes and which as
+// points, for a pass seen from the eye. Every face of a cube map has the same
+// eye and resolution, so they can share one selection.
+void UI::select_lod(const glm::vec3 &eye, float pixels_per_unit) {
+	const auto &l = shaders.lod_program;
+	lod_eye = eye;
+	lod_pixels_per_unit = pixels_per_unit;
+
+	const GLuint commands[8] = {
+		// Mesh: vertex count, instance count, first vertex, base instance.
+		(GLuint)cube_vertices.vertex_count(), 0, 0, 0,
+		// Points: vertex count, instance count, first vertex, base instance.
+		0, 1, 0, 0,
+	};
+	stage(lod_command_buffer, 0, commands);
+	if (lod_cluster_count == 0) {
+		return;
+	}
+
+	glUseProgram(l.program_id);
+	l.eye = eye;
+	l.pixels_per_unit = pixels_per_unit;
+	l.mesh_min_pixels = lod_options.mesh_min_pixels;
+	l.point_min_pixels = lod_options.point_min_pixels;
+	l.cluster_count = lod_cluster_count;
+	l.Clusters.bind(lod_cluster_buffer);
+	l.Order.bind(lod_order_buffer);
+	l.Positions.bind(instance_positions.buffer_id());
+	l.Scales.bind(instance_scales.buffer_id());
+	l.Colors.bind(instance_colors.buffer_id());
+	l.Phases.bind(instance_phases.buffer_id());
+	l.Commands.bind(lod_command_buffer);
+	l.Meshes.bind(lod_meshes.buffer_id());
+	l.Points.bind(lod_points.buffer_id());
+	l.MeshObjects.bind(lod_mesh_object_buffer);
+	// One workgroup per cluster.
+	dispatch_compute(lod_cluster_count);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Uploads the camera lights and the lights of the scene, and allocates the
+// light lists of the clusters.
+void UI::upload_lights() {
+	const auto &l = shaders.lights_program;
+	light_count = std::size(CAMERA_LIGHTS) + scene.light_count;
+	gl_error_guard(glCreateBuffers(1, &light_buffer));
+	glNamedBufferData(light_buffer, light_count * sizeof(SceneLight), nullptr, GL_DYNAMIC_DRAW);
+	glNamedBufferSubData(light_buffer, sizeof(CAMERA_LIGHTS), scene.light_count * sizeof(SceneLight), scene.lights);
+	gl_error_guard(glCreateBuffers(1, &cluster_light_count_buffer));
+	glNamedBufferData(cluster_light_count_buffer, l.CLUSTER_COUNT * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	gl_error_guard(glCreateBuffers(1, &cluster_light_buffer));
+	glNamedBufferData(cluster_light_buffer, l.CLUSTER_COUNT * l.MAX_CLUSTER_LIGHTS * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	LOG(INFO) << "Uploaded " << scene.light_count << " scene lights";
+}
+
+// Moves the camera lights to the camera position and assigns all the lights to
+// the clusters of the camera's view frustum.
+void UI::assign_lights(const Camera &camera) {
+	const auto &l = shaders.lights_program;
+	SceneLight camera_lights[std::size(CAMERA_LIGHTS)];
+	for (size_t i = 0; i < std::size(CAMERA_LIGHTS); ++i) {
+		camera_lights[i] = CAMERA_LIGHTS[i];
+		camera_lights[i].position += camera_position;
+	}
+	stage(light_buffer, 0, camera_lights);
+
+	glUseProgram(l.program_id);
+	const float tan_half_fov_y = std::tan(camera.fov_y / 2);
+	l.View = camera.view;
+	l.tan_half_fov = glm::vec2(camera.aspect() * tan_half_fov_y, tan_half_fov_y);
+	l.near = camera.near;
+	l.far = camera.far;
+	l.light_count = light_count;
+	l.Lights.bind(light_buffer);
+	l.ClusterLightCounts.bind(cluster_light_count_buffer);
+	l.ClusterLights.bind(cluster_light_buffer);
+	glDispatchCompute(l.CLUSTER_COUNT / l.WORKGROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Draws the scene as selected by the last select_lod(). With a target, the
+// meshes are occlusion culled against its depth, as the given face.
+void UI::draw_scene(const Camera &camera, SkyboxTarget *target, int face) {
+	assign_lights(camera);
+	const glm::mat4 projection = camera.projection();
+	const auto &s = shaders.solid_program;
+	glUseProgram(s.program_id);
+	s.Projection = projection;
+	s.viewport_size = camera.viewport_size;
+	s.near = camera.near;
+	s.far = camera.far;
+	s.Lights.bind(light_buffer);
+	s.ClusterLightCounts.bind(cluster_light_count_buffer);
+	s.ClusterLights.bind(cluster_light_buffer);
+	if (target && lod_options.occlusion_culling) {
+		draw_culled_meshes(projection, *target, face);
+	} else {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, lod_command_buffer);
+		glBindVertexArray(cube_vertex_array);
+		glDrawArraysIndirect(GL_TRIANGLES, (const void *)0);
+	}
+
+	const auto &pp = shaders.point_program;
+	glUseProgram(pp.program_id);
+	pp.Projection = projection;
+	pp.eye = lod_eye;
+	pp.pixels_per_unit = lod_pixels_per_unit;
+	pp.viewport_size = camera.viewport_size;
+	pp.near = camera.near;
+	pp.far = camera.far;
+	glBindVertexArray(point_vertex_array);
+	glDrawArraysIndirect(GL_POINTS, (const void *)(4 * sizeof(GLuint)));
+
+	if (world) {
+		glUseProgram(s.program_id);
+		glBindVertexArray(world_vertex_array);
+		const int objects_per_chunk = world->options.objects_per_chunk;
+		for (const auto &chunk : world->resident_chunks()) {
+			glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, cube_vertices.vertex_count(), chunk.count, chunk.slot * objects_per_chunk);
+		}
+	}
+}
+
+// Draws the meshes that were visible in the last pass of the face, builds the
+// hierarchical depth buffer from them and then draws the meshes it shows to be
+// visible too. The solid program must be in use.
+void UI::draw_culled_meshes(const glm::mat4 &projection, SkyboxTarget &target, int face) {
+	const auto &s = shaders.solid_program;
+	const auto &c = shaders.cull_program;
+	const GLintptr slot = face * OCCLUSION_COMMAND_STRIDE;
+	const GLuint commands[10] = {
+		// Early and late phase: vertex count, instance count, first vertex, base
+		// instance.
+		(GLuint)cube_vertices.vertex_count(), 0, 0, 0,
+		(GLuint)cube_vertices.vertex_count(), 0, 0, 0,
+		// Frustum and occlusion culled.
+		0, 0,
+	};
+	stage(occlusion_command_buffer, slot, commands);
+	has_occlusion_counters = true;
+
+	glUseProgram(c.program_id);
+	c.ViewProjection = projection;
+	c.face = face;
+	c.LodCommand.bind(lod_command_buffer);
+	c.Meshes.bind(lod_meshes.buffer_id());
+	c.MeshObjects.bind(lod_mesh_object_buffer);
+	c.Visibility.bind(occlusion_visibility_buffer);
+	c.Commands.bind(occlusion_command_buffer, slot, sizeof(commands));
+	c.CulledMeshes.bind(culled_meshes.buffer_id());
+	// There are at most as many meshes as objects.
+	const GLuint workgroup_count = (scene.count + c.WORKGROUP_SIZE - 1) / c.WORKGROUP_SIZE;
+
+	c.phase = 0;
+	dispatch_compute(workgroup_count);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(s.program_id);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, occlusion_command_buffer);
+	glBindVertexArray(culled_vertex_array);
+	glDrawArraysIndirect(GL_TRIANGLES, (const void *)slot);
+
+	build_hiz(target);
+
+	glUseProgram(c.program_id);
+	c.phase = 1;
+	c.hiz = gl::TextureUnit(0);
+	c.hiz_levels = target.hiz_levels;
+	c.hiz_size = glm::vec2(target.hiz_size, target.hiz_size);
+	glBindTextureUnit(0, target.hiz_texture);
+	dispatch_compute(workgroup_count);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(s.program_id);
+	glDrawArraysIndirect(GL_TRIANGLES, (const void *)(slot + 4 * sizeof(GLuint)));
+}
+
+// Reduces the depth buffer of the target into its hierarchical depth buffer,
+// one level at a time.
+void UI::build_hiz(SkyboxTarget &target) {
+	const auto &h = shaders.hiz_program;
+	glUseProgram(h.program_id);
+	h.src = gl::TextureUnit(0);
+	h.dst = 0;
+	for (int level = 0; level < target.hiz_levels; ++level) {
+		if (level == 0) {
+			glBindTextureUnit(0, target.depth_texture);
+			h.src_level = 0;
+		} else {
+			glBindTextureUnit(0, target.hiz_texture);
+			h.src_level = level - 1;
+		}
+		glBindImageTexture(0, target.hiz_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		const GLuint size = std::max(1, target.hiz_size >> level);
+		const GLuint groups = (size + h.WORKGROUP_SIZE - 1) / h.WORKGROUP_SIZE;
+		glDispatchCompute(groups, groups, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+}
+
+// Adds the GPU time and the occlusion counters of the skybox renders the GPU
+// has finished to the stats. Only polls, so it is called before every skybox
+// and the stats of a render come in with the next one.
+void UI::collect_render_stats() {
+	for (RenderStatsFrame &frame : render_stats_frames) {
+		if (!frame.fence || glClientWaitSync(frame.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			continue;
+		}
+		glDeleteSync(frame.fence);
+		frame.fence = nullptr;
+		// Available, since it ended before the fence.
+		GLuint64 elapsed_ns = 0;
+		glGetQueryObjectui64v(frame.timer_query, GL_QUERY_RESULT, &elapsed_ns);
+		tasks.stats.skybox_renders += 1;
+		tasks.stats.skybox_render_gpu_us += elapsed_ns / 1000;
+		if (frame.has_occlusion_counters) {
+			GLuint counters[6][OCCLUSION_COMMAND_STRIDE / sizeof(GLuint)];
+			glGetNamedBufferSubData(frame.counter_buffer, 0, sizeof(counters), counters);
+			for (const auto &face : counters) {
+				tasks.stats.occlusion_passes += 1;
+				tasks.stats.occlusion_drawn_early += face[1];
+				tasks.stats.occlusion_drawn_late += face[5];
+				tasks.stats.occlusion_frustum_culled += face[8];
+				tasks.stats.occlusion_culled += face[9];
+			}
+		}
+	}
+}
+
+// Allocates the instance buffers for all the chunk slots up front, so the
+// memory use doesn't change as the world streams in and out.
+void UI::create_world_buffers() {
+	const auto &s = shaders.solid_program;
+	const GLsizei capacity = world->options.max_chunks * world->options.objects_per_chunk;
+	chunk_positions.allocate(capacity);
+	chunk_scales.allocate(capacity);
+	chunk_colors.allocate(capacity);
+	chunk_phases.allocate(capacity);
+
+	gl_error_guard(glCreateVertexArrays(1, &world_vertex_array));
+	glBindVertexArray(world_vertex_array);
+	cube_vertices.bind([&](auto builder, auto base) {
+		builder.enable_attribute(s.position, base->position);
+		builder.enable_attribute(s.normal, base->normal);
+	});
+	chunk_positions.bind([&](auto builder, auto base) {
+		builder.enable_attribute(s.instance_position, *base);
+	}, /* divisor */ 1);
+	chunk_scales.bind([&](auto builder, auto base) {
+		builder.enable_attribute(s.instance_scale, *base);
+	}, /* divisor */ 1);
+	chunk_colors.bind([&](auto builder, auto base) {
+		builder.enable_attribute(s.instance_color, *base);
+	}, /* divisor */ 1);
+	chunk_phases.bind([&](auto builder, auto base) {
+		builder.enable_attribute(s.instance_phase, *base);
+	}, /* divisor */ 1);
+}
+
+void UI::upload_chunk(int slot, const SceneBuffer &objects) {
+	const GLsizei first = slot * world->options.objects_per_chunk;
+	const GLsizei count = objects.positions.size();
+	chunk_positions.buffer_sub_data(first, objects.positions.data(), count);
+	chunk_scales.buffer_sub_data(first, objects.scales.data(), count);
+	chunk_colors.buffer_sub_data(first, objects.colors.data(), count);
+	chunk_phases.buffer_sub_data(first, objects.phases.data(), count);
+}
+
+// Allocates the atlas for all the brick slots up front, like the world buffers.
+// The slots are laid out in a cube as far as the maximum texture size allows.
+void UI::create_volume_textures() {
+	const VolumeFileHeader &h = volume->header();
+	const int slot_size = h.brick_size + 2;
+	const int slot_count = std::max(1, volume->slot_count());
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+	const int max_slots = max_size / slot_size;
+	const int side = std::min(max_slots, (int)std::ceil(std::cbrt((float)slot_count)));
+	volume_atlas_slots = {side, side, (slot_count + side * side - 1) / (side * side)};
+	if (volume_atlas_slots.z > max_slots) {
+		throw gl::exception(
+				"Volume budget of " + to_string(slot_count) + " bricks exceeds the maximum 3D texture size " + to_string(max_size));
+	}
+	volume_atlas.resize(side * slot_size, side * slot_size, volume_atlas_slots.z * slot_size);
+	volume_atlas.set(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	volume_atlas.set(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	volume_atlas.set(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	volume_atlas.set(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	volume_atlas.set(GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	// Integer textures can't be filtered.
+	volume_indirection.resize(h.grid_size.x, h.grid_size.y, h.grid_size.z);
+	volume_indirection.set(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	volume_indirection.set(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	gl_error_guard(glClearTexImage(volume_indirection.texture_id(), 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr));
+
+	volume_upload_buffer.create(volume->options.uploads_per_frame * volume->brick_bytes());
+	gl_error_guard(glCreateVertexArrays(1, &volume_vertex_array));
+	LOG(INFO) << "Volume atlas of " << volume_atlas_slots.x << "x" << volume_atlas_slots.y << "x" << volume_atlas_slots.z
+						<< " bricks";
+}
+
+void UI::upload_brick(int slot, const glm::ivec3 &coords, const std::byte *voxels) {
+	const int slot_size = volume->header().brick_size + 2;
+	const glm::ivec3 slot_coords = {
+		slot % volume_atlas_slots.x,
+		slot / volume_atlas_slots.x % volume_atlas_slots.y,
+		slot / (volume_atlas_slots.x * volume_atlas_slots.y),
+	};
+	const auto staged = volume_upload_buffer.push(voxels, volume->brick_bytes());
+	const glm::ivec3 p = slot_coords * slot_size;
+	volume_atlas.sub_image(0, p.x, p.y, p.z, slot_size, slot_size, slot_size, gl::RGBA8, staged.buffer_id, staged.offset);
+	const glm::u8vec4 entry = {slot_coords, 1};
+	volume_indirection.sub_image(0, coords.x, coords.y, coords.z, 1, 1, 1, gl::RGBA8UI, gl::BufferView(&entry, 1));
+}
+
+void UI::evict_brick(int slot, const glm::ivec3 &coords) {
+	const glm::u8vec4 entry = {0, 0, 0, 0};
+	volume_indirection.sub_image(0, coords.x, coords.y, coords.z, 1, 1, 1, gl::RGBA8UI, gl::BufferView(&entry, 1));
+}
+
+// Uploads some of the bricks read since the last frame, each through its own
+// range of the upload ring.
+void UI::update_volume() {
+	volume_upload_buffer.next_frame();
+	volume->update(
+			[this](int slot, const glm::ivec3 &coords, const std::byte *voxels) { upload_brick(slot, coords, voxels); },
+			[this](int slot, const glm::ivec3 &coords) { evict_brick(slot, coords); });
+}
+
+// Raymarches the volume over the face drawn last into the target, up to the
+// depth of the scene.
+void UI::draw_volume(const Camera &camera, SkyboxTarget &target) {
+	const auto &v = shaders.volume_program;
+	const VolumeFileHeader &h = volume->header();
+	glUseProgram(v.program_id);
+	v.InverseViewProjection = glm::inverse(camera.projection());
+	v.eye = glm::vec3(glm::inverse(camera.view)[3]);
+	v.origin = h.origin;
+	v.voxel_size = h.voxel_size;
+	v.grid_size = h.grid_size;
+	v.brick_size = (GLint)h.brick_size;
+	v.atlas_size = glm::vec3(volume_atlas.size());
+	v.density_scale = volume->options.density_scale;
+	v.max_steps = VOLUME_MAX_STEPS;
+	v.atlas = gl::TextureUnit(0);
+	v.indirection = gl::TextureUnit(1);
+	v.depth = gl::TextureUnit(2);
+	volume_atlas.bind(gl::TextureUnit(0));
+	volume_indirection.bind(gl::TextureUnit(1));
+	glBindTextureUnit(2, target.depth_texture);
+
+	// The depth buffer is only read, so it can stay attached.
+	gl::disable_depth_test no_depth_test;
+	gl::disable_depth_write no_depth_write;
+	gl::enable_blend blend;
+	glBlendFuncSeparate(GL_ONE, GL_SRC_ALPHA, GL_ZERO, GL_ONE);
+	glBindVertexArray(volume_vertex_array);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
 void UI::process_tasks() {
 	unique_ptr<Task> task = tasks.pop();
 	if (!task) {
+		prefetch_skyboxes();
 		return;
 	}
+	trace::TaskScope task_scope(task->id());
 	switch (task->variant_case()) {
 		case Task::VariantCase::kSkybox: {
 			SkyboxTask skybox_task(std::move(task));
 			process_skybox_task(skybox_task);
 			break;
 		}
+		case Task::VariantCase::kSkyboxBatch: {
+			SkyboxBatchTask skybox_batch_task(std::move(task));
+			process_skybox_batch_task(skybox_batch_task);
+			break;
+		}
 		default:
-			std::cerr << "Unimplemented task variant: " << task->variant_case() << std::endl;
+			LOG(ERROR) << "Unimplemented task variant: " << task->variant_case();
+			Task::drop(std::move(task));
 			break;
 	}
 }
 
+// Converts row_count rows of width RGBA pixels, as read back from the GPU, into
+// RGB rows dst_width pixels apart in dst. Every row is mirrored, so that the
+// faces are laid out the way the cube textures of the client take them.
+static void pack_skybox_rows(const uint8_t *src, int width, int row_count, uint8_t *dst, int dst_width) {
+	for (int row = 0; row < row_count; ++row) {
+		pixels::rgba_to_rgb(src + row * width * 4, dst + row * dst_width * 3, width, /* is_mirrored */ true);
+	}
+}
+
 // TODO: The order is by trial & error. I have no idea why it is in this
 // particular way. Probably something is wrong and I just made an even number of
 // mistakes. Revisit and clean up.
@@ -270,55 +675,503 @@ const glm::mat4 LOOKATS[] = {
 };
 
 void UI::process_skybox_task(SkyboxTask &task) {
-	glBindFramebuffer(GL_FRAMEBUFFER, skybox_framebuffer);
-	glViewport(0, 0, SKYBOX_SIZE, SKYBOX_SIZE);
-
-	const auto &s = shaders.solid_program;
-	glUseProgram(s.program_id);
-	glBindVertexArray(cube_vertex_array);
+	if (task.step() > 0 && task.is_superseded()) {
+		// A refinement nobody is waiting for anymore.
+		return;
+	}
+	if (task.is_cancelled()) {
+		++tasks.stats.cancelled_before_render;
+		return;
+	}
 
+	const pb::SkyboxProjection projection = task.request.projection();
+	const bool is_projected = projection == pb::SKYBOX_PROJECTION_EQUIRECTANGULAR || projection == pb::SKYBOX_PROJECTION_OCTAHEDRAL;
+	const bool is_octahedral = projection == pb::SKYBOX_PROJECTION_OCTAHEDRAL;
+	const int projection_width = std::min<int>(task.request.projection_width(), MAX_PROJECTION_WIDTH);
+	int resolution = task.request.resolution();
+	if (resolution == 0 && is_projected && projection_width > 0) {
+		// Just big enough faces for the requested width. See project_skybox().
+		const float face_size = is_octahedral ? projection_width / 2.0f : projection_width / std::numbers::pi_v<float>;
+		resolution = std::bit_ceil((unsigned)std::ceil(face_size));
+	}
+	// Picked for every step, so that the refinements of a progressive request
+	// follow the load too.
+	const int quality_tier = quality.pick(tasks.pending_count());
+	const QualityTier &tier = QualityController::TIERS[quality_tier];
+	tasks.stats.quality_tier = quality_tier;
+	const int requested_size = skybox_size(resolution);
+	const int final_size = std::max(MIN_SKYBOX_SIZE, requested_size >> tier.resolution_shift);
+	const shared_ptr<TaskReactor> reactor = task.lock_reactor();
+	// If the client holds a skybox we can send a delta against, that is cheaper
+	// than the previews, which would replace it on the client and so prevent the
+	// delta.
+	const bool has_base = reactor && !is_projected
+			&& task.request.base_resolution() == final_size
+			&& reactor->skybox_history.contains(task.request.base_task_id(), final_size);
 	const glm::vec3 position = proto_cast<glm::vec3>(task.request.position());
-	cubes.back().position = position;
+
+	int mip_levels = 1;
+	// A prefetched skybox is ready at full size, so no previews are needed.
+	const bool is_prefetched = reactor && !is_projected && task.step() == 0
+			&& skybox_prefetcher.take(reactor, position, final_size, task.request.mipmaps(), skybox_pixels, mip_levels);
+	if (reactor && !is_projected && task.step() == 0) {
+		skybox_prefetcher.observe(reactor, position, final_size, task.request.mipmaps());
+	}
+	const int size = task.request.progressive() && !has_base && !is_prefetched
+			? std::min(final_size, PROGRESSIVE_SKYBOX_SIZE << task.step())
+			: final_size;
+
+	int image_width = size;
+	int image_height = 6 * size;
+	if (is_projected) {
+		// Faces that match the angular resolution of the image at its coarsest, on
+		// the equator, are pi times smaller than an equirectangular image is wide,
+		// and half as big as an octahedral one. Previews scale down along with the
+		// faces.
+		const int full_width = projection_width > 0
+				? projection_width >> tier.resolution_shift
+				: (int)std::ceil(is_octahedral ? 2.0f * final_size : std::numbers::pi_v<float> * final_size);
+		image_width = std::max(2, full_width * size / final_size) & ~1;
+		image_height = project_skybox(position, skybox_target(size), is_octahedral, image_width, tier.lod_scale);
+	} else if (is_prefetched) {
+		image_height = skybox_pixels.size() / (size * 3);
+	} else if (task.request.mipmaps()) {
+		SkyboxTarget &target = skybox_target(size);
+		render_skybox(position, target, /* to_cubemap */ true, 0, tier.lod_scale);
+		mip_levels = read_skybox_mips(target);
+		image_height = skybox_pixels.size() / (size * 3);
+	} else if (!read_cached_mip(position, size, tier.lod_scale)) {
+		render_skybox(position, skybox_target(size), /* to_cubemap */ false, 0, tier.lod_scale);
+	}
+	if (task.is_cancelled()) {
+		++tasks.stats.cancelled_before_encode;
+		return;
+	}
+
+	SkyboxDelta delta;
+	const TaskId base_task_id = task.request.base_resolution() == size ? task.request.base_task_id() : 0;
+	if (reactor && !is_projected && reactor->skybox_history.push(task.id(), base_task_id, size, image_height, skybox_pixels, delta)) {
+		auto &response_delta = *task.response.mutable_delta();
+		response_delta.set_base_task_id(base_task_id);
+		response_delta.set_tile_size(delta.tile_size);
+		response_delta.set_tile_map(delta.tile_map.data(), delta.tile_map.size());
+		response_delta.set_changed_tile_count(delta.changed_tile_count);
+		if (delta.changed_tile_count > 0) {
+			const int tiles_height = delta.changed_tile_count * delta.tile_size;
+			assets.put_qoi("skybox_delta", std::move(delta.tile_pixels), delta.tile_size, tiles_height, task.response.mutable_path());
+		}
+	} else {
+		assets.put_qoi("skybox", std::move(skybox_pixels), image_width, image_height, task.response.mutable_path());
+	}
+	task.response.set_resolution(size);
+	task.response.set_mip_levels(mip_levels);
+	task.response.set_projection(is_projected ? projection : pb::SKYBOX_PROJECTION_CUBE);
+	task.response.set_is_final(size == final_size);
+	task.response.set_quality_tier(quality_tier);
+	if (quality_tier > 0) {
+		++tasks.stats.degraded_skyboxes;
+	}
+	if (size < final_size) {
+		tasks.add(task.next_step());
+	}
+	respond_after_assets(task.detach(), quality_tier);
+}
+
+// Renders predicted skyboxes while there is nothing else to do, up to the
+// budget per frame.
+void UI::prefetch_skyboxes() {
+	const int quality_tier = quality.current_tier();
+	if (quality_tier > 0) {
+		// Loaded enough to lower the quality, so the GPU time is better left to
+		// the tasks that may come.
+		return;
+	}
+	const float lod_scale = QualityController::TIERS[quality_tier].lod_scale;
+	for (int i = 0; i < skybox_prefetcher.options.budget; ++i) {
+		SkyboxPrefetcher::Entry *entry = skybox_prefetcher.next_pending();
+		if (!entry) {
+			return;
+		}
+		SkyboxTarget &target = skybox_target(entry->size);
+		int mip_levels = 1;
+		if (entry->mipmaps) {
+			render_skybox(entry->position, target, /* to_cubemap */ true, 0, lod_scale);
+			mip_levels = read_skybox_mips(target);
+		} else {
+			render_skybox(entry->position, target, /* to_cubemap */ false, 0, lod_scale);
+		}
+		skybox_prefetcher.rendered(*entry, mip_levels, skybox_pixels);
+	}
+}
+
+// Renders a slice of the batch per step. Each skybox is read back into a pack
+// buffer asynchronously and encoded while the GPU renders the next one.
+void UI::process_skybox_batch_task(SkyboxBatchTask &task) {
+	const int coordinate_count = task.request.positions_size();
+	if (coordinate_count == 0 || coordinate_count % 3 != 0) {
+		// Otherwise there would be no response at all, or the last position
+		// would be silently left out.
+		task.fail(
+				grpc::StatusCode::INVALID_ARGUMENT,
+				"Expected a non-empty list of positions, three coordinates each, got " + to_string(coordinate_count) + " coordinates.");
+		return;
+	}
+	const int size = skybox_size(task.request.resolution());
+	const int count = coordinate_count / 3;
+	const int begin = task.step() * SKYBOX_BATCH_SLICE;
+	const int end = std::min(count, begin + SKYBOX_BATCH_SLICE);
+	SkyboxTarget &target = skybox_target(size);
+
+	const GLsizeiptr image_bytes = 6 * size * size * 4;
+	if (skybox_readback_capacity < image_bytes) {
+		if (skybox_readback_buffers[0] == 0) {
+			gl_error_guard(glCreateBuffers(2, skybox_readback_buffers));
+		}
+		for (GLuint buffer : skybox_readback_buffers) {
+			gl_error_guard(glNamedBufferData(buffer, image_bytes, nullptr, GL_STREAM_READ));
+		}
+		skybox_readback_capacity = image_bytes;
+	}
+
+	const auto &positions = task.request.positions();
+	int rendered_end = begin;
+	for (int i = begin; i < end; ++i) {
+		if (task.is_cancelled()) {
+			++tasks.stats.cancelled_before_render;
+			break;
+		}
+		const glm::vec3 position(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+		const int slot = i % 2;
+		render_skybox(position, target, /* to_cubemap */ false, skybox_readback_buffers[slot]);
+		skybox_readback_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		if (i > begin) {
+			send_batch_skybox(task, i - 1, size, count);
+		}
+		rendered_end = i + 1;
+	}
+	if (rendered_end > begin) {
+		send_batch_skybox(task, rendered_end - 1, size, count);
+	}
+
+	if (rendered_end == end && end < count) {
+		tasks.add(task.next_step());
+	}
+}
+
+// Waits for the readback of the skybox at index, encodes it, and responds with
+// it from a fork of the task.
+void UI::send_batch_skybox(SkyboxBatchTask &task, int index, int size, int count) {
+	trace::Span readback_span("readback");
+	const int slot = index % 2;
+	GLsync &fence = skybox_readback_fences[slot];
+	GLenum status;
+	do {
+		status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000);
+	} while (status == GL_TIMEOUT_EXPIRED);
+	glDeleteSync(fence);
+	fence = nullptr;
+	if (status == GL_WAIT_FAILED) {
+		throw gl::exception("Waiting for skybox readback failed");
+	}
+
+	if (task.is_cancelled()) {
+		++tasks.stats.cancelled_before_encode;
+		return;
+	}
+
+	const GLuint buffer = skybox_readback_buffers[slot];
+	const void *pixels = glMapNamedBufferRange(buffer, 0, 6 * size * size * 4, GL_MAP_READ_BIT);
+	if (!pixels) {
+		throw gl::exception("Failed to map skybox readback buffer");
+	}
+	skybox_pixels.resize(6 * size * size * 3);
+	pack_skybox_rows(static_cast<const uint8_t *>(pixels), size, 6 * size, skybox_pixels.data(), size);
+	glUnmapNamedBuffer(buffer);
+
+	unique_ptr<Task> response_task = task.fork();
+	auto &response = *response_task->response().mutable_skybox_batch();
+	response.set_index(index);
+	auto &skybox = *response.mutable_skybox();
+	assets.put_qoi("skybox", std::move(skybox_pixels), size, 6 * size, skybox.mutable_path());
+	skybox.set_resolution(size);
+	skybox.set_mip_levels(1);
+	skybox.set_is_final(index == count - 1);
+	respond_after_assets(std::move(response_task));
+}
+
+// Sends the response of the task once the assets it refers to are written and
+// their paths are assigned. Responses keep their order, since the asset store
+// writes in order. With a quality_tier the task was rendered at, the time it
+// took counts towards the quality controller.
+void UI::respond_after_assets(unique_ptr<Task> &&task, int quality_tier) {
+	// Shared, because the function must be copyable.
+	auto shared_task = std::make_shared<unique_ptr<Task>>(std::move(task));
+	assets.then([this, shared_task, quality_tier] {
+		const Task &t = **shared_task;
+		if (quality_tier >= 0) {
+			typedef std::chrono::duration<float, std::milli> Milliseconds;
+			const auto now = std::chrono::steady_clock::now();
+			quality.record(
+					quality_tier,
+					Milliseconds(t.started_time() - t.queued_time()).count(),
+					Milliseconds(now - t.started_time()).count());
+		}
+		Task::done(std::move(*shared_task));
+	});
+}
+
+// Renders the six faces of the skybox seen from position. Normally the faces
+// go to the color renderbuffer of the target and are read back into
+// skybox_pixels one by one, or into pack_buffer if given, in which case the
+// reads are asynchronous. With to_cubemap, they go to the layers of the cube
+// map of the target instead, which then gets its mip chain generated and
+// nothing is read back. The level of detail is coarsened by lod_scale, see
+// QualityTier.
+void UI::render_skybox(const glm::vec3 &position, SkyboxTarget &target, bool to_cubemap, GLuint pack_buffer, float lod_scale) {
+	const int size = target.size;
+	if (to_cubemap && target.cubemap == 0) {
+		target.cubemap_levels = std::bit_width((unsigned)size);
+		gl_error_guard(glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &target.cubemap));
+		gl_error_guard(glTextureStorage2D(target.cubemap, target.cubemap_levels, GL_RGBA8, size, size));
+		// Filtered within each face only. GL_TEXTURE_CUBE_MAP_SEAMLESS stays off,
+		// because the faces are turned against the layout it assumes.
+		glTextureParameteri(target.cubemap, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTextureParameteri(target.cubemap, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(target.cubemap, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(target.cubemap, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	if (to_cubemap) {
+		target.has_mips = false;
+	} else {
+		glNamedFramebufferRenderbuffer(target.framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color_renderbuffer);
+		if (pack_buffer == 0) {
+			skybox_readback_pixels.resize(6 * size * size * 4);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+	glViewport(0, 0, size, size);
+
+	camera_position = position;
+	if (volume) {
+		volume->focus(position);
+	}
+	if (world) {
+		// Everything around must be there before the skybox is rendered.
+		world->load_around(position, [this](int slot, const SceneBuffer &objects) { upload_chunk(slot, objects); });
+		glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+	}
+	collect_render_stats();
+	staging_buffer.next_frame();
+	// Only measured if the GPU is done with the last render in this frame, so
+	// the stats are a sample of the renders when it falls behind.
+	RenderStatsFrame &stats_frame = render_stats_frames[render_stats_frame];
+	const bool is_measured = !stats_frame.fence;
+	if (is_measured) {
+		render_stats_frame = (render_stats_frame + 1) % std::size(render_stats_frames);
+		glBeginQuery(GL_TIME_ELAPSED, stats_frame.timer_query);
+	}
+	has_occlusion_counters = false;
+	// The faces are square with a 90 degree field of view, so a unit length at
+	// unit distance spans half a face.
+	select_lod(position, size / 2.0f * lod_scale);
 	glm::mat tr = glm::translate(glm::identity<glm::mat4>(), -position);
-	glm::mat4 p = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f);
-	glm::mat4 flip = glm::scale(glm::identity<glm::mat4>(), glm::vec3(-1.0f, 1.0f, 1.0f));
 
-	int i = 0;
 	for (int i = 0; i < 6; ++i) {
+		trace::Span face_span("face");
+		if (to_cubemap) {
+			glNamedFramebufferTextureLayer(target.framebuffer, GL_COLOR_ATTACHMENT0, target.cubemap, 0, i);
+		}
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		s.Projection = p * LOOKATS[i] * tr;
-		s.light0_position = cubes.back().position + light0_offset;
-		s.light1_position = cubes.back().position + light1_offset;
-
-		for (auto &cube : cubes) {
-			s.Model = cube.Model;
-			s.Normal_model = cube.Normal_model;
-			s.color = glm::vec4(cube.color, 1.0f);
-			glDrawArrays(GL_TRIANGLES, 0, cube_vertices.vertex_count());
+		const Camera camera = {.view = LOOKATS[i] * tr, .fov_y = glm::radians(90.0f), .viewport_size = {size, size}};
+		draw_scene(camera, &target, i);
+		if (volume) {
+			draw_volume(camera, target);
+		}
+
+		if (!to_cubemap) {
+			trace::Span readback_span("readback");
+			const size_t offset = i * size * size * 4;
+			glReadPixels(
+					0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE,
+					pack_buffer ? reinterpret_cast<void *>(offset) : skybox_readback_pixels.data() + offset);
 		}
+	}
+	if (is_measured) {
+		glEndQuery(GL_TIME_ELAPSED);
+		stats_frame.has_occlusion_counters = has_occlusion_counters;
+		if (has_occlusion_counters) {
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			glCopyNamedBufferSubData(occlusion_command_buffer, stats_frame.counter_buffer, 0, 0, 6 * OCCLUSION_COMMAND_STRIDE);
+		}
+		stats_frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
 
-		glReadPixels(
-				0, 0, SKYBOX_SIZE, SKYBOX_SIZE, GL_RGB, GL_UNSIGNED_BYTE,
-				skybox_pixels + i * SKYBOX_SIZE * SKYBOX_SIZE * 3);
+	if (pack_buffer) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	} else if (!to_cubemap) {
+		trace::Span repack_span("repack");
+		skybox_pixels.resize(6 * size * size * 3);
+		pack_skybox_rows(skybox_readback_pixels.data(), size, 6 * size, skybox_pixels.data(), size);
 	}
 
-	std::string path = "skybox.qoi";
-	qoi_desc desc = {(unsigned int)SKYBOX_SIZE, 6 * (unsigned int)SKYBOX_SIZE, 3, QOI_LINEAR};
-	qoi_write(path.c_str(), skybox_pixels, &desc);
-	task.response.set_path(path);
-	task.done();
+	if (to_cubemap) {
+		gl_error_guard(glGenerateTextureMipmap(target.cubemap));
+		target.has_mips = true;
+		target.mips_position = position;
+		target.mips_lod_scale = lod_scale;
+	}
+}
+
+// Reads back all the mip levels of the cube map of the target into
+// skybox_pixels, packed as described in SkyboxResponse. Returns the number of
+// levels.
+int UI::read_skybox_mips(const SkyboxTarget &target) {
+	trace::Span readback_span("readback");
+	const int size = target.size;
+	int image_height = 0;
+	for (int level = 0; level < target.cubemap_levels; ++level) {
+		image_height += 6 * std::max(1, size >> level);
+	}
+	skybox_pixels.assign(size * image_height * 3, 0);
+
+	uint8_t *level_start = skybox_pixels.data();
+	for (int level = 0; level < target.cubemap_levels; ++level) {
+		const int level_size = std::max(1, size >> level);
+		skybox_readback_pixels.resize(6 * level_size * level_size * 4);
+		glGetTextureImage(
+				target.cubemap, level, GL_RGBA, GL_UNSIGNED_BYTE, skybox_readback_pixels.size(), skybox_readback_pixels.data());
+		pack_skybox_rows(skybox_readback_pixels.data(), level_size, 6 * level_size, level_start, size);
+		level_start += 6 * level_size * size * 3;
+	}
+	return target.cubemap_levels;
+}
+
+// Resamples the skybox at position into skybox_pixels in the equirectangular or
+// the octahedral projection, width pixels wide, and returns the height. The
+// cube map of the target is rendered first, unless it holds the skybox already,
+// at least at lod_scale.
+int UI::project_skybox(const glm::vec3 &position, SkyboxTarget &target, bool is_octahedral, int width, float lod_scale) {
+	if (!target.has_mips || target.mips_position != position || target.mips_lod_scale < lod_scale) {
+		render_skybox(position, target, /* to_cubemap */ true, 0, lod_scale);
+	}
+	const int height = is_octahedral ? width : width / 2;
+	if (projection_texture_size != glm::ivec2(width, height)) {
+		glDeleteTextures(1, &projection_texture);
+		gl_error_guard(glCreateTextures(GL_TEXTURE_2D, 1, &projection_texture));
+		gl_error_guard(glTextureStorage2D(projection_texture, 1, GL_RGBA8, width, height));
+		projection_texture_size = {width, height};
+	}
+
+	// Pixels are the coarsest on the equator. Sampling the level whose texels
+	// are about as big there keeps small images from aliasing.
+	const float texels_per_pixel = is_octahedral
+			? 2.0f * target.size / width
+			: std::numbers::pi_v<float> * target.size / width;
+	const auto &p = shaders.project_program;
+	glUseProgram(p.program_id);
+	p.skybox = gl::TextureUnit(0);
+	p.projection = is_octahedral ? pb::SKYBOX_PROJECTION_OCTAHEDRAL : pb::SKYBOX_PROJECTION_EQUIRECTANGULAR;
+	p.lod = std::max(0.0f, std::log2(texels_per_pixel));
+	p.dst = 0;
+	glBindTextureUnit(0, target.cubemap);
+	glBindImageTexture(0, projection_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	glDispatchCompute(
+			(width + p.WORKGROUP_SIZE - 1) / p.WORKGROUP_SIZE,
+			(height + p.WORKGROUP_SIZE - 1) / p.WORKGROUP_SIZE,
+			1);
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	trace::Span readback_span("readback");
+	skybox_readback_pixels.resize(width * height * 4);
+	glGetTextureImage(
+			projection_texture, 0, GL_RGBA, GL_UNSIGNED_BYTE, skybox_readback_pixels.size(), skybox_readback_pixels.data());
+	skybox_pixels.resize(width * height * 3);
+	pixels::rgba_to_rgb(skybox_readback_pixels.data(), skybox_pixels.data(), width * height);
+	return height;
+}
+
+// If some cube map holds the skybox at position in a larger size, reads the
+// matching level into skybox_pixels instead of rendering it again. One rendered
+// at a coarser level of detail than lod_scale doesn't do, while a finer one is
+// only better.
+bool UI::read_cached_mip(const glm::vec3 &position, int size, float lod_scale) {
+	for (const auto &target : skybox_targets) {
+		if (!target.has_mips || target.mips_position != position || target.mips_lod_scale < lod_scale
+				|| target.size <= size || target.size % size != 0) {
+			continue;
+		}
+		const int ratio = target.size / size;
+		if (!std::has_single_bit((unsigned)ratio)) {
+			continue;
+		}
+		const int level = std::countr_zero((unsigned)ratio);
+		trace::Span readback_span("readback");
+		skybox_readback_pixels.resize(6 * size * size * 4);
+		glGetTextureImage(
+				target.cubemap, level, GL_RGBA, GL_UNSIGNED_BYTE, skybox_readback_pixels.size(), skybox_readback_pixels.data());
+		skybox_pixels.resize(6 * size * size * 3);
+		pack_skybox_rows(skybox_readback_pixels.data(), size, 6 * size, skybox_pixels.data(), size);
+		return true;
+	}
+	return false;
+}
+
+// Face size for the requested resolution. Rounded up to a power of two, so
+// that clients stepping through sizes can't fill the GPU memory with targets,
+// and so that every smaller size is a mip level of a larger cube map.
+int UI::skybox_size(int resolution) {
+	if (resolution == 0) {
+		return SKYBOX_SIZE;
+	}
+	return std::bit_ceil((unsigned)std::clamp(resolution, MIN_SKYBOX_SIZE, MAX_SKYBOX_SIZE));
+}
+
+SkyboxTarget &UI::skybox_target(int size) {
+	assert(std::has_single_bit((unsigned)size));
+	for (auto &target : skybox_targets) {
+		if (target.size == size) {
+			return target;
+		}
+	}
+
+	SkyboxTarget target = {size};
+	gl_error_guard(glCreateFramebuffers(1, &target.framebuffer));
+	gl_error_guard(glCreateRenderbuffers(1, &target.color_renderbuffer));
+	// Four bytes per pixel is what GPUs read back without converting.
+	gl_error_guard(glNamedRenderbufferStorage(target.color_renderbuffer, GL_RGBA8, size, size));
+	gl_error_guard(glCreateTextures(GL_TEXTURE_2D, 1, &target.depth_texture));
+	gl_error_guard(glTextureStorage2D(target.depth_texture, 1, GL_DEPTH_COMPONENT32F, size, size));
+	gl_error_guard(glNamedFramebufferRenderbuffer(target.framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color_renderbuffer));
+	gl_error_guard(glNamedFramebufferTexture(target.framebuffer, GL_DEPTH_ATTACHMENT, target.depth_texture, 0));
+
+	target.hiz_size = (size + 1) / 2;
+	target.hiz_levels = std::bit_width((unsigned)target.hiz_size);
+	gl_error_guard(glCreateTextures(GL_TEXTURE_2D, 1, &target.hiz_texture));
+	gl_error_guard(glTextureStorage2D(target.hiz_texture, target.hiz_levels, GL_R32F, target.hiz_size, target.hiz_size));
+	glTextureParameteri(target.hiz_texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTextureParameteri(target.hiz_texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureParameteri(target.hiz_texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(target.hiz_texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	GLenum status = glCheckNamedFramebufferStatus(target.framebuffer, GL_FRAMEBUFFER);
+	LOG(INFO) << "Skybox framebuffer " << size << "x" << size << " status: " << gl::enum_string(status);
+	return skybox_targets.emplace_back(target);
 }
 
 void UI::create_cube_vertices(gl::VertexBuffer<SolidVertex> &vertex_buffer) {
 	std::vector<SolidVertex> vertices;
 	auto push_face = [&](const glm::vec3 &p, const glm::vec3 &ux, const glm::vec3 &uy) {
-		const glm::vec3 n = glm::cross(ux, uy);
-		vertices.push_back({p, n});
-		vertices.push_back({p + ux, n});
-		vertices.push_back({p + ux + uy, n});
-		vertices.push_back({p, n});
-		vertices.push_back({p + ux + uy, n});
-		vertices.push_back({p + uy, n});
+		const gl::Int2_10_10_10Rev n(glm::normalize(glm::cross(ux, uy)));
+		auto vertex = [&](const glm::vec3 &position) {
+			vertices.push_back({gl::NormalizedVec<4, GLbyte>(glm::vec4(position, 1.0f)), n});
+		};
+		vertex(p);
+		vertex(p + ux);
+		vertex(p + ux + uy);
+		vertex(p);
+		vertex(p + ux + uy);
+		vertex(p + uy);
 	};
 	const glm::vec3 v0 = {-1, -1, -1};
 	const glm::vec3 v1 = {1, 1, 1};
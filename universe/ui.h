@@ -4,52 +4,268 @@
 
 #include <gl_cpp/gl.h>
 
+#include "asset_store.h"
 #include "math.h"
+#include "quality.h"
+#include "scene.h"
 #include "shaders.h"
+#include "skybox_prefetch.h"
+#include "volume.h"
+#include "world.h"
 
 class RpcServer;
 class GLFWwindow;
+class Task;
 class TaskQueue;
 class SkyboxTask;
+class SkyboxBatchTask;
 
 struct SolidVertex {
-	glm::vec3 position;
-	glm::vec3 normal;
+	// The cube mesh spans [-1, 1], so its positions fit normalized bytes
+	// exactly.
+	gl::NormalizedVec<4, GLbyte> position;
+	gl::Int2_10_10_10Rev normal;
 };
+static_assert(sizeof(SolidVertex) == 8);
 
-struct CubeInstance {
+// Object drawn as a cube mesh, as selected by the level of detail pass.
+struct LodMeshInstance {
 	glm::vec3 position;
-	glm::vec3 color;
-	float phase;
 	float scale;
-	glm::mat4 Model;
-	glm::mat3 Normal_model;
+	gl::NormalizedVec<4, GLubyte> color;
+	float phase;
+};
+// Written by lod_c.glsl.
+static_assert(sizeof(LodMeshInstance) == 24);
+
+// Object or cluster of objects drawn as a point, as selected by the level of
+// detail pass.
+struct LodPoint {
+	glm::vec3 position;
+	float radius;
+	gl::NormalizedVec<4, GLubyte> color;
+};
+// Written by lod_c.glsl.
+static_assert(sizeof(LodPoint) == 20);
+
+// Camera of a render pass. The projection is kept apart from the view
+// transform, because light clustering needs its parameters.
+struct Camera {
+	glm::mat4 view;
+	float fov_y;
+	glm::vec2 viewport_size;
+	float near = 0.1f;
+	float far = 100.0f;
+
+	float aspect() const { return viewport_size.x / viewport_size.y; }
+
+	glm::mat4 projection() const {
+		return glm::perspective(fov_y, aspect(), near, far) * view;
+	}
+};
+
+struct LodOptions {
+	// Objects smaller than this on screen, in pixels, are drawn as points.
+	float mesh_min_pixels = 4.0f;
+	// Objects and clusters smaller than this are merged into one point per
+	// cluster.
+	float point_min_pixels = 1.0f;
+	// Edge length of the cells the scene is clustered by. Picked automatically
+	// if 0.
+	float cluster_size = 0.0f;
+	// Whether the meshes of skybox faces go through occlusion culling.
+	bool occlusion_culling = true;
+};
+
+// Render target for skybox faces of a single size.
+struct SkyboxTarget {
+	int size;
+	GLuint framebuffer;
+	GLuint color_renderbuffer;
+	// A texture, so that the hierarchical depth buffer can be built from it.
+	GLuint depth_texture;
+	// Hierarchical depth buffer for occlusion culling. Level 0 is half the size.
+	GLuint hiz_texture;
+	int hiz_size;
+	int hiz_levels;
+
+	// Cube map with a full mip chain, created on first use. Used instead of the
+	// color renderbuffer when the request asks for mipmaps.
+	GLuint cubemap = 0;
+	int cubemap_levels = 0;
+	// Whether the cube map currently holds the skybox at mips_position, rendered
+	// at mips_lod_scale, so that smaller requests at the same position and with
+	// at most that level of detail can be served from its levels.
+	bool has_mips = false;
+	glm::vec3 mips_position;
+	float mips_lod_scale = 1.0f;
+};
+
+// GPU time and occlusion counters of a skybox render, collected into the stats
+// once the GPU is done with it.
+struct RenderStatsFrame {
+	GLuint timer_query = 0;
+	// Copy of the counters of the faces from the occlusion command buffer.
+	GLuint counter_buffer = 0;
+	bool has_occlusion_counters = false;
+	// Signaled once the counters are copied. Null unless in flight.
+	GLsync fence = nullptr;
 };
 
 class UI {
+	// Face size used when the request doesn't specify one.
 	static constexpr int SKYBOX_SIZE = 512;
+	static constexpr int MIN_SKYBOX_SIZE = 16;
+	static constexpr int MAX_SKYBOX_SIZE = 2048;
+	// Face size of the first response to a progressive request. Each refinement
+	// doubles it.
+	static constexpr int PROGRESSIVE_SKYBOX_SIZE = 64;
+	// Cap on the width of a skybox resampled into a single image.
+	static constexpr int MAX_PROJECTION_WIDTH = 4096;
+	// Number of positions of a batch rendered per step, so that a long batch
+	// doesn't hold up other tasks.
+	static constexpr int SKYBOX_BATCH_SLICE = 16;
+	// Distance between the slots of occlusion_command_buffer. A multiple of any
+	// GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT out there.
+	static constexpr GLintptr OCCLUSION_COMMAND_STRIDE = 256;
+	// Cap on the raymarching steps through the volume per pixel.
+	static constexpr int VOLUME_MAX_STEPS = 256;
+	// A skybox stages well under a kilobyte.
+	static constexpr GLsizeiptr STAGING_REGION_SIZE = 16 * 1024;
 
 	GLFWwindow *window = nullptr;
 	TaskQueue &tasks;
-	uint8_t *skybox_pixels = nullptr;
+	// Before the asset store, whose writer thread records into it.
+	QualityController quality;
+	// Where the images the responses refer to are written.
+	AssetStore assets;
+	std::vector<uint8_t> skybox_pixels;
+	// RGBA pixels read back from the GPU, before they are packed into
+	// skybox_pixels.
+	std::vector<uint8_t> skybox_readback_pixels;
 	GLuint default_frmaebuffer = 0;
-	GLuint skybox_framebuffer = 0;
+	// Created on first use and reused by all later tasks of the same size. Sizes
+	// are powers of two, see skybox_size(), so there are only a few of them.
+	std::vector<SkyboxTarget> skybox_targets;
+	// Pixel pack buffers for pipelined readback of batched skyboxes. While one
+	// is being encoded, the GPU renders the next skybox into the other.
+	GLuint skybox_readback_buffers[2] = {};
+	GLsync skybox_readback_fences[2] = {};
+	GLsizeiptr skybox_readback_capacity = 0;
+	// Skyboxes requested in a projection other than the cube map are resampled
+	// into this before readback. Recreated whenever the size changes.
+	GLuint projection_texture = 0;
+	glm::ivec2 projection_texture_size = {0, 0};
+	SkyboxPrefetcher skybox_prefetcher;
 	Shaders shaders;
+	// Per-pass data, like the initial draw commands and the camera lights, is
+	// written here and copied into place on the GPU, in order with the passes
+	// that use it. Each window frame and each skybox takes a region.
+	gl::StreamingBuffer staging_buffer;
 	GLuint vertex_array;
 	GLuint cube_vertex_array;
 	gl::VertexBuffer<SolidVertex> cube_vertices;
-	std::vector<CubeInstance> cubes;
+	// The scene columns are uploaded once, straight from the scene. Before each
+	// pass, the level of detail pass picks from them the objects drawn as
+	// instances of the cube and the ones drawn as points.
+	const SceneColumns scene;
+	const LodOptions lod_options;
+	gl::VertexBuffer<glm::vec3> instance_positions;
+	gl::VertexBuffer<float> instance_scales;
+	gl::VertexBuffer<glm::vec3> instance_colors;
+	gl::VertexBuffer<float> instance_phases;
+	GLuint lod_cluster_buffer = 0;
+	GLuint lod_order_buffer = 0;
+	GLuint lod_cluster_count = 0;
+	// Index of the object of each of lod_meshes.
+	GLuint lod_mesh_object_buffer = 0;
+	// Indirect draw commands for the meshes and the points, filled in by the
+	// level of detail pass.
+	GLuint lod_command_buffer = 0;
+	gl::VertexBuffer<LodMeshInstance> lod_meshes;
+	gl::VertexBuffer<LodPoint> lod_points;
+	GLuint point_vertex_array;
+	// Viewpoint of the last level of detail pass.
+	glm::vec3 lod_eye;
+	float lod_pixels_per_unit;
+	// Occlusion culling of the skybox faces. The visibility has a bit per face
+	// for every object. Each face has its own slot of draw commands and
+	// counters, copied out for the stats at the end of the skybox.
+	GLuint occlusion_visibility_buffer = 0;
+	GLuint occlusion_command_buffer = 0;
+	bool has_occlusion_counters = false;
+	gl::VertexBuffer<LodMeshInstance> culled_meshes;
+	GLuint culled_vertex_array;
+	// Procedurally generated world around the skybox positions, if enabled.
+	// Drawn like the scene, from its own instance buffers, where each resident
+	// chunk takes a slot of objects_per_chunk instances.
+	unique_ptr<ChunkedWorld> world;
+	GLuint world_vertex_array = 0;
+	gl::VertexBuffer<glm::vec3> chunk_positions;
+	gl::VertexBuffer<float> chunk_scales;
+	gl::VertexBuffer<glm::vec3> chunk_colors;
+	gl::VertexBuffer<float> chunk_phases;
+	// Volume drawn over the scene of the skyboxes, if any. The atlas has a slot
+	// of (brick_size + 2)^3 voxels for each resident brick, and the indirection
+	// texture a texel for each brick of the volume with its slot, or zero if it
+	// isn't resident. Bricks are uploaded through a ring of pixel unpack buffers.
+	unique_ptr<BrickedVolume> volume;
+	gl::Texture3D volume_atlas{GL_RGBA8};
+	gl::Texture3D volume_indirection{GL_RGBA8UI};
+	glm::ivec3 volume_atlas_slots;
+	gl::StreamingBuffer volume_upload_buffer;
+	GLuint volume_vertex_array = 0;
+	// The camera lights followed by the lights of the scene, and their
+	// assignment to the clusters of the current pass.
+	GLuint light_buffer = 0;
+	GLuint light_count = 0;
+	GLuint cluster_light_count_buffer = 0;
+	GLuint cluster_light_buffer = 0;
+	// Where the last skybox was seen from. The camera lights move along with it.
+	glm::vec3 camera_position = {0.0f, 0.0f, 0.0f};
+	// Stats of the latest skybox renders, taking turns, so that a frame is
+	// collected while the next one renders, without waiting for the GPU.
+	RenderStatsFrame render_stats_frames[2];
+	int render_stats_frame = 0;
 
 public:
-	UI(TaskQueue &tasks);
+	UI(TaskQueue &tasks, const SceneColumns &scene, const LodOptions &lod_options, const WorldOptions &world_options, const VolumeOptions &volume_options, const SkyboxPrefetchOptions &prefetch_options, const AssetStoreOptions &asset_options, const QualityOptions &quality_options);
 	~UI();
 
 	void event_loop(const RpcServer *rpc_server);
 
 private:
 	void on_key(int key, int scancode, int action, int mods);
+	void upload_scene();
+	void create_world_buffers();
+	void upload_chunk(int slot, const SceneBuffer &objects);
+	void create_volume_textures();
+	void upload_brick(int slot, const glm::ivec3 &coords, const std::byte *voxels);
+	void evict_brick(int slot, const glm::ivec3 &coords);
+	void update_volume();
+	void draw_volume(const Camera &camera, SkyboxTarget &target);
+	void select_lod(const glm::vec3 &eye, float pixels_per_unit);
+	void upload_lights();
+	void assign_lights(const Camera &camera);
+	void draw_scene(const Camera &camera, SkyboxTarget *target = nullptr, int face = 0);
+	void draw_culled_meshes(const glm::mat4 &projection, SkyboxTarget &target, int face);
+	void build_hiz(SkyboxTarget &target);
+	void collect_render_stats();
 	void process_tasks();
+	void prefetch_skyboxes();
 	void process_skybox_task(SkyboxTask &task);
+	void process_skybox_batch_task(SkyboxBatchTask &task);
+	void send_batch_skybox(SkyboxBatchTask &task, int index, int size, int count);
+	void respond_after_assets(unique_ptr<Task> &&task, int quality_tier = -1);
+	static int skybox_size(int resolution);
+	SkyboxTarget &skybox_target(int size);
+	void render_skybox(const glm::vec3 &position, SkyboxTarget &target, bool to_cubemap, GLuint pack_buffer = 0, float lod_scale = 1.0f);
+	int read_skybox_mips(const SkyboxTarget &target);
+	bool read_cached_mip(const glm::vec3 &position, int size, float lod_scale);
+	int project_skybox(const glm::vec3 &position, SkyboxTarget &target, bool is_octahedral, int width, float lod_scale);
+
+	template <typename T, size_t N>
+	void stage(GLuint buffer_id, GLintptr offset, const T (&data)[N]);
 
 	static void create_cube_vertices(gl::VertexBuffer<SolidVertex> &vertex_buffer);
 };
\ No newline at end of file
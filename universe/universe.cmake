@@ -31,3 +31,53 @@ target_link_libraries(universe_server
   proto_cpp
   universe_proto_cpp
 )
+
+add_executable(universe_scene_gen
+  "${PKG_SRC_DIR}/scene_gen/scene_gen.cpp"
+  "${PKG_SRC_DIR}/scene.cpp"
+  "${PKG_SRC_DIR}/volume.cpp"
+)
+target_link_libraries(universe_scene_gen
+  ${GRPC_LIBS}
+  glm
+)
+
+# Tests of the parts of the server that don't need OpenGL.
+file(GLOB UNIVERSE_TEST_SRCS "${PKG_SRC_DIR}/test/*.cpp")
+add_executable(universe_test
+  ${UNIVERSE_TEST_SRCS}
+  "${ROOT_DIR}/common_cpp/test_main.cpp"
+  "${PKG_SRC_DIR}/asset_store.cpp"
+  "${PKG_SRC_DIR}/qoi.cpp"
+  "${PKG_SRC_DIR}/quality.cpp"
+  "${PKG_SRC_DIR}/scene.cpp"
+  "${PKG_SRC_DIR}/skybox_delta.cpp"
+  "${PKG_SRC_DIR}/task.cpp"
+  "${PKG_SRC_DIR}/trace.cpp"
+  "${PKG_SRC_DIR}/volume.cpp"
+  "${PKG_SRC_DIR}/world.cpp"
+)
+target_link_libraries(universe_test
+  ${GRPC_LIBS}
+  glm
+  proto_cpp
+  universe_proto_cpp
+)
+add_test(NAME universe_test COMMAND universe_test)
+
+# Counts the heap allocations of the whole binary, by replacing the global
+# operator new, so it is kept apart from the other tests.
+add_executable(universe_alloc_test
+  "${PKG_SRC_DIR}/test/alloc/allocation_count.cpp"
+  "${PKG_SRC_DIR}/test/alloc/task_alloc_test.cpp"
+  "${ROOT_DIR}/common_cpp/test_main.cpp"
+  "${PKG_SRC_DIR}/skybox_delta.cpp"
+  "${PKG_SRC_DIR}/task.cpp"
+  "${PKG_SRC_DIR}/trace.cpp"
+)
+target_link_libraries(universe_alloc_test
+  ${GRPC_LIBS}
+  proto_cpp
+  universe_proto_cpp
+)
+add_test(NAME universe_alloc_test COMMAND universe_alloc_test)
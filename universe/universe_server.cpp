@@ -4,18 +4,45 @@
 #include <absl/flags/usage.h>
 #include <cstdlib>
 #include <ctime>
-#include <iostream>
+#include <fstream>
 #include <memory>
 
+#include <common_cpp/log.h>
+
 #include "common.h"
 
 #include "rpc.h"
+#include "scene.h"
 #include "task.h"
+#include "trace.h"
 #include "ui.h"
 
-using std::cout, std::endl;
-
 ABSL_FLAG(string, port, "8100", "Listening port");
+ABSL_FLAG(string, log_level, "info", "Least severe level of the messages logged: debug, info, warning or error.");
+ABSL_FLAG(string, scene, "", "Scene file to load, as written by universe_scene_gen. A small built-in scene is used if empty.");
+ABSL_FLAG(int, max_stream_tasks, TaskLimits().max_stream_tasks, "Maximum number of tasks in flight per stream. Reading from a stream pauses when reached.");
+ABSL_FLAG(int, max_server_tasks, TaskLimits().max_server_tasks, "Maximum number of tasks in flight across all streams. New tasks are rejected when reached.");
+ABSL_FLAG(float, lod_mesh_pixels, LodOptions().mesh_min_pixels, "Objects smaller than this on screen, in pixels, are drawn as points. 0 draws every object as a mesh.");
+ABSL_FLAG(float, lod_point_pixels, LodOptions().point_min_pixels, "Objects and clusters of objects smaller than this on screen, in pixels, are merged into one point per cluster. 0 disables merging.");
+ABSL_FLAG(float, lod_cluster_size, LodOptions().cluster_size, "Edge length of the cells the scene is clustered by for level of detail. 0 picks one from the scene size.");
+ABSL_FLAG(bool, occlusion_culling, LodOptions().occlusion_culling, "Whether to skip the meshes hidden behind nearer ones when rendering skyboxes. The occlusion_* job metrics count the culled ones.");
+ABSL_FLAG(int, world_max_chunks, WorldOptions().max_chunks, "Maximum number of procedurally generated world chunks resident at once. 0 disables the procedural world.");
+ABSL_FLAG(uint64_t, world_seed, WorldOptions().seed, "Seed of the procedural world");
+ABSL_FLAG(float, world_chunk_size, WorldOptions().chunk_size, "Edge length of the procedural world chunks");
+ABSL_FLAG(int, world_objects_per_chunk, WorldOptions().objects_per_chunk, "Number of objects in each procedural world chunk");
+ABSL_FLAG(int, world_load_radius, WorldOptions().load_radius, "Radius, in chunks, of the procedural world loaded around each skybox position");
+ABSL_FLAG(int, world_threads, WorldOptions().thread_count, "Number of threads generating the procedural world. 0 uses all hardware threads.");
+ABSL_FLAG(string, volume, VolumeOptions().path, "Volume file, e.g. of nebulae, as written by universe_scene_gen --volume_out, to stream around the skybox positions. No volume if empty.");
+ABSL_FLAG(int, volume_budget_mb, VolumeOptions().budget_mb, "Video memory for the resident bricks of the volume, in megabytes");
+ABSL_FLAG(int, volume_uploads_per_frame, VolumeOptions().uploads_per_frame, "Maximum number of volume bricks uploaded per frame");
+ABSL_FLAG(float, volume_load_radius, VolumeOptions().load_radius, "Volume bricks within this distance of recent skybox positions are loaded");
+ABSL_FLAG(float, volume_density_scale, VolumeOptions().density_scale, "Extinction of the volume per unit of length at full density");
+ABSL_FLAG(int, skybox_prefetch_lookahead, SkyboxPrefetchOptions().lookahead, "Number of predicted skyboxes to prefetch ahead of each stream's trajectory when idle. 0 disables prefetching.");
+ABSL_FLAG(int, skybox_prefetch_budget, SkyboxPrefetchOptions().budget, "Maximum number of skyboxes prefetched per idle frame.");
+ABSL_FLAG(string, asset_dir, AssetStoreOptions().dir, "Directory the skybox images are written to, relative to the directory the frontend serves. Files in it may be deleted.");
+ABSL_FLAG(int, asset_budget_mb, AssetStoreOptions().budget_mb, "Disk space for the skybox images, in megabytes. The least recently produced ones are deleted beyond it.");
+ABSL_FLAG(float, latency_target_ms, QualityOptions().latency_target_ms, "Target for the 95th percentile of the skybox latency, in milliseconds. Under load, skyboxes are rendered at a lower level of detail and resolution to meet it. 0 never lowers the quality.");
+ABSL_FLAG(string, trace_out, "", "File to write the trace of the tasks to on exit, in the Chrome trace event format. Tracing is on from the start if set, and can be toggled and dumped through the Trace job RPC either way.");
 
 int main(int argc, char **argv) {
 	try {
@@ -23,21 +50,78 @@ int main(int argc, char **argv) {
 		absl::ParseCommandLine(argc, argv);
 		string port_string = absl::GetFlag(FLAGS_port);
 
+		logging::Level log_level;
+		if (!logging::parse_level(absl::GetFlag(FLAGS_log_level), log_level)) {
+			throw std::runtime_error("Invalid log level " + squote(absl::GetFlag(FLAGS_log_level)));
+		}
+		logging::set_min_level(log_level);
+
 		std::srand(std::time(0));
 
-		TaskQueue tasks;
+		const string trace_path = absl::GetFlag(FLAGS_trace_out);
+		trace::set_enabled(!trace_path.empty());
+
+		// The file stays mapped for the lifetime of the server, since the columns
+		// point into it.
+		unique_ptr<SceneFile> scene_file;
+		SceneBuffer scene_buffer;
+		SceneColumns scene;
+		if (string scene_path = absl::GetFlag(FLAGS_scene); !scene_path.empty()) {
+			scene_file = make_unique<SceneFile>(scene_path);
+			scene = scene_file->columns();
+			LOG(INFO) << "Mapped scene file " << scene_path << " with " << scene.count << " objects";
+		} else {
+			scene_buffer = default_scene();
+			scene = scene_buffer.columns();
+		}
+
+		TaskQueue tasks({
+			.max_stream_tasks = absl::GetFlag(FLAGS_max_stream_tasks),
+			.max_server_tasks = absl::GetFlag(FLAGS_max_server_tasks),
+		});
 
 		RpcServer rpc_server(argc, argv, tasks);
 		rpc_server.start("localhost:" + port_string);
-		cout << "Listening on port " << rpc_server.port() << endl;
+		LOG(INFO) << "Listening on port " << rpc_server.port();
 
-		UI ui(tasks);
+		UI ui(tasks, scene, {
+			.mesh_min_pixels = absl::GetFlag(FLAGS_lod_mesh_pixels),
+			.point_min_pixels = absl::GetFlag(FLAGS_lod_point_pixels),
+			.cluster_size = absl::GetFlag(FLAGS_lod_cluster_size),
+			.occlusion_culling = absl::GetFlag(FLAGS_occlusion_culling),
+		}, {
+			.max_chunks = absl::GetFlag(FLAGS_world_max_chunks),
+			.seed = absl::GetFlag(FLAGS_world_seed),
+			.chunk_size = absl::GetFlag(FLAGS_world_chunk_size),
+			.objects_per_chunk = absl::GetFlag(FLAGS_world_objects_per_chunk),
+			.load_radius = absl::GetFlag(FLAGS_world_load_radius),
+			.thread_count = absl::GetFlag(FLAGS_world_threads),
+		}, {
+			.path = absl::GetFlag(FLAGS_volume),
+			.budget_mb = absl::GetFlag(FLAGS_volume_budget_mb),
+			.uploads_per_frame = absl::GetFlag(FLAGS_volume_uploads_per_frame),
+			.load_radius = absl::GetFlag(FLAGS_volume_load_radius),
+			.density_scale = absl::GetFlag(FLAGS_volume_density_scale),
+		}, {
+			.lookahead = absl::GetFlag(FLAGS_skybox_prefetch_lookahead),
+			.budget = absl::GetFlag(FLAGS_skybox_prefetch_budget),
+		}, {
+			.dir = absl::GetFlag(FLAGS_asset_dir),
+			.budget_mb = absl::GetFlag(FLAGS_asset_budget_mb),
+		}, {
+			.latency_target_ms = absl::GetFlag(FLAGS_latency_target_ms),
+		});
 		ui.event_loop(&rpc_server);
+
+		if (!trace_path.empty()) {
+			std::ofstream(trace_path) << trace::dump_json();
+			LOG(INFO) << "Wrote trace to " << trace_path;
+		}
 	} catch (std::exception &e) {
-		cout << e.what() << endl;
+		LOG(ERROR) << e.what();
 		return 1;
 	} catch (...) {
-		cout << "Unknown error" << endl;
+		LOG(ERROR) << "Unknown error";
 		return 1;
 	}
 
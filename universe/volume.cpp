@@ -0,0 +1,242 @@
+#include "volume.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <common_cpp/log.h>
+
+static size_t align_up(size_t offset) {
+	return (offset + VolumeFile::ALIGNMENT - 1) / VolumeFile::ALIGNMENT * VolumeFile::ALIGNMENT;
+}
+
+VolumeFile::VolumeFile(const string &path)
+		: in(path, std::ios::binary) {
+	if (!in) {
+		throw std::runtime_error("Failed to open volume file " + squote(path));
+	}
+	auto fail = [&](const string &reason) {
+		throw std::runtime_error("Invalid volume file " + squote(path) + ": " + reason);
+	};
+	in.seekg(0, std::ios::end);
+	const uint64_t size = in.tellg();
+	in.seekg(0);
+	if (!in.read(reinterpret_cast<char *>(&_header), sizeof(_header))) {
+		fail("too short");
+	}
+	if (std::memcmp(_header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+		fail("bad magic");
+	}
+	if (_header.version != VERSION) {
+		fail("unsupported version " + to_string(_header.version));
+	}
+	if (_header.header_size < sizeof(VolumeFileHeader) || _header.header_size > size) {
+		fail("header size " + to_string(_header.header_size) + " doesn't fit version " + to_string(_header.version));
+	}
+	const glm::ivec3 &g = _header.grid_size;
+	if (g.x <= 0 || g.y <= 0 || g.z <= 0 || _header.brick_size == 0 || _header.voxel_size <= 0) {
+		fail("empty volume");
+	}
+	if (_header.brick_size > MAX_BRICK_SIZE) {
+		fail("brick size " + to_string(_header.brick_size) + " above the maximum of " + to_string(MAX_BRICK_SIZE));
+	}
+	if (_header.bricks_offset > size || (size - _header.bricks_offset) / sizeof(VolumeBrickEntry) < _header.brick_count) {
+		fail("brick table out of bounds");
+	}
+	_bricks.resize(_header.brick_count);
+	in.seekg(_header.bricks_offset);
+	if (!in.read(reinterpret_cast<char *>(_bricks.data()), _bricks.size() * sizeof(VolumeBrickEntry))) {
+		fail("failed to read brick table");
+	}
+	for (const VolumeBrickEntry &entry : _bricks) {
+		const glm::ivec3 &c = entry.coords;
+		if (c.x < 0 || c.y < 0 || c.z < 0 || c.x >= g.x || c.y >= g.y || c.z >= g.z) {
+			fail("brick outside of the grid");
+		}
+		if (entry.offset % ALIGNMENT != 0 || entry.offset > size || size - entry.offset < brick_bytes()) {
+			fail("brick at " + to_string(entry.offset) + " out of bounds");
+		}
+	}
+}
+
+void VolumeFile::read_brick(size_t index, std::byte *voxels) {
+	in.seekg(_bricks[index].offset);
+	if (!in.read(reinterpret_cast<char *>(voxels), brick_bytes())) {
+		throw std::runtime_error("Failed to read volume brick " + to_string(index));
+	}
+}
+
+void VolumeFile::write(const string &path, VolumeFileHeader header, const BrickFunction &brick) {
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.header_size = sizeof(VolumeFileHeader);
+	if (header.brick_size == 0 || header.brick_size > MAX_BRICK_SIZE) {
+		throw std::runtime_error("Volume brick size " + to_string(header.brick_size) + " not between 1 and " + to_string(MAX_BRICK_SIZE));
+	}
+
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		throw std::runtime_error("Failed to open " + squote(path) + " for writing");
+	}
+	// The header is written again at the end, once the brick table is known.
+	size_t offset = 0;
+	auto write_at = [&](uint64_t at, const void *bytes, size_t byte_count) {
+		static const char padding[ALIGNMENT] = {};
+		out.write(padding, at - offset);
+		out.write(static_cast<const char *>(bytes), byte_count);
+		offset = at + byte_count;
+	};
+	write_at(0, &header, sizeof(header));
+
+	const size_t brick_bytes = VolumeFile::brick_bytes(header.brick_size);
+	std::vector<std::byte> voxels(brick_bytes);
+	std::vector<VolumeBrickEntry> entries;
+	const glm::ivec3 &g = header.grid_size;
+	for (int z = 0; z < g.z; ++z) {
+		for (int y = 0; y < g.y; ++y) {
+			for (int x = 0; x < g.x; ++x) {
+				if (!brick({x, y, z}, voxels.data())) {
+					continue;
+				}
+				entries.push_back({.coords = {x, y, z}, ._padding = 0, .offset = align_up(offset)});
+				write_at(entries.back().offset, voxels.data(), brick_bytes);
+			}
+		}
+	}
+	header.brick_count = entries.size();
+	header.bricks_offset = align_up(offset);
+	write_at(header.bricks_offset, entries.data(), entries.size() * sizeof(VolumeBrickEntry));
+
+	out.seekp(0);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	if (!out.flush()) {
+		throw std::runtime_error("Failed to write " + squote(path));
+	}
+}
+
+BrickedVolume::BrickedVolume(const VolumeOptions &options)
+		: options(options), file(options.path), loader(1) {
+	const size_t budget = (size_t)std::max(options.budget_mb, 0) << 20;
+	if (budget < file.brick_bytes()) {
+		throw std::runtime_error("Volume budget of " + to_string(options.budget_mb) + " MB doesn't fit a brick of "
+				+ to_string(file.brick_bytes()) + " bytes");
+	}
+	_slot_count = std::min<size_t>(budget / file.brick_bytes(), file.bricks().size());
+	for (int slot = _slot_count - 1; slot >= 0; --slot) {
+		free_slots.push_back(slot);
+	}
+	const VolumeFileHeader &h = file.header();
+	const float brick_extent = h.brick_size * h.voxel_size;
+	reach = options.load_radius + 0.5f * std::sqrt(3.0f) * brick_extent;
+	bricks.reserve(file.bricks().size());
+	for (const VolumeBrickEntry &entry : file.bricks()) {
+		bricks.push_back({.center = h.origin + (glm::vec3(entry.coords) + 0.5f) * brick_extent});
+	}
+	LOG(INFO) << "Volume " << squote(options.path) << " with " << bricks.size() << " bricks of " << h.brick_size
+						<< " voxels, " << _slot_count << " of them resident at most";
+}
+
+void BrickedVolume::focus(const glm::vec3 &position) {
+	recent_positions.push_back(position);
+	while ((int)recent_positions.size() > options.recent_position_count) {
+		recent_positions.pop_front();
+	}
+
+	// The nearest of the bricks around, as many as there are slots. Farther
+	// ones would only be evicted again right away.
+	std::vector<std::pair<float, size_t>> nearby;
+	for (size_t i = 0; i < bricks.size(); ++i) {
+		const float distance = glm::distance(bricks[i].center, position);
+		if (distance <= reach) {
+			nearby.emplace_back(distance, i);
+		}
+	}
+	const size_t count = std::min<size_t>(nearby.size(), _slot_count);
+	std::partial_sort(nearby.begin(), nearby.begin() + count, nearby.end());
+	for (size_t k = 0; k < count; ++k) {
+		const size_t index = nearby[k].second;
+		if (bricks[index].state != BrickState::ABSENT) {
+			continue;
+		}
+		bricks[index].state = BrickState::LOADING;
+		loader.submit([this, index] {
+			std::vector<std::byte> voxels(file.brick_bytes());
+			try {
+				file.read_brick(index, voxels.data());
+			} catch (std::exception &e) {
+				// Stays loading, so it isn't tried again.
+				LOG(ERROR) << e.what();
+				return;
+			}
+			std::lock_guard<std::mutex> lock(loaded_mut);
+			loaded_bricks.emplace_back(index, std::move(voxels));
+		});
+	}
+}
+
+void BrickedVolume::update(const UploadFunction &upload, const EvictFunction &evict) {
+	{
+		std::lock_guard<std::mutex> lock(loaded_mut);
+		for (auto &loaded : loaded_bricks) {
+			pending_uploads.push_back(std::move(loaded));
+		}
+		loaded_bricks.clear();
+	}
+	for (int uploaded = 0; uploaded < options.uploads_per_frame && !pending_uploads.empty();) {
+		auto [index, voxels] = std::move(pending_uploads.front());
+		pending_uploads.pop_front();
+		Brick &brick = bricks[index];
+		const float p = priority(brick);
+		const int slot = p <= reach ? acquire_slot(p, evict) : -1;
+		if (slot < 0) {
+			// No longer around, or less relevant than everything resident. It is
+			// read again if it is ever needed.
+			brick.state = BrickState::ABSENT;
+			continue;
+		}
+		upload(slot, file.bricks()[index].coords, voxels.data());
+		brick.state = BrickState::RESIDENT;
+		brick.slot = slot;
+		++uploaded;
+	}
+}
+
+// Lower is more relevant. Distance from the center of the brick to the nearest
+// recent position.
+float BrickedVolume::priority(const Brick &brick) const {
+	float distance = INFINITY;
+	for (const glm::vec3 &position : recent_positions) {
+		distance = std::min(distance, glm::distance(brick.center, position));
+	}
+	return distance;
+}
+
+// Returns a free slot, evicting the least relevant resident brick if it is less
+// relevant than the given priority, or -1 if there is no such brick.
+int BrickedVolume::acquire_slot(float priority, const EvictFunction &evict) {
+	if (!free_slots.empty()) {
+		const int slot = free_slots.back();
+		free_slots.pop_back();
+		return slot;
+	}
+	Brick *evicted = nullptr;
+	float evicted_priority = priority;
+	for (Brick &brick : bricks) {
+		if (brick.state != BrickState::RESIDENT) {
+			continue;
+		}
+		const float p = this->priority(brick);
+		if (p > evicted_priority) {
+			evicted = &brick;
+			evicted_priority = p;
+		}
+	}
+	if (!evicted) {
+		return -1;
+	}
+	const int slot = evicted->slot;
+	evict(slot, file.bricks()[evicted - bricks.data()].coords);
+	evicted->state = BrickState::ABSENT;
+	evicted->slot = -1;
+	return slot;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <common_cpp/thread_pool.h>
+
+#include "common.h"
+#include "math.h"
+
+// Header at the start of a volume file. All integers are little endian. The
+// brick table follows at bricks_offset, and the bricks themselves at the
+// offsets in the table, each a multiple of VolumeFile::ALIGNMENT.
+//
+// The volume is a grid of cubic bricks of brick_size voxels. Only the bricks
+// that aren't empty are in the file. Each is stored with an apron of one voxel
+// on every side, copied from the neighbors, as (brick_size + 2)^3 RGBA8
+// voxels with x varying fastest: the emitted color and the density.
+struct VolumeFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	// Size of the volume in bricks.
+	glm::ivec3 grid_size;
+	uint32_t brick_size;
+	// Corner of the volume with the lowest coordinates, in world space.
+	glm::vec3 origin;
+	float voxel_size;
+	uint64_t brick_count;
+	uint64_t bricks_offset;
+};
+static_assert(sizeof(VolumeFileHeader) == 64);
+
+struct VolumeBrickEntry {
+	glm::ivec3 coords;
+	uint32_t _padding;
+	uint64_t offset;
+};
+static_assert(sizeof(VolumeBrickEntry) == 24);
+
+// Volume file opened for reading. The header and the brick table are read up
+// front, and the bricks when asked for.
+class VolumeFile {
+	std::ifstream in;
+	VolumeFileHeader _header;
+	std::vector<VolumeBrickEntry> _bricks;
+
+public:
+	static constexpr char MAGIC[8] = {'S', 'P', 'J', 'S', 'V', 'O', 'L', 'M'};
+	static constexpr uint32_t VERSION = 1;
+	static constexpr size_t ALIGNMENT = 64;
+	// Largest brick_size accepted. Bricks are read whole into memory, and their
+	// size grows with the cube of it.
+	static constexpr uint32_t MAX_BRICK_SIZE = 256;
+
+	// Throws std::runtime_error if it is not a valid volume file.
+	VolumeFile(const string &path);
+	VolumeFile(const VolumeFile &) = delete;
+
+	const VolumeFileHeader &header() const { return _header; }
+
+	const std::vector<VolumeBrickEntry> &bricks() const { return _bricks; }
+
+	// Bytes of a brick, including the apron.
+	size_t brick_bytes() const { return brick_bytes(_header.brick_size); }
+
+	// Reads the voxels of the brick at the index in bricks(). Not thread safe.
+	void read_brick(size_t index, std::byte *voxels);
+
+	static size_t brick_bytes(uint32_t brick_size) {
+		const size_t size = brick_size + 2;
+		return size * size * size * 4;
+	}
+
+	// Writes a file of the volume described by the header. The brick function
+	// fills in the voxels of the brick at the coordinates, apron included, and
+	// returns false if it is empty and should be left out. The brick_count and
+	// bricks_offset of the header are filled in. Throws std::runtime_error if the
+	// brick_size is 0 or above MAX_BRICK_SIZE.
+	typedef std::function<bool(const glm::ivec3 &coords, std::byte *voxels)> BrickFunction;
+	static void write(const string &path, VolumeFileHeader header, const BrickFunction &brick);
+};
+
+struct VolumeOptions {
+	// Volume file to stream from, as written by universe_scene_gen. There is no
+	// volume if empty.
+	string path;
+	// Memory for the resident bricks, in megabytes. This is what the brick atlas
+	// takes in video memory.
+	int budget_mb = 256;
+	// Maximum number of bricks uploaded per frame, so that streaming in a new
+	// region doesn't stall the frames.
+	int uploads_per_frame = 16;
+	// Bricks within this distance of a recent skybox position are made resident.
+	float load_radius = 200.0f;
+	// How many of the latest positions count as recent.
+	int recent_position_count = 8;
+	// Extinction per unit of length at full density.
+	float density_scale = 0.05f;
+};
+
+// Sparse volume, like a nebula, streamed brick by brick from a volume file into
+// a fixed number of slots, as many as fit in the memory budget.
+//
+// Skybox positions given to focus() make the bricks around them wanted. The
+// bricks are read from the file on a worker thread and handed to the upload
+// callback a few per update(), along with their slot. When all slots are taken,
+// the brick farthest from every recent position is evicted, which the evict
+// callback is told about.
+//
+// Only accessed from the render thread.
+class BrickedVolume {
+public:
+	typedef std::function<void(int slot, const glm::ivec3 &coords, const std::byte *voxels)> UploadFunction;
+	typedef std::function<void(int slot, const glm::ivec3 &coords)> EvictFunction;
+
+	const VolumeOptions options;
+
+	// Throws std::runtime_error if the file is invalid, or if not even one brick
+	// fits in the budget.
+	BrickedVolume(const VolumeOptions &options);
+	BrickedVolume(const BrickedVolume &) = delete;
+
+	const VolumeFileHeader &header() const { return file.header(); }
+
+	size_t brick_bytes() const { return file.brick_bytes(); }
+
+	int slot_count() const { return _slot_count; }
+
+	int resident_count() const { return _slot_count - free_slots.size(); }
+
+	// Records a position of interest and starts reading the missing bricks
+	// around it.
+	void focus(const glm::vec3 &position);
+
+	// Uploads up to uploads_per_frame of the bricks that have been read.
+	void update(const UploadFunction &upload, const EvictFunction &evict);
+
+private:
+	enum class BrickState {
+		ABSENT,
+		LOADING,
+		RESIDENT,
+	};
+
+	struct Brick {
+		glm::vec3 center;
+		BrickState state = BrickState::ABSENT;
+		int slot = -1;
+	};
+
+	VolumeFile file;
+	int _slot_count;
+	// Bricks with the center within this distance of a position are around it.
+	float reach;
+	// Parallel to the brick table of the file.
+	std::vector<Brick> bricks;
+	std::vector<int> free_slots;
+	std::deque<glm::vec3> recent_positions;
+	// Read, but waiting for their turn to be uploaded.
+	std::deque<std::pair<size_t, std::vector<std::byte>>> pending_uploads;
+
+	std::mutex loaded_mut;
+	std::vector<std::pair<size_t, std::vector<std::byte>>> loaded_bricks;
+
+	// A single thread, since the file is read sequentially anyway. Last, so that
+	// it is destroyed first and its jobs can't touch anything destroyed already.
+	ThreadPool loader;
+
+	float priority(const Brick &brick) const;
+	int acquire_slot(float priority, const EvictFunction &evict);
+};
@@ -0,0 +1,217 @@
+#include "world.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <common_cpp/log.h>
+
+static bool is_in_bounds(const glm::ivec3 &coords) {
+	for (int i = 0; i < 3; ++i) {
+		if (coords[i] < -ChunkedWorld::COORD_LIMIT || coords[i] >= ChunkedWorld::COORD_LIMIT) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Unique for the coordinates within bounds.
+static uint64_t chunk_key(const glm::ivec3 &coords) {
+	constexpr uint64_t MASK = (1 << 21) - 1;
+	return ((uint64_t)coords.x & MASK) << 42 | ((uint64_t)coords.y & MASK) << 21 | ((uint64_t)coords.z & MASK);
+}
+
+static uint64_t splitmix64(uint64_t x) {
+	x += 0x9E3779B97F4A7C15;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+	return x ^ (x >> 31);
+}
+
+ChunkedWorld::ChunkedWorld(const WorldOptions &options)
+		: options(options), generators(options.thread_count) {
+	const int r = options.load_radius;
+	for (int x = -r; x <= r; ++x) {
+		for (int y = -r; y <= r; ++y) {
+			for (int z = -r; z <= r; ++z) {
+				if (x * x + y * y + z * z <= r * r) {
+					load_offsets.push_back({x, y, z});
+				}
+			}
+		}
+	}
+	std::sort(load_offsets.begin(), load_offsets.end(), [](const glm::ivec3 &a, const glm::ivec3 &b) {
+		return glm::dot(a, a) < glm::dot(b, b);
+	});
+	if (options.max_chunks < (int)load_offsets.size()) {
+		throw std::runtime_error(
+				"World chunk budget of " + to_string(options.max_chunks) + " is less than the "
+				+ to_string(load_offsets.size()) + " chunks within the load radius");
+	}
+
+	for (int slot = options.max_chunks - 1; slot >= 0; --slot) {
+		free_slots.push_back(slot);
+	}
+	LOG(INFO) << "Chunked world with " << options.max_chunks << " chunks of " << options.objects_per_chunk
+						<< " objects, generated on " << generators.thread_count() << " threads";
+}
+
+void ChunkedWorld::focus(const glm::vec3 &position) {
+	recent_positions.push_back(position);
+	while ((int)recent_positions.size() > options.recent_position_count) {
+		recent_positions.pop_front();
+	}
+	request_around(position);
+}
+
+void ChunkedWorld::update(const UploadFunction &upload) {
+	std::vector<std::pair<uint64_t, SceneBuffer>> generated;
+	{
+		std::lock_guard<std::mutex> lock(generated_mut);
+		generated.swap(generated_chunks);
+	}
+	for (auto &[key, objects] : generated) {
+		auto it = chunks.find(key);
+		if (it == chunks.end() || it->second.state != ChunkState::PENDING) {
+			continue;
+		}
+		Chunk &chunk = it->second;
+		const int slot = acquire_slot(priority(chunk.coords));
+		if (slot < 0) {
+			// Less relevant than everything resident. It is generated again if it is
+			// ever needed.
+			chunks.erase(it);
+			continue;
+		}
+		upload(slot, objects);
+		chunk.state = ChunkState::RESIDENT;
+		chunk.slot = slot;
+		chunk.count = objects.positions.size();
+		is_resident_chunks_dirty = true;
+	}
+}
+
+void ChunkedWorld::load_around(const glm::vec3 &position, const UploadFunction &upload) {
+	focus(position);
+	required_center = chunk_coords(position);
+	while (true) {
+		update(upload);
+		if (request_around(position)) {
+			break;
+		}
+		std::unique_lock<std::mutex> lock(generated_mut);
+		chunk_generated.wait(lock, [this] { return !generated_chunks.empty(); });
+	}
+	required_center.reset();
+}
+
+const std::vector<ChunkedWorld::ResidentChunk> &ChunkedWorld::resident_chunks() {
+	if (is_resident_chunks_dirty) {
+		_resident_chunks.clear();
+		for (const auto &[key, chunk] : chunks) {
+			if (chunk.state == ChunkState::RESIDENT) {
+				_resident_chunks.push_back({chunk.slot, chunk.count});
+			}
+		}
+		is_resident_chunks_dirty = false;
+	}
+	return _resident_chunks;
+}
+
+// Clamped to well past the bounds, so that positions out there can't overflow
+// the coordinates, nor can the offsets around them.
+glm::ivec3 ChunkedWorld::chunk_coords(const glm::vec3 &position) const {
+	const float limit = 2.0f * COORD_LIMIT;
+	return glm::ivec3(glm::clamp(glm::floor(position / options.chunk_size), -limit, limit));
+}
+
+// Lower is more relevant. Distance from the center of the chunk to the nearest
+// recent position, or negative for the chunks required by load_around().
+float ChunkedWorld::priority(const glm::ivec3 &coords) const {
+	if (required_center) {
+		const glm::ivec3 offset = coords - *required_center;
+		if (glm::dot(offset, offset) <= options.load_radius * options.load_radius) {
+			return -1.0f;
+		}
+	}
+	const glm::vec3 center = (glm::vec3(coords) + 0.5f) * options.chunk_size;
+	float distance = INFINITY;
+	for (const glm::vec3 &position : recent_positions) {
+		distance = std::min(distance, glm::distance(center, position));
+	}
+	return distance;
+}
+
+// Starts generating the missing chunks around the position. Returns whether
+// all of them are already resident. Chunks out of bounds are skipped.
+bool ChunkedWorld::request_around(const glm::vec3 &position) {
+	const glm::ivec3 center = chunk_coords(position);
+	bool is_all_resident = true;
+	for (const glm::ivec3 &offset : load_offsets) {
+		const glm::ivec3 coords = center + offset;
+		if (!is_in_bounds(coords)) {
+			continue;
+		}
+		const uint64_t key = chunk_key(coords);
+		auto [it, is_new] = chunks.try_emplace(key, Chunk{coords});
+		if (is_new) {
+			generators.submit([this, key, coords] {
+				SceneBuffer objects = generate(coords);
+				std::lock_guard<std::mutex> lock(generated_mut);
+				generated_chunks.emplace_back(key, std::move(objects));
+				chunk_generated.notify_all();
+			});
+		}
+		is_all_resident &= it->second.state == ChunkState::RESIDENT;
+	}
+	return is_all_resident;
+}
+
+// Returns a free slot, evicting the least relevant resident chunk if it is
+// less relevant than the given priority, or -1 if there is no such chunk.
+int ChunkedWorld::acquire_slot(float priority) {
+	if (!free_slots.empty()) {
+		const int slot = free_slots.back();
+		free_slots.pop_back();
+		return slot;
+	}
+	auto evicted = chunks.end();
+	float evicted_priority = priority;
+	for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+		if (it->second.state != ChunkState::RESIDENT) {
+			continue;
+		}
+		const float p = this->priority(it->second.coords);
+		if (p > evicted_priority) {
+			evicted = it;
+			evicted_priority = p;
+		}
+	}
+	if (evicted == chunks.end()) {
+		return -1;
+	}
+	const int slot = evicted->second.slot;
+	chunks.erase(evicted);
+	is_resident_chunks_dirty = true;
+	return slot;
+}
+
+// Deterministic in the seed of the world and the coordinates of the chunk, so
+// an evicted chunk comes back the same.
+SceneBuffer ChunkedWorld::generate(const glm::ivec3 &coords) const {
+	SceneRandom rng(splitmix64(options.seed ^ splitmix64(chunk_key(coords))));
+	const glm::vec3 origin = glm::vec3(coords) * options.chunk_size;
+	const float size = options.chunk_size;
+	SceneBuffer objects;
+	objects.positions.reserve(options.objects_per_chunk);
+	objects.scales.reserve(options.objects_per_chunk);
+	objects.colors.reserve(options.objects_per_chunk);
+	objects.phases.reserve(options.objects_per_chunk);
+	for (int i = 0; i < options.objects_per_chunk; ++i) {
+		const glm::vec3 offset = {rng.uniform(0, size), rng.uniform(0, size), rng.uniform(0, size)};
+		const float scale = rng.uniform(0.2f, 4.0f);
+		const glm::vec3 color = {rng.uniform(0, 1), rng.uniform(0, 1), rng.uniform(0, 1)};
+		const float phase = rng.uniform(-10, 10);
+		objects.push(origin + offset, scale, color, phase);
+	}
+	return objects;
+}
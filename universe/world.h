@@ -0,0 +1,115 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <common_cpp/thread_pool.h>
+
+#include "common.h"
+#include "math.h"
+#include "scene.h"
+
+struct WorldOptions {
+	// Maximum number of chunks resident at once, which bounds the memory use.
+	// The procedural world is off if 0.
+	int max_chunks = 0;
+	uint64_t seed = 1;
+	// Edge length of the cubic chunks.
+	float chunk_size = 64.0f;
+	int objects_per_chunk = 256;
+	// Chunks within this many chunk lengths of a recent position are loaded.
+	int load_radius = 2;
+	// How many of the latest positions count as recent.
+	int recent_position_count = 8;
+	// Generator threads. As many as hardware threads if 0.
+	int thread_count = 0;
+};
+
+// Unbounded world split into cubic chunks, each generated procedurally from its
+// own seed, so that only the chunks around the positions skyboxes were recently
+// requested from need to be resident.
+//
+// Chunks are generated on a thread pool. Generated chunks get a slot, a fixed
+// range of objects_per_chunk instances in the GPU buffers, through the upload
+// callback. When all slots are taken, the chunk farthest from every recent
+// position is evicted.
+//
+// Chunks are keyed by their coordinates packed into 21 bits each, so the world
+// is only unbounded up to COORD_LIMIT chunks from the origin along each axis.
+// There are no chunks beyond, rather than chunks aliasing those on the other
+// side.
+//
+// Only accessed from the render thread.
+class ChunkedWorld {
+public:
+	typedef std::function<void(int slot, const SceneBuffer &objects)> UploadFunction;
+
+	// Chunk coordinates are in [-COORD_LIMIT, COORD_LIMIT).
+	static constexpr int COORD_LIMIT = 1 << 20;
+
+	struct ResidentChunk {
+		int slot;
+		int count;
+	};
+
+	const WorldOptions options;
+
+	ChunkedWorld(const WorldOptions &options);
+	ChunkedWorld(const ChunkedWorld &) = delete;
+
+	// Records a position of interest and starts generating the missing chunks
+	// around it.
+	void focus(const glm::vec3 &position);
+
+	// Uploads the chunks that have been generated since the last call.
+	void update(const UploadFunction &upload);
+
+	// Like update(), but blocks until all the chunks around the position are
+	// resident.
+	void load_around(const glm::vec3 &position, const UploadFunction &upload);
+
+	const std::vector<ResidentChunk> &resident_chunks();
+
+private:
+	enum class ChunkState {
+		PENDING,
+		RESIDENT,
+	};
+
+	struct Chunk {
+		glm::ivec3 coords;
+		ChunkState state = ChunkState::PENDING;
+		int slot = -1;
+		int count = 0;
+	};
+
+	std::unordered_map<uint64_t, Chunk> chunks;
+	std::vector<int> free_slots;
+	std::deque<glm::vec3> recent_positions;
+	// Offsets of the chunks within the load radius, nearest first.
+	std::vector<glm::ivec3> load_offsets;
+	std::vector<ResidentChunk> _resident_chunks;
+	bool is_resident_chunks_dirty = true;
+	// While loading around a position, the chunks there take precedence over
+	// any others.
+	std::optional<glm::ivec3> required_center;
+
+	std::mutex generated_mut;
+	std::condition_variable chunk_generated;
+	std::vector<std::pair<uint64_t, SceneBuffer>> generated_chunks;
+
+	// Last, so that it is destroyed first and its jobs can't touch anything
+	// destroyed already.
+	ThreadPool generators;
+
+	glm::ivec3 chunk_coords(const glm::vec3 &position) const;
+	float priority(const glm::ivec3 &coords) const;
+	bool request_around(const glm::vec3 &position);
+	int acquire_slot(float priority);
+	SceneBuffer generate(const glm::ivec3 &coords) const;
+};